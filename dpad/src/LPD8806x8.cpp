@@ -65,134 +65,17 @@
 */
 
 
-#include <SPI.h>
 #include "LPD8806x8.h"
 
-#define PORT1_DATAf( x ) PORT ## x
-#define fPORT1_DATAf( x ) PORT1_DATAf( x )
-#define PORT1_DATA  fPORT1_DATAf( LPD_PORT1 )
-
-#define PORT2_DATAf( x ) PORT ## x
-#define fPORT2_DATAf( x ) PORT2_DATAf( x )
-#define PORT2_DATA  fPORT2_DATAf( LPD_PORT2 )
-
-#define CONTROL_DATAf( x ) PORT ## x
-#define fCONTROL_DATAf( x ) CONTROL_DATAf( x )
-#define CONTROL_PORT  fCONTROL_DATAf( LPD_CONTROL_PORT )
-
-
-#define PORT1_DDRf( x ) DDR ## x
-#define fPORT1_DDRf( x ) PORT1_DDRf( x )
-#define PORT1_DDR  fPORT1_DDRf( LPD_PORT1 )
-
-#define PORT2_DDRf( x ) DDR ## x
-#define fPORT2_DDRf( x ) PORT2_DDRf( x )
-#define PORT2_DDR  fPORT2_DDRf( LPD_PORT2 )
-
-#define CONTROL_DDRf( x ) DDR ## x
-#define fCONTROL_DDRf( x ) CONTROL_DDRf( x )
-#define CONTROL_DDR  fCONTROL_DDRf( LPD_CONTROL_PORT )
-
-/*****************************************************************************/
-
-// via Michael Vogt/neophob: empty constructor is used when strip length
-// isn't known at compile-time; situations where program config might be
-// read from internal flash memory or an SD card, or arrive via serial
-// command.  If using this constructor, MUST follow up with updateLength()
-// and updatePins() to establish the strip length and output pins!
-LPD8806x8::LPD8806x8(void) {
-  updatePins(); // Must assume hardware SPI until pins are set
-}
-
-// update the directions of the ports
-void LPD8806x8::updatePins() {
-  PORT1_DDR = 0xff;
-  PORT2_DDR = 0xff;
-
-  CONTROL_DDR = 0xff;
-  CLOCK_DISABLE();
-  UNSELECT_STRIPS();
-}
-
-void LPD8806x8::show(const StripImage* img, const Palette* pal) {
-
-  for (uint8_t n = 0; n < 128; ++n) {
-    for (uint8_t ix = 0; ix < 3; ++ix) {
-      // Load the data into all of the shift registers.
-      PORT1_DATA = pal->_c[img->_c[n]].grb[ix];
-      PORT2_DATA = pal->_c[img->_c[n]].grb[ix];
-      LOAD_STRIP(0);
-      UNSELECT_STRIPS();
-      
-      clockOutputs();
-    }
-  }
-
-  for (int i = 0; i < LATCH_BYTES; ++i) {
-    PORT1_DATA = 0;
-    PORT2_DATA = 0;
-    LOAD_STRIP(0);
-    UNSELECT_STRIPS();
-
-    clockOutputs();
-  }
-}
-
-void LPD8806x8::show(const Image* img, const Palette* pal) {
-
-  CLOCK_DISABLE();
-  for (uint8_t n = 0; n < STRIP_LENGTH; ++n) {
-    for (uint8_t ix = 0; ix < 3; ++ix) {
-
-      // Load the data into all of the shift registers.
-      PORT1_DATA = pal->_c[img->_c[0][n]].grb[ix];
-      PORT2_DATA = pal->_c[img->_c[4][n]].grb[ix];
-      LOAD_STRIP(0);
-      UNSELECT_STRIPS();
-
-      PORT1_DATA = pal->_c[img->_c[1][n]].grb[ix];
-      PORT2_DATA = pal->_c[img->_c[5][n]].grb[ix];
-      LOAD_STRIP(1);
-      UNSELECT_STRIPS();
-
-      PORT1_DATA = pal->_c[img->_c[2][n]].grb[ix];
-      PORT2_DATA = pal->_c[img->_c[6][n]].grb[ix];
-      LOAD_STRIP(2);
-      UNSELECT_STRIPS();
-
-      PORT1_DATA = pal->_c[img->_c[3][n]].grb[ix];
-      PORT2_DATA = pal->_c[img->_c[7][n]].grb[ix];
-      LOAD_STRIP(3);
-      UNSELECT_STRIPS();
-
-      clockOutputs();
-    }
-  }
-    
-  for (int i = 0; i < LATCH_BYTES; ++i) {
-    for (int j = 0; j < 4; ++j) {
-      PORT1_DATA = 0;
-      PORT2_DATA = 0;
-      LOAD_STRIP(j);
-      UNSELECT_STRIPS();
-    }
-
-    clockOutputs();
-  }
-}
-
-inline void LPD8806x8::clockOutputs()
-{
-  // Here, we need to keep the load inhibit pin high, but the select bits
-  // don't matter.
-  CLOCK_ENABLE();
-  CLOCK_HIGH();
-  
-  for (uint8_t i = 0; i < 7; ++i) {
-    CLOCK_LOW();
-    CLOCK_HIGH();
-  }
-
-  CLOCK_LOW();
-  CLOCK_DISABLE();
-}
+// The driver and compiled frame are templates defined in the header. The
+// default panel is instantiated once here; other geometries are instantiated
+// wherever they're used.
+template class BasicCompiledFrame<Panel32x32>;
+
+#ifdef __AVR__
+template class BasicLPD8806x8<AvrPorts>;
+template class BasicLPD8806x8<AvrSpiPorts>;
+#else
+template class BasicLPD8806x8<SimPorts>;
+template class BasicLPD8806x8<SimSpiPorts>;
+#endif
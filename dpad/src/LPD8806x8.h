@@ -3,60 +3,504 @@
 
 #include <Arduino.h>
 #include "image.h"
+#include "lpd_ports.h"
 
-const uint8_t STRIP_LENGTH = 128;
-const uint8_t LATCH_BYTES = (STRIP_LENGTH + 31) / 32;
+/**
+ * An Image with all of its palette lookups already resolved, stored in exactly
+ * the order the bytes are sent out to the shift registers. Showing a compiled
+ * frame is a linear walk over _d with no lookups.
+ */
+template <class Geometry>
+class BasicCompiledFrame
+{
+public:
+  static const uint16_t STRIP_LENGTH = Geometry::STRIP_LENGTH;
 
-/// PC0 - 37
-/// PC7 - 30
+  /**
+   * Number of bytes loaded into the shift registers for each color component
+   * of each LED: one per strip, in the order they are loaded (strip k on port
+   * 1, then strip k + STRIPS/2 on port 2, for each shift register in use).
+   */
+  static const uint8_t GROUP_BYTES = Geometry::STRIPS;
 
-// PA0 - 22
-// PA7 - 29
+  BasicCompiledFrame()
+    : _pal(NULL), _pal_generation(0), _dirty(STRIP_LENGTH),
+      _scanning(false) { }
 
-// PL0 - 49
-// PL7 - 42
+  /**
+   * Resolve the pixels of the image through the palette. Only the dirty part
+   * of the image is recompiled, unless the palette has changed since the
+   * last compile. The image's dirty region is consumed. Images of any pixel
+   * depth can be compiled.
+   *
+   * The frame can't change while it's being scanned out (see
+   * BasicLPD8806x8::begin_show()). Until then this does nothing, leaves the
+   * image dirty and returns false.
+   */
+  template <uint8_t BPP>
+  bool compile(BasicImage<Geometry, BPP>* img, const Palette* pal);
 
-#define LPD_PORT1         C
-#define LPD_PORT2         A
-#define LPD_CONTROL_PORT  L
+  /**
+   * Number of LEDs on each strip that have changed since the frame was last
+   * shown.
+   */
+  uint16_t dirty_length() const {
+    return _dirty;
+  }
 
-/**
- * We only use 7 bits of the control port, but reserve the whole thing just in
- * case.
- */
-/**
- * 0-3: select-bits
- * 4: Clock Bit
- * 5: Clock Inhibit Bit
- */
-#define SELECT_STRIP0               0xfe
-#define SELECT_STRIP1               0xfd
-#define SELECT_STRIP2               0xfb
-#define SELECT_STRIP3               0xf7
-#define SELECT_MASK                 0x0f
-#define CLOCK_HIGH_BIT              0x10
-#define CLOCK_INHIBIT_HIGH_BIT      0x20
+  /**
+   * Force the next show() to push the whole frame.
+   */
+  void invalidate() {
+    _dirty = STRIP_LENGTH;
+  }
+
+  /**
+   * True while the frame is being scanned out.
+   */
+  bool busy() const {
+    return _scanning;
+  }
 
-#define CLOCK_HIGH() CONTROL_PORT |= CLOCK_HIGH_BIT
-#define CLOCK_LOW() CONTROL_PORT &= ~CLOCK_HIGH_BIT
-#define CLOCK_ENABLE() CONTROL_PORT &= ~CLOCK_INHIBIT_HIGH_BIT
-#define CLOCK_DISABLE() CONTROL_PORT |= CLOCK_INHIBIT_HIGH_BIT
+private:
+  template <class Ports, class G> friend class BasicLPD8806x8;
+  uint8_t _d[STRIP_LENGTH * 3 * GROUP_BYTES];
 
-#define LOAD_STRIP(x) CONTROL_PORT &= 0xff - (1 << x)
-#define UNSELECT_STRIPS() CONTROL_PORT |= SELECT_MASK
+  const Palette* _pal;
+  uint16_t _pal_generation;
+  uint16_t _dirty;
+  volatile bool _scanning;
+};
 
 
-class LPD8806x8 {
+/**
+ * Driver for up to 8 strips fed through shift registers on two data ports.
+ * The first half of the strips are on port 1 and the second half on port 2,
+ * one shift register each. All port access goes through the Ports backend
+ * (see lpd_ports.h), and the panel layout comes from the Geometry (see
+ * panel.h).
+ */
+template <class Ports, class Geometry = Panel32x32>
+class BasicLPD8806x8 {
  public:
-  LPD8806x8(void); // Empty constructor; init pins & strip length later
-  void show(const Image* i, const Palette* p);
+  static_assert(Geometry::STRIPS % 2 == 0 && Geometry::STRIPS <= 8,
+                "strips are split evenly over 4 shift registers per port");
+
+  static const uint16_t STRIP_LENGTH = Geometry::STRIP_LENGTH;
+  static const uint8_t LATCH_BYTES = (STRIP_LENGTH + 31) / 32;
+  static const uint8_t REGISTERS = Geometry::STRIPS / 2;
+
+  BasicLPD8806x8(void); // Empty constructor; init pins & strip length later
+
+  /**
+   * Push the image out through the palette. Nothing is sent if neither has
+   * changed since the last call, and only the dirty part of the image is sent
+   * if the palette is unchanged. The image's dirty region is consumed.
+   */
+  template <uint8_t BPP>
+  void show(BasicImage<Geometry, BPP>* i, const Palette* p);
   void show(const StripImage* i, const Palette* p);
 
+  /**
+   * Push out the part of the frame that changed since it was last shown.
+   * busy() stays false meanwhile, so a timer calling service() leaves the
+   * ports alone until it's done.
+   */
+  void show(BasicCompiledFrame<Geometry>* f);
+
+  /**
+   * Scanout in the background. begin_show() starts pushing out the part of
+   * the frame that changed, and returns right away; the frame is then sent a
+   * slice at a time, either from a timer interrupt calling service(), or
+   * cooperatively from the main loop calling scan(). Don't mix the two,
+   * unless the timer's interrupt is masked around each scan(), and don't call
+   * any of the show() functions until the scanout is done.
+   */
+  void begin_show(BasicCompiledFrame<Geometry>* f);
+
+  /**
+   * Send up to 'groups' byte groups (one color component of one LED on every
+   * strip, or a latch byte). Returns true if there's more to send.
+   */
+  bool scan(uint16_t groups);
+
+  /**
+   * Send the next SCAN_GROUPS groups. Meant to be called from a timer
+   * interrupt.
+   */
+  void service() {
+    scan(SCAN_GROUPS);
+  }
+
+  bool busy() const {
+    return _scan_busy;
+  }
+
+  /**
+   * Groups sent so far out of scan_total(), in the current or last scanout.
+   */
+  uint16_t progress() const;
+
+  uint16_t scan_total() const {
+    return _scan_total;
+  }
+
+  /**
+   * Wait for the scanout to finish, the way one would wait for vsync. The
+   * frame is free to be compiled again afterwards. Only makes sense if a
+   * timer is calling service().
+   */
+  void wait() const {
+    while (_scan_busy)
+      ;
+  }
+
+  /**
+   * Groups sent per service() call. At about 8 us a group, 8 keeps each
+   * interrupt short enough not to hold up the serial port.
+   */
+  static const uint8_t SCAN_GROUPS = 8;
+
  private:
   void updatePins(void);
+  void latch();
+  void latchByte();
+  bool startScan(BasicCompiledFrame<Geometry>* f);
+  bool scanGroups(uint16_t groups);
+
+  const Palette* _last_pal;
+  uint16_t _last_pal_generation;
 
+  // Background scanout.
+  BasicCompiledFrame<Geometry>* _scan_frame;
+  const uint8_t* _scan;
+  const uint8_t* _scan_end;
+  uint8_t _scan_latch;
+  uint16_t _scan_total;
+  volatile uint16_t _scan_sent;
+  volatile bool _scan_busy;
+
+  inline void loadRegister(uint8_t k, uint8_t a, uint8_t b);
+  inline void loadGroups(const uint8_t* d);
   inline void clockOutputs();
 };
 
+/*****************************************************************************/
+
+template <class Geometry>
+template <uint8_t BPP>
+bool BasicCompiledFrame<Geometry>::compile(BasicImage<Geometry, BPP>* img,
+                                           const Palette* pal)
+{
+  if (_scanning)
+    return false;
+
+  uint16_t length = img->dirty_length();
+  if (pal != _pal || pal->generation() != _pal_generation) {
+    length = STRIP_LENGTH;
+    _pal = pal;
+    _pal_generation = pal->generation();
+  }
+  img->clear_dirty();
+
+  if (length > _dirty)
+    _dirty = length;
+
+  typedef BasicImage<Geometry, BPP> image_type;
+  const uint8_t per_byte = image_type::PIXELS_PER_BYTE;
+  const uint8_t half = GROUP_BYTES / 2;
+  uint8_t* d = _d;
+  for (uint16_t n = 0; n < length; n += per_byte) {
+    // Unpack a whole byte of each strip at a time.
+    uint8_t indices[GROUP_BYTES][per_byte];
+    uint16_t o = n / per_byte;
+    for (uint8_t k = 0; k < half; ++k) {
+      image_type::unpack_byte(img->_c[k][o], indices[2*k]);
+      image_type::unpack_byte(img->_c[k + half][o], indices[2*k + 1]);
+    }
+
+    uint8_t count = length - n < per_byte ? length - n : per_byte;
+    for (uint8_t p = 0; p < count; ++p) {
+      const uint8_t* c[GROUP_BYTES];
+      for (uint8_t k = 0; k < GROUP_BYTES; ++k)
+        c[k] = pal->get(indices[k][p]).grb;
+
+      for (uint8_t ix = 0; ix < 3; ++ix)
+        for (uint8_t k = 0; k < GROUP_BYTES; ++k)
+          *d++ = c[k][ix];
+    }
+  }
+
+  return true;
+}
+
+// via Michael Vogt/neophob: empty constructor is used when strip length
+// isn't known at compile-time; situations where program config might be
+// read from internal flash memory or an SD card, or arrive via serial
+// command.  If using this constructor, MUST follow up with updateLength()
+// and updatePins() to establish the strip length and output pins!
+template <class Ports, class Geometry>
+BasicLPD8806x8<Ports, Geometry>::BasicLPD8806x8(void)
+  : _last_pal(NULL), _last_pal_generation(0), _scan_frame(NULL),
+    _scan(NULL), _scan_end(NULL), _scan_latch(0), _scan_total(0),
+    _scan_sent(0), _scan_busy(false) {
+  updatePins(); // Must assume hardware SPI until pins are set
+}
+
+// update the directions of the ports
+template <class Ports, class Geometry>
+void BasicLPD8806x8<Ports, Geometry>::updatePins() {
+  Ports::setup();
+}
+
+template <class Ports, class Geometry>
+void BasicLPD8806x8<Ports, Geometry>::show(const StripImage* img,
+                                           const Palette* pal) {
+
+  for (uint8_t n = 0; n < 128; ++n) {
+    for (uint8_t ix = 0; ix < 3; ++ix) {
+      // Load the data into all of the shift registers.
+      uint8_t v = pal->get(img->_c[n]).grb[ix];
+      Ports::clock_end();
+      loadRegister(0, v, v);
+
+      clockOutputs();
+    }
+  }
+
+  for (int i = 0; i < (128 + 31) / 32; ++i) {
+    Ports::clock_end();
+    loadRegister(0, 0, 0);
+
+    clockOutputs();
+  }
+  Ports::clock_end();
+}
+
+template <class Ports, class Geometry>
+template <uint8_t BPP>
+void BasicLPD8806x8<Ports, Geometry>::show(BasicImage<Geometry, BPP>* img,
+                                           const Palette* pal) {
+
+  uint16_t length = img->dirty_length();
+  if (pal != _last_pal || pal->generation() != _last_pal_generation) {
+    length = STRIP_LENGTH;
+    _last_pal = pal;
+    _last_pal_generation = pal->generation();
+  }
+  img->clear_dirty();
+
+  if (length == 0)
+    return;
+
+  typedef BasicImage<Geometry, BPP> image_type;
+  const uint8_t per_byte = image_type::PIXELS_PER_BYTE;
+  Ports::control(CONTROL_IDLE);
+  for (uint16_t n = 0; n < length; n += per_byte) {
+    // Unpack a whole byte of each strip at a time, once for all three color
+    // components of its LEDs.
+    uint8_t a[REGISTERS][per_byte], b[REGISTERS][per_byte];
+    uint16_t o = n / per_byte;
+    for (uint8_t k = 0; k < REGISTERS; ++k) {
+      image_type::unpack_byte(img->_c[k][o], a[k]);
+      image_type::unpack_byte(img->_c[k + REGISTERS][o], b[k]);
+    }
+
+    uint8_t count = length - n < per_byte ? length - n : per_byte;
+    for (uint8_t p = 0; p < count; ++p)
+      for (uint8_t ix = 0; ix < 3; ++ix) {
+        // Look the group up while the last one is still shifting out.
+        uint8_t g[Geometry::STRIPS];
+        for (uint8_t k = 0; k < REGISTERS; ++k) {
+          g[2*k]     = pal->get(a[k][p]).grb[ix];
+          g[2*k + 1] = pal->get(b[k][p]).grb[ix];
+        }
+
+        loadGroups(g);
+        clockOutputs();
+      }
+  }
+
+  latch();
+  Ports::clock_end();
+}
+
+template <class Ports, class Geometry>
+void BasicLPD8806x8<Ports, Geometry>::show(BasicCompiledFrame<Geometry>* f) {
+  // Scan out without setting _scan_busy, so that service() from the timer
+  // returns straight away instead of sending from the same frame.
+  if (startScan(f))
+    while (scanGroups(0xffff))
+      ;
+}
+
+template <class Ports, class Geometry>
+void BasicLPD8806x8<Ports, Geometry>::begin_show(
+  BasicCompiledFrame<Geometry>* f) {
+  if (!startScan(f))
+    return;
+
+  // Everything startScan() set up has to be in place before a timer
+  // interrupt can see the scanout start.
+  asm volatile("" ::: "memory");
+  _scan_busy = true;
+}
+
+/**
+ * Set up a scanout of the dirty part of the frame. Returns false if there's
+ * nothing to send.
+ */
+template <class Ports, class Geometry>
+bool BasicLPD8806x8<Ports, Geometry>::startScan(
+  BasicCompiledFrame<Geometry>* f) {
+  if (f->_dirty == 0)
+    return false;
+
+  const uint8_t group = BasicCompiledFrame<Geometry>::GROUP_BYTES;
+
+  // LEDs past the dirty region keep whatever they latched last time, so the
+  // latch can come early.
+  _scan_frame = f;
+  _scan = f->_d;
+  _scan_end = _scan + f->_dirty * 3 * group;
+  _scan_latch = LATCH_BYTES;
+  _scan_total = f->_dirty * 3 + LATCH_BYTES;
+  _scan_sent = 0;
+  f->_dirty = 0;
+  f->_scanning = true;
+
+  Ports::control(CONTROL_IDLE);
+  return true;
+}
+
+template <class Ports, class Geometry>
+bool BasicLPD8806x8<Ports, Geometry>::scan(uint16_t groups) {
+  if (!_scan_busy)
+    return false;
+
+  if (!scanGroups(groups))
+    _scan_busy = false;
+  return _scan_busy;
+}
+
+/**
+ * Send up to 'groups' groups of the scanout startScan() set up. Returns true
+ * if there's more to send.
+ */
+template <class Ports, class Geometry>
+bool BasicLPD8806x8<Ports, Geometry>::scanGroups(uint16_t groups) {
+  const uint8_t group = BasicCompiledFrame<Geometry>::GROUP_BYTES;
+  uint16_t sent = _scan_sent;
+
+  for (; groups > 0 && _scan != _scan_end; --groups, ++sent) {
+    loadGroups(_scan);
+    _scan += group;
+    clockOutputs();
+  }
+
+  for (; groups > 0 && _scan_latch > 0; --groups, ++sent) {
+    latchByte();
+    --_scan_latch;
+  }
+
+  _scan_sent = sent;
+  if (_scan_latch > 0)
+    return true;
+
+  Ports::clock_end();
+  _scan_frame->_scanning = false;
+  _scan_frame = NULL;
+  return false;
+}
+
+template <class Ports, class Geometry>
+uint16_t BasicLPD8806x8<Ports, Geometry>::progress() const {
+  // service() may change the count between the two halves of a read; read
+  // until two agree.
+  uint16_t a, b;
+  do {
+    a = _scan_sent;
+    b = _scan_sent;
+  } while (a != b);
+  return a;
+}
+
+template <class Ports, class Geometry>
+void BasicLPD8806x8<Ports, Geometry>::latch()
+{
+  for (uint8_t i = 0; i < LATCH_BYTES; ++i)
+    latchByte();
+}
+
+template <class Ports, class Geometry>
+void BasicLPD8806x8<Ports, Geometry>::latchByte()
+{
+  Ports::clock_end();
+  for (uint8_t j = 0; j < REGISTERS; ++j)
+    loadRegister(j, 0, 0);
+
+  clockOutputs();
+}
+
+template <class Ports, class Geometry>
+inline void BasicLPD8806x8<Ports, Geometry>::loadRegister(uint8_t k,
+                                                          uint8_t a,
+                                                          uint8_t b)
+{
+  Ports::data(a, b);
+  Ports::control(CONTROL_LOAD(k));
+  Ports::control(CONTROL_IDLE);
+}
+
+/**
+ * Load one group of bytes (port 1 and port 2 for each register in turn) into
+ * the shift registers in use. The register count is a constant, so the unused
+ * loads drop out.
+ *
+ * Everything is read, and the first pair put on the data ports, before
+ * waiting for the last byte to finish shifting out; with a hardware clock
+ * that all happens in the shadow of the shift.
+ */
+template <class Ports, class Geometry>
+inline void BasicLPD8806x8<Ports, Geometry>::loadGroups(const uint8_t* d)
+{
+  uint8_t a0 = d[0], b0 = d[1];
+  uint8_t a1 = REGISTERS > 1 ? d[2] : 0, b1 = REGISTERS > 1 ? d[3] : 0;
+  uint8_t a2 = REGISTERS > 2 ? d[4] : 0, b2 = REGISTERS > 2 ? d[5] : 0;
+  uint8_t a3 = REGISTERS > 3 ? d[6] : 0, b3 = REGISTERS > 3 ? d[7] : 0;
+
+  Ports::data(a0, b0);
+  Ports::clock_end();
+
+  Ports::control(CONTROL_LOAD(0));
+  Ports::control(CONTROL_IDLE);
+  if (REGISTERS > 1)
+    loadRegister(1, a1, b1);
+  if (REGISTERS > 2)
+    loadRegister(2, a2, b2);
+  if (REGISTERS > 3)
+    loadRegister(3, a3, b3);
+}
+
+/**
+ * Start shifting the loaded bytes out to the strips. The whole control port
+ * is ours, so the backends store final values directly rather than masking
+ * bits in and out.
+ */
+template <class Ports, class Geometry>
+inline void BasicLPD8806x8<Ports, Geometry>::clockOutputs()
+{
+  Ports::clock_begin();
+}
+
+typedef BasicCompiledFrame<Panel32x32> CompiledFrame;
+extern template class BasicCompiledFrame<Panel32x32>;
+
+#ifdef __AVR__
+typedef BasicLPD8806x8<AvrPorts> LPD8806x8;
+typedef BasicLPD8806x8<AvrSpiPorts> LPD8806x8Spi;
+extern template class BasicLPD8806x8<AvrPorts>;
+extern template class BasicLPD8806x8<AvrSpiPorts>;
+#endif
 
 #endif
@@ -0,0 +1,70 @@
+#ifndef ASSET_FORMAT_H__
+#define ASSET_FORMAT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "frame_packets.h"
+
+/**
+ * Layout of palettes, images and animations on the smart card (see
+ * libraries/SmartCard), so the panel can start up showing something without
+ * waiting for the serial link:
+ *
+ *   'd', 'A', version, count, length (2 bytes), CRC (2 bytes)
+ *   count directory entries: type, offset (2 bytes), length (2 bytes)
+ *   the assets
+ *
+ * Multi-byte values are little endian, and offsets are from the start of the
+ * card. 'length' is how much of the card is in use, header and all, and the
+ * CRC is CRC-16-CCITT (as in frame_packets.h) over everything after the
+ * header, so a blank or half written card is never loaded. Assets are
+ * referred to by their position in the directory.
+ *
+ * Images are palette indices in raster order from the top left, like frames
+ * (see frame_packets.h), and like them reach only the first FRAME_COLORS
+ * colors. tools/pack_assets builds a card from the same
+ * files send_frames takes, and writes it through the panel.
+ */
+
+#define ASSET_MAGIC_0           'd'
+#define ASSET_MAGIC_1           'A'
+#define ASSET_VERSION           1
+
+#define ASSET_HEADER_LENGTH     8
+#define ASSET_ENTRY_LENGTH      5
+#define ASSET_CARD_LENGTH       2048
+
+#define ASSET_NONE              0xff
+
+/**
+ * Payload: the first palette index, the number of colors (0 for 256), then
+ * r, g, b for each.
+ */
+#define ASSET_PALETTE           0x01
+/**
+ * Payload: FRAME_PIXELS / 2 bytes, two indices from 0-15 in each, the first
+ * pixel in the low bits.
+ */
+#define ASSET_IMAGE_4BIT        0x02
+/**
+ * Payload: a run-length coded frame, as in PACKET_FRAME_RLE.
+ */
+#define ASSET_IMAGE_RLE         0x03
+/**
+ * Payload: the changes from the image before it in an animation, coded as
+ * in PACKET_FRAME_DELTA. Only makes sense as an animation step.
+ */
+#define ASSET_IMAGE_DELTA       0x04
+/**
+ * Payload: a palette asset (or ASSET_NONE), the number of steps, then for
+ * each step an image asset and how long to show it in ms (2 bytes). The
+ * steps loop.
+ */
+#define ASSET_ANIMATION         0x05
+
+#define ASSET_ANIMATION_HEADER  2
+#define ASSET_STEP_LENGTH       3
+
+#define ASSET_IMAGE_4BIT_LENGTH (FRAME_PIXELS / 2)
+
+#endif
@@ -0,0 +1,405 @@
+#include <Arduino.h>
+#include "asset_loader.h"
+
+static_assert(Image4::WIDTH == FRAME_WIDTH && Image4::HEIGHT == FRAME_HEIGHT,
+              "images are stored at the size of the panel");
+
+static uint16_t get16(const uint8_t* p)
+{
+  return p[0] | (uint16_t(p[1]) << 8);
+}
+
+AssetLoader::AssetLoader(SmartCard* card)
+  : _card(card), _count(0), _anim(ASSET_NONE), _anim_offset(0),
+    _anim_length(0), _type(0), _offset(0), _length(0), _left(0), _bad(false),
+    _img(NULL), _pixel(0), _op(0), _op_count(0)
+{
+}
+
+bool AssetLoader::begin()
+{
+  uint8_t header[ASSET_HEADER_LENGTH];
+
+  _count = 0;
+  _anim = ASSET_NONE;
+  _img = NULL;
+  _card->seek(0);
+  if (_card->read(header, sizeof(header)) != sizeof(header))
+    return false;
+
+  uint16_t length = get16(header + 4);
+  if (header[0] != ASSET_MAGIC_0 || header[1] != ASSET_MAGIC_1 ||
+      header[2] != ASSET_VERSION || length > ASSET_CARD_LENGTH ||
+      length < ASSET_HEADER_LENGTH + header[3] * ASSET_ENTRY_LENGTH)
+    return false;
+
+  // Read the rest as an asset would be.
+  _left = length - ASSET_HEADER_LENGTH;
+  _bad = false;
+  uint16_t crc = CRC16_INIT;
+  while (more())
+    crc = crc16_update(crc, next());
+  if (_bad || crc != get16(header + 6))
+    return false;
+
+  _count = header[3];
+  return true;
+}
+
+/**
+ * Look up an asset in the directory, and get ready to read it from the
+ * start.
+ */
+bool AssetLoader::open(uint8_t asset)
+{
+  uint8_t entry[ASSET_ENTRY_LENGTH];
+
+  _left = 0;
+  _bad = false;
+  _img = NULL;
+  if (asset >= _count)
+    return false;
+
+  _card->seek(ASSET_HEADER_LENGTH + asset * ASSET_ENTRY_LENGTH);
+  if (_card->read(entry, sizeof(entry)) != sizeof(entry))
+    return false;
+
+  _type = entry[0];
+  _offset = get16(entry + 1);
+  _length = get16(entry + 3);
+  if (uint32_t(_offset) + _length > ASSET_CARD_LENGTH)
+    return false;
+
+  _left = _length;
+  _card->seek(_offset);
+  return true;
+}
+
+/**
+ * The next byte of the asset. Reading past the end gives zeros and marks the
+ * asset bad.
+ */
+uint8_t AssetLoader::next()
+{
+  uint8_t b = 0;
+  if (_left == 0 || _card->read(&b, 1) != 1) {
+    _left = 0;
+    _bad = true;
+    return 0;
+  }
+  --_left;
+  return b;
+}
+
+uint8_t AssetLoader::type(uint8_t asset)
+{
+  return open(asset) ? _type : 0;
+}
+
+uint8_t AssetLoader::find(uint8_t type, uint8_t from)
+{
+  for (uint8_t asset = from; asset < _count; ++asset)
+    if (this->type(asset) == type)
+      return asset;
+  return ASSET_NONE;
+}
+
+bool AssetLoader::load_palette(uint8_t asset, Palette* pal)
+{
+  if (!open(asset) || _type != ASSET_PALETTE || _length < 2)
+    return false;
+
+  uint8_t start = next();
+  uint16_t count = next();
+  if (count == 0)
+    count = 256;
+  if (_length != 2 + 3 * count)
+    return false;
+
+  for (uint16_t i = 0; i < count; ++i) {
+    uint8_t r = next();
+    uint8_t g = next();
+    uint8_t b = next();
+    pal->set_color(start + i, r, g, b);
+  }
+  return !_bad;
+}
+
+/**
+ * Write 'count' pixels from the current position on.
+ */
+void AssetLoader::pixels(uint8_t index, uint8_t count)
+{
+  for (; count > 0; --count, ++_pixel) {
+    if (_pixel >= FRAME_PIXELS || index >= FRAME_COLORS) {
+      _bad = true;
+      return;
+    }
+    _img->set_color(_pixel % FRAME_WIDTH,
+                    FRAME_HEIGHT - 1 - _pixel / FRAME_WIDTH, index);
+  }
+}
+
+/**
+ * Decode one byte of an image. Run-length images use the same codes as
+ * frame packets (see FrameDecoder::code()), and like there, a code's pixels
+ * can come in later calls.
+ */
+void AssetLoader::code(uint8_t b)
+{
+  if (_type == ASSET_IMAGE_4BIT) {
+    pixels(b & 0x0f, 1);
+    pixels(b >> 4, 1);
+    return;
+  }
+
+  if (_op_count > 0) {
+    if (_op == FRAME_OP_LITERAL) {
+      pixels(b, 1);
+      --_op_count;
+    }
+    else {
+      pixels(b, _op_count);
+      _op_count = 0;
+    }
+    return;
+  }
+
+  if (b < FRAME_OP_RUN) {
+    _op = FRAME_OP_LITERAL;
+    _op_count = b - FRAME_OP_LITERAL + 1;
+  }
+  else if (b < FRAME_OP_SKIP) {
+    _op = FRAME_OP_RUN;
+    _op_count = b - FRAME_OP_RUN + 2;
+  }
+  else if (_type == ASSET_IMAGE_DELTA) {
+    _pixel += b - FRAME_OP_SKIP + 1;
+    if (_pixel > FRAME_PIXELS)
+      _bad = true;
+  }
+  else
+    _bad = true;
+}
+
+bool AssetLoader::start_image(uint8_t asset, Image4* img)
+{
+  if (!open(asset))
+    return false;
+  if (_type == ASSET_IMAGE_4BIT) {
+    if (_length != ASSET_IMAGE_4BIT_LENGTH)
+      return false;
+  }
+  else if (_type != ASSET_IMAGE_RLE && _type != ASSET_IMAGE_DELTA)
+    return false;
+
+  _img = img;
+  _pixel = 0;
+  _op_count = 0;
+  _card->prefetch();
+  return true;
+}
+
+uint8_t AssetLoader::load_more(uint16_t budget)
+{
+  return decode(budget, false);
+}
+
+/**
+ * Decode up to 'budget' bytes of the image, waiting for the card if 'wait',
+ * and otherwise stopping short of it.
+ */
+uint8_t AssetLoader::decode(uint16_t budget, bool wait)
+{
+  if (_img == NULL)
+    return LOAD_ERROR;
+
+  // Something else may have moved the card since the last call.
+  uint16_t at = _offset + (_length - _left);
+  if (_card->tell() != at)
+    _card->seek(at);
+
+  for (; budget > 0 && more() && !_bad; --budget) {
+    if (!wait && !_card->ready()) {
+      // Rather than wait, start the line coming in if it isn't, and carry
+      // on next time.
+      if (!_card->busy())
+        _card->prefetch();
+      break;
+    }
+    code(next());
+  }
+  if (more() && !_bad)
+    return LOAD_MORE;
+
+  _img = NULL;
+  return !_bad && _op_count == 0 && _pixel == FRAME_PIXELS ?
+    LOAD_DONE : LOAD_ERROR;
+}
+
+bool AssetLoader::load_image(uint8_t asset, Image4* img)
+{
+  return start_image(asset, img) && decode(_length, true) == LOAD_DONE;
+}
+
+bool AssetLoader::animation(uint8_t asset, uint8_t* palette, uint8_t* steps)
+{
+  _anim = ASSET_NONE;
+  if (!open(asset) || _type != ASSET_ANIMATION ||
+      _length < ASSET_ANIMATION_HEADER)
+    return false;
+
+  *palette = next();
+  *steps = next();
+  if (_bad || *steps == 0 ||
+      _length != ASSET_ANIMATION_HEADER + *steps * ASSET_STEP_LENGTH)
+    return false;
+
+  _anim = asset;
+  _anim_offset = _offset;
+  _anim_length = _length;
+  return true;
+}
+
+bool AssetLoader::animation_step(uint8_t asset, uint8_t step, uint8_t* image,
+                                 uint16_t* hold_ms)
+{
+  uint8_t s[ASSET_STEP_LENGTH], palette, steps;
+  uint16_t at = ASSET_ANIMATION_HEADER + step * ASSET_STEP_LENGTH;
+
+  if (asset != _anim && !animation(asset, &palette, &steps))
+    return false;
+  _left = 0;
+  _img = NULL;
+  if (at + ASSET_STEP_LENGTH > _anim_length)
+    return false;
+
+  _card->seek(_anim_offset + at);
+  if (_card->read(s, sizeof(s)) != sizeof(s))
+    return false;
+  *image = s[0];
+  *hold_ms = get16(s + 1);
+  return true;
+}
+
+void AssetLoader::prefetch_step(uint8_t step)
+{
+  _left = 0;
+  _img = NULL;
+  _card->seek(_anim_offset + ASSET_ANIMATION_HEADER +
+              step * ASSET_STEP_LENGTH);
+  _card->prefetch();
+}
+
+void AssetLoader::prefetch_entry(uint8_t asset)
+{
+  _left = 0;
+  _img = NULL;
+  _card->seek(ASSET_HEADER_LENGTH + asset * ASSET_ENTRY_LENGTH);
+  _card->prefetch();
+}
+
+AssetPlayer::AssetPlayer(AssetLoader* loader, DoubleBuffer<Image4>* images,
+                         Palette* pal)
+  : _loader(loader), _images(images), _pal(pal), _asset(ASSET_NONE),
+    _steps(0), _step(0), _hold(0), _shown(0), _state(AP_FIND), _next_step(0),
+    _next_image(0), _next_hold(0)
+{
+}
+
+bool AssetPlayer::play(uint8_t asset, uint32_t now)
+{
+  uint8_t palette;
+
+  stop();
+  if (!_loader->animation(asset, &palette, &_steps))
+    return false;
+  if (palette != ASSET_NONE && !_loader->load_palette(palette, _pal))
+    return false;
+
+  _asset = asset;
+  _hold = 0;
+  _shown = now;
+  _next_step = 0;
+  _state = AP_FIND;
+  return true;
+}
+
+bool AssetPlayer::update(uint32_t now)
+{
+  if (!playing())
+    return false;
+
+  if (_state != AP_READY) {
+    if (!next_step())
+      stop();
+    if (_state != AP_READY)
+      return false;
+  }
+  if (now - _shown < _hold)
+    return false;
+
+  _images->flip();
+  _step = _next_step;
+  _hold = _next_hold;
+  _shown = now;
+  _next_step = _step + 1 < _steps ? _step + 1 : 0;
+  _state = AP_FIND;
+  return true;
+}
+
+/**
+ * Take the next step one piece further into the back image. Returns false if
+ * it doesn't load.
+ */
+bool AssetPlayer::next_step()
+{
+  uint8_t result;
+
+  // Wait for what's being read ahead, from this step or the one before,
+  // rather than for the bus.
+  if (_state != AP_LOAD && _loader->busy())
+    return true;
+
+  switch (_state) {
+  case AP_FIND:
+    _loader->prefetch_step(_next_step);
+    _state = AP_STEP;
+    return true;
+
+  case AP_STEP:
+    if (!_loader->animation_step(_asset, _next_step, &_next_image,
+                                 &_next_hold))
+      return false;
+    _loader->prefetch_entry(_next_image);
+    _state = AP_OPEN;
+    return true;
+
+  case AP_OPEN:
+    // Deltas are drawn over the step before, which is the one in front.
+    if (_loader->type(_next_image) == ASSET_IMAGE_DELTA)
+      _images->sync();
+    if (!_loader->start_image(_next_image, _images->back()))
+      return false;
+    _state = AP_LOAD;
+    return true;
+
+  case AP_LOAD:
+    result = _loader->load_more(ASSET_LOAD_BUDGET);
+    if (result == LOAD_DONE)
+      _state = AP_READY;
+    return result != LOAD_ERROR;
+  }
+  return true;
+}
+
+bool AssetPlayer::show_image(uint8_t image)
+{
+  // Deltas are drawn over the image before, which is the one in front.
+  if (_loader->type(image) == ASSET_IMAGE_DELTA)
+    _images->sync();
+  if (!_loader->load_image(image, _images->back()))
+    return false;
+  _images->flip();
+  return true;
+}
@@ -0,0 +1,205 @@
+#ifndef ASSET_LOADER_H__
+#define ASSET_LOADER_H__
+
+#include <Arduino.h>
+#include "smart_card.h"
+#include "image.h"
+#include "double_buffer.h"
+#include "asset_format.h"
+
+// Bytes of an image decoded each time AssetPlayer::update() is called: a
+// line of the card's cache, so at most one read that has to wait for the bus.
+const uint8_t ASSET_LOAD_BUDGET = 32;
+
+enum LoadResult
+{
+  LOAD_MORE,      // part of the image is in, and there's more to decode
+  LOAD_DONE,      // the whole image is in
+  LOAD_ERROR      // it didn't decode; the image may be partly drawn
+};
+
+/**
+ * Finds assets on a smart card (see asset_format.h) and decodes them
+ * straight into a Palette or an Image4 a byte at a time, as the card's cache
+ * reads them in; nothing is ever held whole in memory.
+ */
+class AssetLoader
+{
+public:
+  AssetLoader(SmartCard* card);
+
+  /**
+   * Read the header and check the CRC over everything on the card. Returns
+   * false if there are no assets: the card is blank, holds something else, or
+   * was only partly written.
+   */
+  bool begin();
+
+  uint8_t count() const {
+    return _count;
+  }
+
+  /**
+   * True while the card is still reading ahead; looking anything up now
+   * would wait for it.
+   */
+  bool busy() const {
+    return _card->busy();
+  }
+
+  /**
+   * Type of an asset, or 0 if there's no such asset.
+   */
+  uint8_t type(uint8_t asset);
+
+  /**
+   * The first asset of a type at or after 'from', or ASSET_NONE.
+   */
+  uint8_t find(uint8_t type, uint8_t from = 0);
+
+  bool load_palette(uint8_t asset, Palette* pal);
+
+  /**
+   * Decode an image. A delta is drawn over whatever 'img' already holds.
+   * Returns false if the asset isn't an image or doesn't decode, in which
+   * case 'img' may be partly drawn. This does the whole image at once, which
+   * takes tens of ms; from loop(), use start_image() and load_more().
+   */
+  bool load_image(uint8_t asset, Image4* img);
+
+  /**
+   * Start decoding an image into 'img', a piece at a time with load_more().
+   * Returns false if the asset isn't an image. Any other call on the loader
+   * before it's done abandons the image.
+   */
+  bool start_image(uint8_t asset, Image4* img);
+
+  /**
+   * Decode up to 'budget' more bytes of the image from start_image(). Returns
+   * a LoadResult.
+   */
+  uint8_t load_more(uint16_t budget);
+
+  /**
+   * Palette asset (or ASSET_NONE) and number of steps of an animation.
+   */
+  bool animation(uint8_t asset, uint8_t* palette, uint8_t* steps);
+
+  /**
+   * Image asset and time in ms of one step of an animation. Where the last
+   * animation() is on the card is kept, so for its steps this is one read.
+   */
+  bool animation_step(uint8_t asset, uint8_t step, uint8_t* image,
+                      uint16_t* hold_ms);
+
+  /**
+   * Start reading a step of the last animation(), or the directory entry of
+   * an asset, in the background, so that animation_step() or opening the
+   * asset doesn't wait for the card once busy() is false.
+   */
+  void prefetch_step(uint8_t step);
+  void prefetch_entry(uint8_t asset);
+
+private:
+  bool open(uint8_t asset);
+  bool more() const {
+    return _left > 0;
+  }
+  uint8_t next();
+  uint8_t decode(uint16_t budget, bool wait);
+  void code(uint8_t b);
+  void pixels(uint8_t index, uint8_t count);
+
+  SmartCard* _card;
+  uint8_t _count;
+
+  // The last animation().
+  uint8_t _anim;
+  uint16_t _anim_offset;
+  uint16_t _anim_length;
+
+  // The asset being read.
+  uint8_t _type;
+  uint16_t _offset;
+  uint16_t _length;
+  uint16_t _left;
+  bool _bad;
+
+  // The image being decoded, and where in it.
+  Image4* _img;
+  uint16_t _pixel;
+  uint8_t _op;
+  uint8_t _op_count;
+};
+
+/**
+ * Plays an animation from the card: each step is decoded into the back image
+ * a little at a time while the one before is up, and flipped to the front
+ * once it's in and the one before has been up long enough. Each update() does
+ * one piece: looking up the step, opening its image, or decoding up to
+ * ASSET_LOAD_BUDGET bytes of it. What each piece reads from the card is read
+ * ahead in the background by the one before, and update() waits a pass
+ * rather than for the bus.
+ */
+class AssetPlayer
+{
+public:
+  AssetPlayer(AssetLoader* loader, DoubleBuffer<Image4>* images, Palette* pal);
+
+  /**
+   * Load the animation's palette and start on its first step, which goes up
+   * as soon as update() has it all in. Returns false if it doesn't load.
+   */
+  bool play(uint8_t asset, uint32_t now);
+
+  void stop() {
+    _asset = ASSET_NONE;
+  }
+
+  bool playing() const {
+    return _asset != ASSET_NONE;
+  }
+
+  /**
+   * Decode some more of the next step, and move on to it if it's in and it's
+   * time. Cheap enough to call every time around loop(). Returns true if
+   * there's a new front image.
+   */
+  bool update(uint32_t now);
+
+  /**
+   * Put an image asset up on its own, through the back image, all at once
+   * (see AssetLoader::load_image()).
+   */
+  bool show_image(uint8_t image);
+
+private:
+  enum State
+  {
+    AP_FIND,        // starting to read the next step
+    AP_STEP,        // looking up the next step
+    AP_OPEN,        // opening its image
+    AP_LOAD,        // decoding it into the back image
+    AP_READY        // waiting for the step in front to be up long enough
+  };
+
+  bool next_step();
+
+  AssetLoader* _loader;
+  DoubleBuffer<Image4>* _images;
+  Palette* _pal;
+
+  uint8_t _asset;
+  uint8_t _steps;
+  uint8_t _step;
+  uint16_t _hold;
+  uint32_t _shown;
+
+  // The step on its way into the back image.
+  uint8_t _state;
+  uint8_t _next_step;
+  uint8_t _next_image;
+  uint16_t _next_hold;
+};
+
+#endif
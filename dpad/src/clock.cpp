@@ -1,8 +1,9 @@
-#include <Wire.h>
 #include <Arduino.h>
+#include "i2c_queue.h"
 #include "clock.h"
 
 DS1307_Clock::DS1307_Clock()
+  : _register(0), _requested(false), _halted(false)
 {
 }
 
@@ -12,19 +13,34 @@ DS1307_Clock::DS1307_Clock()
 
 void DS1307_Clock::begin()
 {
-  Wire.begin();
+  I2CQueue::begin();
   //fdevopen(&myputc, 0);
 }
 
 void DS1307_Clock::enable()
 {
-
-
+  uint8_t seconds;
+  if (read_bytes(DS1307_SECONDS, &seconds, 1) == 0)
+    return;
+  seconds &= ~DS1307_CLOCK_HALT;
+  if (write_bytes(DS1307_SECONDS, &seconds, 1) != 0)
+    _halted = false;
 }
 
 void DS1307_Clock::disable()
 {
+  uint8_t seconds;
+  if (read_bytes(DS1307_SECONDS, &seconds, 1) == 0)
+    return;
+  seconds |= DS1307_CLOCK_HALT;
+  if (write_bytes(DS1307_SECONDS, &seconds, 1) != 0)
+    _halted = true;
+}
 
+void DS1307_Clock::set_square_wave(bool on)
+{
+  uint8_t control = on ? DS1307_SQWE : 0;
+  write_bytes(DS1307_CONTROL, &control, 1);
 }
 
 void DS1307_Clock::set_time(ds1307_time t, bool enable)
@@ -40,58 +56,80 @@ void DS1307_Clock::set_time(ds1307_time t, bool enable)
   else
     t.seconds |= 0x80;
 
-  write_bytes(t.datetime, 7);
+  if (write_bytes(DS1307_SECONDS, t.datetime, 7) != 0)
+    _halted = !enable;
 }
 
-uint8_t DS1307_Clock::write_bytes(uint8_t* bytes, uint8_t len)
+uint8_t DS1307_Clock::write_bytes(uint8_t reg, const uint8_t* bytes,
+                                  uint8_t len)
 {
-  uint8_t lenWritten = 0;
-  Wire.beginTransmission( DS1307_ADDRESS );
-  Wire.write((uint8_t)0);
-  lenWritten = Wire.write(bytes, len);
-  Wire.endTransmission();
+  if (len > DS1307_TIME_LENGTH)
+    return 0;
 
-  Serial.print("Wrote "); Serial.print(lenWritten);
-  Serial.println(" bytes to RTC (in class).");
-  return lenWritten;
+  // A read in the background gives way, and has to be asked for again.
+  I2CQueue::wait(&_t);
+  _requested = false;
+
+  // The register to start at, then the bytes.
+  _buffer[0] = reg;
+  memcpy(_buffer + 1, bytes, len);
+  _t.set(DS1307_ADDRESS, _buffer, 1 + len, NULL, 0);
+
+  return I2CQueue::run(&_t) == I2C_DONE ? len : 0;
 }
 
-uint8_t DS1307_Clock::read_bytes(uint8_t* bytes, uint8_t len)
+uint8_t DS1307_Clock::read_bytes(uint8_t reg, uint8_t* bytes, uint8_t len)
 {
-  Wire.beginTransmission( DS1307_ADDRESS );
-  uint8_t x = 0;
-  Wire.write(&x, 1);
-  Wire.endTransmission();
+  I2CQueue::wait(&_t);
+  _requested = false;
 
-  Wire.requestFrom((uint8_t)DS1307_ADDRESS, len);
+  _register = reg;
+  _t.set(DS1307_ADDRESS, &_register, 1, bytes, len);
 
-  uint8_t bytes_read = 0;
-  for (uint8_t i = 0; i < len; ++i)
-  {
-    if (Wire.available())
-    {
-      bytes[i] = Wire.read();
-      ++bytes_read;
-    }
-  }
+  return I2CQueue::run(&_t) == I2C_DONE ? len : 0;
+}
+
+bool DS1307_Clock::request_time()
+{
+  if (_t.busy())
+    return false;
 
-  return bytes_read;
+  _register = DS1307_SECONDS;
+  _t.set(DS1307_ADDRESS, &_register, 1, _buffer, 7);
+  _requested = I2CQueue::submit(&_t);
+  return _requested;
 }
 
-void DS1307_Clock::get_time(ds1307_time* t)
+bool DS1307_Clock::poll_time(ds1307_time* t)
 {
-  uint8_t bytes_read = read_bytes((uint8_t*)t, 7);
-  Serial.print(bytes_read);
-  Serial.println(F(" bytes read."));
-  
-  t->datetime[0] = bcd_to_int(t->datetime[0] & 0x7f);
+  if (!_requested || _t.busy())
+    return false;
+
+  _requested = false;
+  if (_t.status != I2C_DONE)
+    return false;
+
+  _halted = _buffer[0] & DS1307_CLOCK_HALT;
+  from_bcd(_buffer, t);
+  return true;
+}
+
+void DS1307_Clock::from_bcd(const uint8_t* bytes, ds1307_time* t)
+{
+  // The top bit of the seconds is CH, not part of the time.
+  t->datetime[0] = bcd_to_int(bytes[0] & ~DS1307_CLOCK_HALT);
   for (uint8_t i = 1; i < 7; ++i)
-  {
-    Serial.print(t->datetime[i]);
-    t->datetime[i] = bcd_to_int(t->datetime[i]);
-    Serial.print("  ");
-    Serial.println(t->datetime[i]);
-  }
+    t->datetime[i] = bcd_to_int(bytes[i]);
+}
+
+void DS1307_Clock::get_time(ds1307_time* t)
+{
+  uint8_t bytes[7];
+  if (read_bytes(DS1307_SECONDS, bytes, 7) == 0)
+    return;
+
+  _halted = bytes[0] & DS1307_CLOCK_HALT;
+  from_bcd(bytes, t);
 }
 
 
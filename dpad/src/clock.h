@@ -1,6 +1,8 @@
 #ifndef DS1307_CLOCK_H__
 #define DS1307_CLOCK_H__
 
+#include "i2c_queue.h"
+
 struct ds1307_time
 {
   union
@@ -20,6 +22,15 @@ struct ds1307_time
 
 #define DS1307_TIME_LENGTH  8
 
+#define DS1307_SECONDS      0x0
+#define DS1307_CONTROL      0x7
+
+// CH, in the seconds register: the oscillator is stopped.
+#define DS1307_CLOCK_HALT   0x80
+// In the control register: SQW/OUT puts out a square wave, at 1 Hz with the
+// rate select bits clear.
+#define DS1307_SQWE         0x10
+
 #define CLOCK_SET_TIME      0x1
 #define CLOCK_SET_DATE      0x2
 
@@ -50,9 +61,43 @@ void enable();
  * Stops the clock oscillation.
  **/
 void disable();
-  
+
+/*
+ * Whether the clock was stopped when the time was last read.
+ */
+bool halted() const
+{
+  return _halted;
+}
+
+/*
+ * Turn the 1 Hz square wave on SQW/OUT on or off. Its edges mark the seconds
+ * going by (see SoftClock).
+ */
+void set_square_wave(bool on);
+
 void get_time(ds1307_time* t);
 
+/*
+ * Start reading the time in the background, through I2CQueue. Returns false
+ * if a read is already under way.
+ */
+bool request_time();
+
+/*
+ * True once the read request_time() started is over and 't' holds the time.
+ * False while it's still on the bus, and if it failed.
+ */
+bool poll_time(ds1307_time* t);
+
+/*
+ * True from request_time() until poll_time() has given its answer.
+ */
+bool requested() const
+{
+  return _requested;
+}
+
 /*
  * Set the time stored on the chip. This function automatically activates the
  * clock, unless disable is specifically set.
@@ -65,9 +110,16 @@ private:
 static uint8_t bcd_to_int(uint8_t);
 static uint8_t int_to_bcd(uint8_t);
 
-static uint8_t write_bytes(uint8_t* bytes, uint8_t len);
-static uint8_t write_bytes(ds1307_time);
-static uint8_t read_bytes(uint8_t* bytes, uint8_t len);
+static void from_bcd(const uint8_t* bytes, ds1307_time* t);
+
+uint8_t write_bytes(uint8_t reg, const uint8_t* bytes, uint8_t len);
+uint8_t read_bytes(uint8_t reg, uint8_t* bytes, uint8_t len);
+
+I2CTransaction _t;
+uint8_t _register;
+uint8_t _buffer[1 + DS1307_TIME_LENGTH];
+bool _requested;
+bool _halted;
 };
 
 
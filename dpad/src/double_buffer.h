@@ -0,0 +1,68 @@
+#ifndef DOUBLE_BUFFER_H__
+#define DOUBLE_BUFFER_H__
+
+#include <Arduino.h>
+#include "image.h"
+
+/**
+ * A front and a back image. The front is the one that gets compiled and shown;
+ * everything that draws or receives a new frame writes into the back, and
+ * flip() makes it visible in one step by swapping the pointers. A half drawn
+ * or half received frame is never on the strips.
+ *
+ * After a flip the back holds the frame from before, not the one just shown.
+ * Call sync() first if the next frame is drawn on top of the current one.
+ */
+template <class I>
+class DoubleBuffer
+{
+public:
+  typedef I image_type;
+
+  DoubleBuffer() : _front(&_a), _back(&_b), _synced(false) { }
+
+  I* front() { return _front; }
+  const I* front() const { return _front; }
+
+  I* back() { return _back; }
+  const I* back() const { return _back; }
+
+  /**
+   * Make the back image the front. If the back was synced to the front and
+   * only drawn on since, just its dirty region has to be recompiled;
+   * otherwise the whole of the new front is marked dirty.
+   */
+  void flip() {
+    if (_synced) {
+      // Anything on the front that hasn't been compiled yet is still
+      // pending.
+      if (_front->dirty_length() > 0)
+        _back->mark_dirty(_front->dirty_length() - 1);
+    }
+    else
+      _back->touch();
+
+    I* t = _front;
+    _front = _back;
+    _back = t;
+    _synced = false;
+  }
+
+  /**
+   * Copy the front into the back, so that the next frame can be drawn as
+   * changes to the current one.
+   */
+  void sync() {
+    memcpy(_back->_c, _front->_c, sizeof(_front->_c));
+    _back->clear_dirty();
+    _synced = true;
+  }
+
+private:
+  I _a, _b;
+  I* _front;
+  I* _back;
+  bool _synced;
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include <Arduino.h>
+#include "frame_decoder.h"
+
+static_assert(Image4::WIDTH == FRAME_WIDTH && Image4::HEIGHT == FRAME_HEIGHT,
+              "frames are sent at the size of the panel");
+
+FrameDecoder::FrameDecoder(DoubleBuffer<Image4>* images, Palette* pal)
+  : _images(images), _pal(pal), _card_writer(NULL), _state(FD_SYNC),
+    _type(0), _length(0), _received(0), _crc(CRC16_INIT), _crc_low(0),
+    _pixel(0), _op(0), _op_count(0), _bad(false), _last_type(0),
+    _packets(0), _errors(0)
+{
+}
+
+uint8_t FrameDecoder::feed(uint8_t b)
+{
+  switch (_state) {
+  case FD_SYNC:
+    if (b == PACKET_SYNC) {
+      _crc = CRC16_INIT;
+      _state = FD_TYPE;
+    }
+    return FEED_MORE;
+
+  case FD_TYPE:
+    _crc = crc16_update(_crc, b);
+    _type = b;
+    _state = FD_LENGTH_LOW;
+    return FEED_MORE;
+
+  case FD_LENGTH_LOW:
+    _crc = crc16_update(_crc, b);
+    _length = b;
+    _state = FD_LENGTH_HIGH;
+    return FEED_MORE;
+
+  case FD_LENGTH_HIGH:
+    _crc = crc16_update(_crc, b);
+    _length |= uint16_t(b) << 8;
+    if (!begin_payload()) {
+      _state = FD_SYNC;
+      ++_errors;
+      return FEED_ERROR;
+    }
+    _state = _length > 0 ? FD_PAYLOAD : FD_CRC_LOW;
+    return FEED_MORE;
+
+  case FD_PAYLOAD:
+    _crc = crc16_update(_crc, b);
+    payload(b);
+    if (++_received == _length)
+      _state = FD_CRC_LOW;
+    return FEED_MORE;
+
+  case FD_CRC_LOW:
+    _crc_low = b;
+    _state = FD_CRC_HIGH;
+    return FEED_MORE;
+
+  case FD_CRC_HIGH:
+  default:
+    _state = FD_SYNC;
+    if (_crc != ((uint16_t(b) << 8) | _crc_low) || !commit()) {
+      ++_errors;
+      return FEED_ERROR;
+    }
+    _last_type = _type;
+    ++_packets;
+    return FEED_PACKET;
+  }
+}
+
+/**
+ * Check the header of a packet and get ready for its payload. Returns false
+ * if the packet can't be right.
+ */
+bool FrameDecoder::begin_payload()
+{
+  _received = 0;
+  _pixel = 0;
+  _op_count = 0;
+  _bad = false;
+
+  switch (_type) {
+  case PACKET_PALETTE:
+    return _length > 1 && _length <= sizeof(_held) &&
+      (_length - 1) % 3 == 0;
+
+  case PACKET_CARD_WRITE:
+    return _card_writer && _length > 2 &&
+      _length <= 2 + PACKET_CARD_BYTES;
+
+  case PACKET_FRAME_RAW:
+    return _length == FRAME_PIXELS;
+
+  case PACKET_FRAME_RLE:
+    return _length > 0 && _length <= PACKET_MAX_LENGTH;
+
+  case PACKET_FRAME_DELTA:
+    if (_length == 0 || _length > PACKET_MAX_LENGTH)
+      return false;
+    // Changes are drawn on top of the frame being shown.
+    _images->sync();
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+void FrameDecoder::payload(uint8_t b)
+{
+  switch (_type) {
+  case PACKET_PALETTE:
+  case PACKET_CARD_WRITE:
+    _held[_received] = b;
+    break;
+
+  case PACKET_FRAME_RAW:
+    pixels(b, 1);
+    break;
+
+  default:
+    code(b);
+    break;
+  }
+}
+
+/**
+ * Handle one byte of a run-length coded frame.
+ */
+void FrameDecoder::code(uint8_t b)
+{
+  if (_op_count > 0) {
+    if (_op == FRAME_OP_LITERAL) {
+      pixels(b, 1);
+      --_op_count;
+    }
+    else {
+      pixels(b, _op_count);
+      _op_count = 0;
+    }
+    return;
+  }
+
+  if (b < FRAME_OP_RUN) {
+    _op = FRAME_OP_LITERAL;
+    _op_count = b - FRAME_OP_LITERAL + 1;
+  }
+  else if (b < FRAME_OP_SKIP) {
+    _op = FRAME_OP_RUN;
+    _op_count = b - FRAME_OP_RUN + 2;
+  }
+  else if (_type == PACKET_FRAME_DELTA) {
+    _pixel += b - FRAME_OP_SKIP + 1;
+    if (_pixel > FRAME_PIXELS) {
+      _pixel = FRAME_PIXELS;
+      _bad = true;
+    }
+  }
+  else {
+    // There's nothing to skip over in a whole frame.
+    _bad = true;
+  }
+}
+
+/**
+ * Write 'count' pixels into the back image, from the current position on.
+ */
+void FrameDecoder::pixels(uint8_t index, uint8_t count)
+{
+  Image4* img = _images->back();
+  for (; count > 0; --count, ++_pixel) {
+    if (_pixel >= FRAME_PIXELS || index >= FRAME_COLORS) {
+      _bad = true;
+      return;
+    }
+    img->set_color(_pixel % FRAME_WIDTH,
+                   FRAME_HEIGHT - 1 - _pixel / FRAME_WIDTH, index);
+  }
+}
+
+/**
+ * Make a packet that checked out take effect. Returns false if its contents
+ * didn't add up.
+ */
+bool FrameDecoder::commit()
+{
+  if (_type == PACKET_PALETTE) {
+    uint8_t start = _held[0];
+    const uint8_t* c = _held + 1;
+    for (uint8_t i = 0; i < (_length - 1) / 3; ++i, c += 3)
+      _pal->set_color(start + i, c[0], c[1], c[2]);
+    return true;
+  }
+
+  if (_type == PACKET_CARD_WRITE)
+    return _card_writer(_held[0] | (uint16_t(_held[1]) << 8), _held + 2,
+                        _length - 2);
+
+  if (_bad || _op_count != 0 || _pixel != FRAME_PIXELS)
+    return false;
+
+  _images->flip();
+  return true;
+}
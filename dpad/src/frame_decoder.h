@@ -0,0 +1,111 @@
+#ifndef FRAME_DECODER_H__
+#define FRAME_DECODER_H__
+
+#include <Arduino.h>
+#include "image.h"
+#include "double_buffer.h"
+#include "frame_packets.h"
+
+enum FeedResult
+{
+  FEED_MORE,      // in the middle of a packet, or waiting for one
+  FEED_PACKET,    // a packet checked out and took effect
+  FEED_ERROR      // a packet was dropped; answer with PACKET_NAK
+};
+
+/**
+ * Decodes packets (see frame_packets.h) a byte at a time, as they arrive.
+ * Frames are written straight into the back image as they come in, and the
+ * buffers are flipped once the whole frame is there and its CRC checks out,
+ * so a damaged or partial frame is never shown. Palette packets are held
+ * until their CRC has been checked, then applied all at once.
+ */
+class FrameDecoder
+{
+public:
+  /**
+   * Writes a PACKET_CARD_WRITE payload to the smart card. Returns false if
+   * the write failed.
+   */
+  typedef bool (*CardWriter)(uint16_t address, const uint8_t* bytes,
+                             uint8_t size);
+
+  FrameDecoder(DoubleBuffer<Image4>* images, Palette* pal);
+
+  /**
+   * Take PACKET_CARD_WRITE packets, and hand them to 'writer'. Without one
+   * they're refused.
+   */
+  void set_card_writer(CardWriter writer) {
+    _card_writer = writer;
+  }
+
+  uint8_t feed(uint8_t b);
+
+  /**
+   * True between the start of a packet and its CRC.
+   */
+  bool busy() const {
+    return _state != FD_SYNC;
+  }
+
+  /**
+   * Type of the last packet that took effect.
+   */
+  uint8_t last_type() const {
+    return _last_type;
+  }
+
+  uint16_t packets() const {
+    return _packets;
+  }
+
+  uint16_t errors() const {
+    return _errors;
+  }
+
+private:
+  enum State
+  {
+    FD_SYNC,
+    FD_TYPE,
+    FD_LENGTH_LOW,
+    FD_LENGTH_HIGH,
+    FD_PAYLOAD,
+    FD_CRC_LOW,
+    FD_CRC_HIGH
+  };
+
+  bool begin_payload();
+  void payload(uint8_t b);
+  void code(uint8_t b);
+  void pixels(uint8_t index, uint8_t count);
+  bool commit();
+
+  DoubleBuffer<Image4>* _images;
+  Palette* _pal;
+  CardWriter _card_writer;
+
+  uint8_t _state;
+  uint8_t _type;
+  uint16_t _length;
+  uint16_t _received;
+  uint16_t _crc;
+  uint8_t _crc_low;
+
+  // Frame payloads.
+  uint16_t _pixel;
+  uint8_t _op;
+  uint8_t _op_count;
+  bool _bad;
+
+  // Palette and card write payloads, held until the CRC.
+  uint8_t _held[1 + 3 * PACKET_PALETTE_COLORS > 2 + PACKET_CARD_BYTES
+                ? 1 + 3 * PACKET_PALETTE_COLORS : 2 + PACKET_CARD_BYTES];
+
+  uint8_t _last_type;
+  uint16_t _packets;
+  uint16_t _errors;
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include "frame_packets.h"
+
+#ifdef __AVR__
+#include <util/crc16.h>
+#endif
+
+uint16_t crc16_update(uint16_t crc, uint8_t b)
+{
+#ifdef __AVR__
+  return _crc_xmodem_update(crc, b);
+#else
+  crc ^= uint16_t(b) << 8;
+  for (uint8_t i = 0; i < 8; ++i)
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  return crc;
+#endif
+}
+
+FrameEncoder::FrameEncoder(Sink sink, void* context)
+  : _sink(sink), _context(context), _crc(CRC16_INIT), _bytes(0)
+{
+}
+
+void FrameEncoder::palette(uint8_t start, uint16_t count, const uint8_t* rgb)
+{
+  while (count > 0) {
+    uint8_t n = count < PACKET_PALETTE_COLORS ? count : PACKET_PALETTE_COLORS;
+
+    begin(PACKET_PALETTE, 1 + 3 * n);
+    put(start);
+    for (uint8_t i = 0; i < 3 * n; ++i)
+      put(*rgb++);
+    end();
+
+    start += n;
+    count -= n;
+  }
+}
+
+uint8_t FrameEncoder::frame(const uint8_t* indices)
+{
+  return send_frame(Pixels(indices));
+}
+
+uint8_t FrameEncoder::frame(Source source, void* context)
+{
+  return send_frame(Pixels(source, context));
+}
+
+uint8_t FrameEncoder::send_frame(const Pixels& indices)
+{
+  uint16_t length = code(indices, NULL, false);
+  if (length >= FRAME_PIXELS) {
+    begin(PACKET_FRAME_RAW, FRAME_PIXELS);
+    for (uint16_t i = 0; i < FRAME_PIXELS; ++i)
+      put(indices[i]);
+    end();
+    return PACKET_FRAME_RAW;
+  }
+
+  begin(PACKET_FRAME_RLE, length);
+  code(indices, NULL, true);
+  end();
+  return PACKET_FRAME_RLE;
+}
+
+uint8_t FrameEncoder::delta(const uint8_t* indices, const uint8_t* previous)
+{
+  Pixels pixels(indices);
+  uint16_t length = code(pixels, previous, false);
+  if (length >= code(pixels, NULL, false) || length >= FRAME_PIXELS)
+    return send_frame(pixels);
+
+  begin(PACKET_FRAME_DELTA, length);
+  code(pixels, previous, true);
+  end();
+  return PACKET_FRAME_DELTA;
+}
+
+void FrameEncoder::card_write(uint16_t address, uint16_t size,
+                              const uint8_t* bytes)
+{
+  while (size > 0) {
+    uint8_t n = size < PACKET_CARD_BYTES ? size : PACKET_CARD_BYTES;
+
+    begin(PACKET_CARD_WRITE, 2 + n);
+    put(address & 0xff);
+    put(address >> 8);
+    for (uint8_t i = 0; i < n; ++i)
+      put(*bytes++);
+    end();
+
+    address += n;
+    size -= n;
+  }
+}
+
+uint16_t FrameEncoder::code_only(const uint8_t* indices,
+                                 const uint8_t* previous)
+{
+  return code(Pixels(indices), previous, true);
+}
+
+uint16_t FrameEncoder::coded_length(const uint8_t* indices,
+                                    const uint8_t* previous)
+{
+  FrameEncoder counter(NULL, NULL);
+  return counter.code(Pixels(indices), previous, false);
+}
+
+void FrameEncoder::begin(uint8_t type, uint16_t length)
+{
+  _sink(PACKET_SYNC, _context);
+  ++_bytes;
+
+  _crc = CRC16_INIT;
+  put(type);
+  put(length & 0xff);
+  put(length >> 8);
+}
+
+void FrameEncoder::put(uint8_t b)
+{
+  _crc = crc16_update(_crc, b);
+  _sink(b, _context);
+  ++_bytes;
+}
+
+void FrameEncoder::end()
+{
+  uint16_t crc = _crc;
+  _sink(crc & 0xff, _context);
+  _sink(crc >> 8, _context);
+  _bytes += PACKET_CRC_LENGTH;
+}
+
+void FrameEncoder::emit_byte(uint8_t b, bool emit)
+{
+  if (emit)
+    put(b);
+}
+
+uint16_t FrameEncoder::code(const Pixels& indices, const uint8_t* previous,
+                            bool emit)
+{
+  uint16_t length = 0;
+  uint16_t i = 0;
+
+  while (i < FRAME_PIXELS) {
+    uint16_t n;
+
+    // Pixels that haven't changed.
+    if (previous) {
+      for (n = 0; i + n < FRAME_PIXELS && n < FRAME_MAX_SKIP &&
+             indices[i + n] == previous[i + n]; ++n)
+        ;
+      if (n > 0) {
+        emit_byte(FRAME_OP_SKIP | (n - 1), emit);
+        length += 1;
+        i += n;
+        continue;
+      }
+    }
+
+    // A run of one index.
+    for (n = 1; i + n < FRAME_PIXELS && n < FRAME_MAX_RUN &&
+           indices[i + n] == indices[i]; ++n)
+      ;
+    if (n >= 2) {
+      emit_byte(FRAME_OP_RUN | (n - 2), emit);
+      emit_byte(indices[i], emit);
+      length += 2;
+      i += n;
+      continue;
+    }
+
+    // Literals, up to the start of the next run or skip worth coding.
+    for (n = 1; i + n < FRAME_PIXELS && n < FRAME_MAX_LITERAL; ++n) {
+      uint16_t j = i + n;
+      if (j + 2 < FRAME_PIXELS && indices[j] == indices[j + 1] &&
+          indices[j] == indices[j + 2])
+        break;
+      if (previous && j + 1 < FRAME_PIXELS && indices[j] == previous[j] &&
+          indices[j + 1] == previous[j + 1])
+        break;
+    }
+    emit_byte(FRAME_OP_LITERAL | (n - 1), emit);
+    for (uint16_t k = 0; k < n; ++k)
+      emit_byte(indices[i + k], emit);
+    length += 1 + n;
+    i += n;
+  }
+
+  return length;
+}
@@ -0,0 +1,203 @@
+#ifndef FRAME_PACKETS_H__
+#define FRAME_PACKETS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Serial protocol for sending frames to the panel. Everything travels in
+ * packets:
+ *
+ *   0xA5, type, length (2 bytes), payload (length bytes), CRC (2 bytes)
+ *
+ * Multi-byte values are little endian. The CRC is CRC-16-CCITT (polynomial
+ * 0x1021, starting at 0xffff) over the type, length and payload. The panel
+ * answers every packet with a single PACKET_ACK, or PACKET_NAK if it was
+ * damaged or made no sense, and nothing else; senders wait for the answer
+ * before sending the next packet.
+ *
+ * Frames are palette indices in raster order, starting at the top left, so
+ * pixel k is x = k % 32, y = 31 - k / 32 on the panel. They only reach the
+ * first FRAME_COLORS colors of the palette.
+ *
+ * This header and frame_packets.cpp have no Arduino dependencies, so the
+ * encoder also builds on the host (see dpad/tools).
+ */
+
+#define PACKET_SYNC             0xA5
+#define PACKET_ACK              0x06
+#define PACKET_NAK              0x15
+
+/**
+ * Payload: the first palette index, then r, g, b for up to
+ * PACKET_PALETTE_COLORS colors. The colors change together once the packet
+ * has checked out.
+ */
+#define PACKET_PALETTE          0x01
+/**
+ * Payload: FRAME_PIXELS indices.
+ */
+#define PACKET_FRAME_RAW        0x02
+/**
+ * Payload: a run-length coded frame (see the FRAME_OP_* codes, without
+ * skips).
+ */
+#define PACKET_FRAME_RLE        0x03
+/**
+ * Payload: the changes from the frame before, coded like PACKET_FRAME_RLE
+ * but with skips over the pixels that stay the same.
+ */
+#define PACKET_FRAME_DELTA      0x04
+/**
+ * Payload: a smart card address (2 bytes), then up to PACKET_CARD_BYTES
+ * bytes to write there once the packet has checked out. This is how assets
+ * get onto the card (see asset_format.h).
+ */
+#define PACKET_CARD_WRITE       0x05
+
+#define PACKET_HEADER_LENGTH    4
+#define PACKET_CRC_LENGTH       2
+#define PACKET_MAX_LENGTH       2048
+
+#define PACKET_PALETTE_COLORS   16
+#define PACKET_CARD_BYTES       32
+
+#define FRAME_WIDTH             32
+#define FRAME_HEIGHT            32
+#define FRAME_PIXELS            (FRAME_WIDTH * FRAME_HEIGHT)
+/**
+ * The panel keeps its two frames at 4 bits a pixel (Image4), which leaves
+ * the Mega2560 a kilobyte more SRAM than two Images would. A frame with an
+ * index of FRAME_COLORS or more is refused.
+ */
+#define FRAME_COLORS            16
+
+/**
+ * Run-length codes. The top bits of each code byte pick the operation and
+ * the rest hold the count.
+ *
+ *   0x00-0x7f   the next 1-128 bytes are indices
+ *   0x80-0xbf   the next byte is repeated 2-65 times
+ *   0xc0-0xff   the next 1-64 pixels are unchanged (delta frames only)
+ */
+#define FRAME_OP_LITERAL        0x00
+#define FRAME_OP_RUN            0x80
+#define FRAME_OP_SKIP           0xc0
+
+#define FRAME_MAX_LITERAL       128
+#define FRAME_MAX_RUN           65
+#define FRAME_MAX_SKIP          64
+
+#define CRC16_INIT              0xffff
+
+uint16_t crc16_update(uint16_t crc, uint8_t b);
+
+/**
+ * Writes packets out a byte at a time through a sink, without buffering
+ * them: frames are coded in two passes, one to measure the payload for the
+ * header and one to send it.
+ */
+class FrameEncoder
+{
+public:
+  typedef void (*Sink)(uint8_t b, void* context);
+
+  /**
+   * Gives the index of pixel k of a frame, for frames that are worked out
+   * as they're sent instead of being held in memory.
+   */
+  typedef uint8_t (*Source)(uint16_t k, void* context);
+
+  FrameEncoder(Sink sink, void* context);
+
+  /**
+   * Send 'count' colors as r, g, b triples, starting at palette index
+   * 'start'. Large palettes go out as several packets.
+   */
+  void palette(uint8_t start, uint16_t count, const uint8_t* rgb);
+
+  /**
+   * Send a whole frame, raw or run-length coded, whichever is shorter.
+   * Returns the packet type used.
+   */
+  uint8_t frame(const uint8_t* indices);
+
+  /**
+   * frame() with the pixels from 'source', which is asked for each of them
+   * several times over.
+   */
+  uint8_t frame(Source source, void* context);
+
+  /**
+   * Send a frame as changes from 'previous', the last frame sent, falling
+   * back to frame() when that's shorter. Returns the packet type used.
+   */
+  uint8_t delta(const uint8_t* indices, const uint8_t* previous);
+
+  /**
+   * Send 'size' bytes to write to the smart card from 'address' on. Large
+   * writes go out as several packets.
+   */
+  void card_write(uint16_t address, uint16_t size, const uint8_t* bytes);
+
+  /**
+   * Send just the run-length coding of a frame, with skips if 'previous' is
+   * given, and no packet around it: for frames that are stored rather than
+   * sent. Returns its length.
+   */
+  uint16_t code_only(const uint8_t* indices, const uint8_t* previous);
+
+  /**
+   * Total number of bytes sent.
+   */
+  uint32_t bytes() const {
+    return _bytes;
+  }
+
+  /**
+   * Length of the run-length coding of a frame, with skips if 'previous' is
+   * given.
+   */
+  static uint16_t coded_length(const uint8_t* indices,
+                               const uint8_t* previous);
+
+private:
+  /**
+   * The pixels of the frame being coded: an array, or else a Source.
+   */
+  struct Pixels
+  {
+    Pixels(const uint8_t* indices)
+      : indices(indices), source(NULL), context(NULL) { }
+    Pixels(Source source, void* context)
+      : indices(NULL), source(source), context(context) { }
+
+    uint8_t operator[](uint16_t k) const {
+      return indices ? indices[k] : source(k, context);
+    }
+
+    const uint8_t* indices;
+    Source source;
+    void* context;
+  };
+
+  uint8_t send_frame(const Pixels& indices);
+
+  void begin(uint8_t type, uint16_t length);
+  void put(uint8_t b);
+  void end();
+
+  /**
+   * Run-length code a frame, sending the bytes unless 'emit' is false.
+   * Returns the coded length.
+   */
+  uint16_t code(const Pixels& indices, const uint8_t* previous, bool emit);
+  void emit_byte(uint8_t b, bool emit);
+
+  Sink _sink;
+  void* _context;
+  uint16_t _crc;
+  uint32_t _bytes;
+};
+
+#endif
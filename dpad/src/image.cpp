@@ -1,5 +1,6 @@
 #include <Arduino.h>
 #include "image.h"
+#include "gamma.h"
 
 /**
  * Taken from:
@@ -54,51 +55,149 @@ void HSVtoRGB( float *r, float *g, float *b, float h, float s, float v )
   }
 }
 
+/**
+ * x / 255, exact for any 16-bit x but 0xffff.
+ */
+static inline uint8_t div255(uint16_t x)
+{
+  return (x + 1 + (x >> 8)) >> 8;
+}
+
+/**
+ * value * m / (255 * 255), rounded, for m up to 255 * 255. m is split into
+ * 255ths so everything stays within 16 bits, and the remainder of the small
+ * part decides the rounding.
+ */
+static inline uint8_t scale255x255(uint8_t value, uint16_t m)
+{
+  uint8_t a = div255(m), b = m - a * 255;
+  uint16_t c = value * b;
+  uint8_t c1 = div255(c), c2 = c - c1 * 255;
+  return div255(value * a + c1 + 127 + (c2 >= 128));
+}
+
+/**
+ * Integer version of HSVtoRGB, with every component in 0-255 (hue 255 is 360
+ * degrees). Each component is what the float version gives rounded to 8
+ * bits, to within its float error.
+ */
+void hsv_to_rgb(uint8_t hue, uint8_t saturation, uint8_t value,
+                uint8_t* r, uint8_t* g, uint8_t* b)
+{
+  if (saturation == 0) {
+    *r = *g = *b = value;
+    return;
+  }
+
+  // Sector and the fractional part of the hue within it, out of 255.
+  uint16_t h = hue * 6;
+  uint8_t i = h / 255;
+  uint8_t f = h - i * 255;
+
+  uint8_t p = div255(value * (255 - saturation) + 127);
+  uint8_t q = scale255x255(value, 255 * 255 - saturation * f);
+  uint8_t t = scale255x255(value, 255 * 255 - saturation * (255 - f));
+
+  switch( i ) {
+  case 0:
+    *r = value;
+    *g = t;
+    *b = p;
+    break;
+  case 1:
+    *r = q;
+    *g = value;
+    *b = p;
+    break;
+  case 2:
+    *r = p;
+    *g = value;
+    *b = t;
+    break;
+  case 3:
+    *r = p;
+    *g = q;
+    *b = value;
+    break;
+  case 4:
+    *r = t;
+    *g = p;
+    *b = value;
+    break;
+  default:		// case 5, or hue == 255
+    *r = value;
+    *g = p;
+    *b = q;
+    break;
+  }
+}
+
 void Palette::set_color_hsv(uint8_t index, uint8_t hue, uint8_t saturation, uint8_t value)
 {
-  float h = float(hue) * 360.0f / 255.0f;
-  float s = float(saturation) / 255.0f;
-  float v = float(value) / 255.0f;
-  float rf, gf, bf;
+  uint8_t r, g, b;
+  hsv_to_rgb(hue, saturation, value, &r, &g, &b);
+  set_color(index, r, g, b);
+}
+
+void Palette::fill_hsv_gradient(uint8_t start, uint16_t count,
+                                uint8_t h0, uint8_t h1,
+                                uint8_t saturation, uint8_t value)
+{
+  if (count == 0)
+    return;
 
-  HSVtoRGB(&rf, &gf, &bf, h, s, v);
+  // Hue in 8.8 fixed point, so that long gradients still move smoothly.
+  int32_t h = int32_t(h0) << 8;
+  int32_t step = 0;
+  if (count > 1)
+    step = ((int32_t(h1) - h0) << 8) / int32_t(count - 1);
 
-  set_color(index, rf * 255, gf * 255, bf * 255);
+  for (uint16_t i = 0; i < count; ++i) {
+    uint8_t r, g, b;
+    hsv_to_rgb((h + 0x80) >> 8, saturation, value, &r, &g, &b);
+    set_color(start + i, r, g, b);
+    h += step;
+  }
 }
-PROGMEM prog_uchar gammaTable[]  = {
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,
-    1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  2,  2,  2,  2,
-    2,  2,  2,  2,  2,  3,  3,  3,  3,  3,  3,  3,  3,  4,  4,  4,
-    4,  4,  4,  4,  5,  5,  5,  5,  5,  6,  6,  6,  6,  6,  7,  7,
-    7,  7,  7,  8,  8,  8,  8,  9,  9,  9,  9, 10, 10, 10, 10, 11,
-   11, 11, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 15, 15, 16, 16,
-   16, 17, 17, 17, 18, 18, 18, 19, 19, 20, 20, 21, 21, 21, 22, 22,
-   23, 23, 24, 24, 24, 25, 25, 26, 26, 27, 27, 28, 28, 29, 29, 30,
-   30, 31, 32, 32, 33, 33, 34, 34, 35, 35, 36, 37, 37, 38, 38, 39,
-   40, 40, 41, 41, 42, 43, 43, 44, 45, 45, 46, 47, 47, 48, 49, 50,
-   50, 51, 52, 52, 53, 54, 55, 55, 56, 57, 58, 58, 59, 60, 61, 62,
-   62, 63, 64, 65, 66, 67, 67, 68, 69, 70, 71, 72, 73, 74, 74, 75,
-   76, 77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 88, 89, 90, 91,
-   92, 93, 94, 95, 96, 97, 98, 99,100,101,102,104,105,106,107,108,
-  109,110,111,113,114,115,116,117,118,120,121,122,123,125,126,127
-};
-
-// This function (which actually gets 'inlined' anywhere it's called)
-// exists so that gammaTable can reside out of the way down here in the
-// utility code...didn't want that huge table distracting or intimidating
-// folks before even getting into the real substance of the program, and
-// the compiler permits forward references to functions but not data.
+// 8-bit colors to the LPD8806's 7 bits.
+typedef GammaTable<250, 7> LedGamma;
+
 inline byte gamma(byte x) {
-  return pgm_read_byte(&gammaTable[x]);
+  return LedGamma::lookup(x);
 }
 
 void Palette::set_color(uint8_t index, uint8_t r, uint8_t g, uint8_t b)
 {
-    color& c = _c[index];
+    color& c = _c[slot(index)];
     // Input colors are assumed to be 8-bit and coverted into 7-bit with the
     // high-bit set.
     c.v.r = 0x80 | gamma(r);
     c.v.g = 0x80 | gamma(g);
     c.v.b = 0x80 | gamma(b);
+    touch();
+}
+
+void Palette::normalize()
+{
+  if (_cycle_offset == 0)
+    return;
+
+  // Rotate in place with three reversals.
+  color* first = _c;
+  color* middle = _c + _cycle_offset;
+  color* last = _c + _cycle_length;
+  reverse(first, middle);
+  reverse(middle, last);
+  reverse(first, last);
+
+  _cycle_offset = 0;
+}
+
+void Palette::reverse(color* first, color* last)
+{
+  while (first < --last) {
+    color c = *first;
+    *first++ = *last;
+    *last = c;
+  }
 }
@@ -1,7 +1,21 @@
 #ifndef IMAGE_H__
 #define IMAGE_H__
 
-class LPD8806x8;
+#include "panel.h"
+
+template <class Ports, class Geometry> class BasicLPD8806x8;
+
+/**
+ * HSV to RGB conversion with all components in 0-255.
+ */
+void hsv_to_rgb(uint8_t hue, uint8_t saturation, uint8_t value,
+                uint8_t* r, uint8_t* g, uint8_t* b);
+
+/**
+ * Reference floating point conversion, with h in degrees and everything else
+ * in [0, 1]. Much slower than hsv_to_rgb on the AVR.
+ */
+void HSVtoRGB( float *r, float *g, float *b, float h, float s, float v );
 
 /**
  * Representation of given as input. The public interface to all color-based
@@ -22,7 +36,8 @@ struct color
 
 struct Palette
 {
-  Palette(uint16_t size) : _size(size) {
+  Palette(uint16_t size)
+    : _size(size), _generation(0), _cycle_length(0), _cycle_offset(0) {
     _c = (color*)malloc(_size * sizeof(color));
   }
 
@@ -40,22 +55,90 @@ struct Palette
   }
 
   void set_color_hsv(uint8_t index, uint8_t hue, uint8_t saturation, uint8_t value);
+
+  /**
+   * Set 'count' colors starting at 'start' to an even sweep of hues from h0 to
+   * h1 (both inclusive), at a fixed saturation and value.
+   */
+  void fill_hsv_gradient(uint8_t start, uint16_t count, uint8_t h0, uint8_t h1,
+                         uint8_t saturation, uint8_t value);
   /** 
-   * Rotate the first 'num' colors in the palette.
+   * Rotate the first 'num' colors in the palette, so that each index takes on
+   * the color of the one after it. This only moves an offset; no colors are
+   * copied unless 'num' differs from the previous call.
    */
   void cycle_colors(uint16_t num) {
-    color c = _c[0];
-    for (uint16_t i = 0; i < num - 1; ++i)
-      _c[i] = _c[i+1];
-    _c[num-1] = c;
+    if (num != _cycle_length) {
+      normalize();
+      _cycle_length = num;
+    }
+    if (++_cycle_offset >= _cycle_length)
+      _cycle_offset = 0;
+    touch();
+  }
+
+  /**
+   * Physically rotate the colors so that _c is in index order again, and
+   * drop the cycle offset.
+   */
+  void normalize();
+
+  /**
+   * Position in _c of the color currently at the given index.
+   */
+  uint8_t slot(uint8_t index) const {
+    if (index < _cycle_length) {
+      uint16_t i = index + _cycle_offset;
+      if (i >= _cycle_length)
+        i -= _cycle_length;
+      return i;
+    }
+    return index;
+  }
+
+  /**
+   * The color currently at the given index, in output form (7-bit GRB with
+   * the high bits set).
+   */
+  const color& get(uint8_t index) const {
+    return _c[slot(index)];
+  }
+
+  uint16_t size() const {
+    return _size;
+  }
+
+  /**
+   * Note that the colors have changed. Only needed after writing to _c
+   * directly; all of the setters do this already.
+   */
+  void touch() {
+    ++_generation;
+  }
+
+  /**
+   * Counter that changes whenever any color in the palette does, so that
+   * consumers can tell whether anything they derived from it is stale.
+   */
+  uint16_t generation() const {
+    return _generation;
   }
     
 public:
+  /**
+   * Color storage. With a cycle active, this is rotated relative to the
+   * indices; use get() or slot() to look colors up.
+   */
   color* _c;
   
 private:
-  friend class LPD8806x8;
+  template <class Ports, class Geometry> friend class BasicLPD8806x8;
   uint16_t _size;
+  uint16_t _generation;
+  uint16_t _cycle_length;
+  uint16_t _cycle_offset;
+
+  static void reverse(color* first, color* last);
 
 };
 
@@ -64,7 +147,7 @@ class StripImage
 private:
   uint8_t _c[128];
   uint8_t _size;
-  friend class LPD8806x8;
+  template <class Ports, class Geometry> friend class BasicLPD8806x8;
 
 public:
   StripImage() : _size(128) { }
@@ -81,62 +164,226 @@ public:
   }
 };
     
-class Image
+/**
+ * Palette indices for every pixel of a panel, stored strip by strip in output
+ * order. The layout of the pixels on the strips comes from the Geometry (see
+ * panel.h).
+ *
+ * With BPP of 4 or 2, indices are packed two or four to a byte (first pixel
+ * in the low bits), so the image only reaches the first 16 or 4 palette
+ * entries but takes a half or a quarter of the memory. Packed images have no
+ * writable operator(); use set_color().
+ */
+template <class Geometry, uint8_t BPP = 8>
+class BasicImage
 {
 public:
-  uint8_t _c[8][128];
-  friend class LPD8806x8;
+  typedef Geometry geometry;
+
+  static_assert(BPP == 8 || BPP == 4 || BPP == 2,
+                "pixels are 8, 4 or 2 bits");
+
+  static const uint8_t WIDTH = Geometry::WIDTH;
+  static const uint8_t HEIGHT = Geometry::HEIGHT;
+  static const uint8_t STRIPS = Geometry::STRIPS;
+  static const uint16_t STRIP_LENGTH = Geometry::STRIP_LENGTH;
+
+  static const uint8_t PIXELS_PER_BYTE = 8 / BPP;
+  static const uint8_t INDEX_MASK = (1 << BPP) - 1;
+  static const uint16_t STRIP_BYTES = STRIP_LENGTH / PIXELS_PER_BYTE;
+
+  static_assert(STRIP_LENGTH % PIXELS_PER_BYTE == 0,
+                "strips have to fill whole bytes");
+
+  uint8_t _c[STRIPS][STRIP_BYTES];
+  template <class Ports, class G> friend class BasicLPD8806x8;
   
 public:
-  Image() {
+  BasicImage() : _dirty(STRIP_LENGTH) {
   }
 
   void fill( uint8_t index ) {
-    for (uint8_t i = 0; i < 8; ++i)
-      for (uint8_t j = 0; j < 128; ++j)
-        _c[i][j] = index;
+    // Repeat the index across the byte: 0x11 for 4 bits, 0x55 for 2 bits.
+    memset(_c, (index & INDEX_MASK) * (0xff / INDEX_MASK), sizeof(_c));
+    touch();
   }
 
   void set_color( uint8_t x, uint8_t y, uint8_t color_index) {
-    uint8_t r, c;
-    rowcol(x, y, r, c);
-    _c[r][c] = color_index;
+    uint16_t o = Geometry::lookup(x, y);
+    put(o, color_index);
+    mark_dirty(o % STRIP_LENGTH);
   }
   uint8_t get_color( uint8_t x, uint8_t y ) const {
-    uint8_t r, c;
-    rowcol(x, y, r, c);
-    return _c[r][c];
+    return get(Geometry::lookup(x, y));
   }
   
+  /**
+   * Writable access to a pixel. The pixel is assumed to be changed. Only
+   * available on unpacked images.
+   */
   uint8_t& operator() (uint8_t x, uint8_t y) {
-    uint8_t r, c;
-    rowcol(x, y, r, c);
-    return _c[r][c];
+    static_assert(BPP == 8, "packed pixels can't be referenced");
+    uint16_t o = Geometry::lookup(x, y);
+    mark_dirty(o % STRIP_LENGTH);
+    return data()[o];
   }    
   uint8_t operator() (uint8_t x, uint8_t y) const {
-    uint8_t s, r;
-    rowcol(x, y, s, r);
-    return _c[s][r];
+    return get(Geometry::lookup(x, y));
   }    
 
-  void rowcol(uint8_t x, uint8_t y, uint8_t& s, uint8_t& r) const {
-    bool h = x >= 16;
-    s = x % 4 + h * 4;
+  /**
+   * Palette index of LED n of strip s.
+   */
+  uint8_t index(uint8_t s, uint16_t n) const {
+    return unpack(_c[s], n);
+  }
 
-    uint8_t m;
-    if (h)
-    {
-       m = (x - s - 12) / 4;
+  /**
+   * Unpack LED n from a strip of packed indices. For 8-bit pixels this is
+   * just strip[n].
+   */
+  static uint8_t unpack(const uint8_t* strip, uint16_t n) {
+    if (BPP == 8)
+      return strip[n];
+    return (strip[n / PIXELS_PER_BYTE] >> ((n % PIXELS_PER_BYTE) * BPP)) &
+      INDEX_MASK;
+  }
+
+  /**
+   * Unpack all PIXELS_PER_BYTE indices of a byte of a strip, first pixel
+   * first. Every shift is by BPP, which the AVR does inline where the
+   * variable shift in unpack() is a loop; compile() and show() walk strips
+   * a byte at a time with this.
+   */
+  static void unpack_byte(uint8_t byte, uint8_t* indices) {
+    for (uint8_t p = 0; p < PIXELS_PER_BYTE; ++p) {
+      indices[p] = byte & INDEX_MASK;
+      byte >>= BPP;
     }
+  }
+
+  /**
+   * Set all of the pixels of a column, from y = 0 up. A column is one
+   * contiguous run of a single strip, so this is a straight (possibly
+   * reversed) copy.
+   */
+  void set_column(uint8_t x, const uint8_t* indices) {
+    uint16_t o = Geometry::lookup(x, 0);
+    if (Geometry::lookup(x, 1) > o) {
+      for (uint8_t y = 0; y < HEIGHT; ++y)
+        put(o++, indices[y]);
+      mark_dirty((o - 1) % STRIP_LENGTH);
+    }
+    else {
+      mark_dirty(o % STRIP_LENGTH);
+      for (uint8_t y = 0; y < HEIGHT; ++y)
+        put(o--, indices[y]);
+    }
+  }
+
+  void fill_column(uint8_t x, uint8_t index) {
+    uint16_t o = Geometry::lookup(x, 0);
+    if (Geometry::lookup(x, 1) < o)
+      o -= HEIGHT - 1;
+    if (BPP == 8)
+      memset(data() + o, index, HEIGHT);
     else
-    {
-      m = (12 + s - x) / 4;
+      for (uint8_t y = 0; y < HEIGHT; ++y)
+        put(o + y, index);
+    mark_dirty(o % STRIP_LENGTH + HEIGHT - 1);
+  }
+
+  /**
+   * Set all of the pixels of a row, from x = 0 across.
+   */
+  void set_row(uint8_t y, const uint8_t* indices) {
+    uint16_t last = 0;
+    for (uint8_t x = 0; x < WIDTH; ++x) {
+      uint16_t o = Geometry::lookup(x, y);
+      put(o, indices[x]);
+      if (o % STRIP_LENGTH > last)
+        last = o % STRIP_LENGTH;
     }
+    mark_dirty(last);
+  }
 
-    r = m * 32;
-    r += m % 2 == 0 ? y : 31 - y;
+  void fill_row(uint8_t y, uint8_t index) {
+    uint16_t last = 0;
+    for (uint8_t x = 0; x < WIDTH; ++x) {
+      uint16_t o = Geometry::lookup(x, y);
+      put(o, index);
+      if (o % STRIP_LENGTH > last)
+        last = o % STRIP_LENGTH;
+    }
+    mark_dirty(last);
+  }
 
+  /**
+   * Strip and index within the strip of a pixel.
+   */
+  void rowcol(uint8_t x, uint8_t y, uint8_t& s, uint16_t& r) const {
+    uint16_t o = Geometry::lookup(x, y);
+    s = o / STRIP_LENGTH;
+    r = o % STRIP_LENGTH;
   }
+
+  /**
+   * Since all of the strips are clocked out together, the changed region is
+   * tracked as a single length: every strip index at or past dirty_length()
+   * is unchanged since the last clear_dirty().
+   */
+  uint16_t dirty_length() const {
+    return _dirty;
+  }
+
+  void mark_dirty(uint16_t strip_index) {
+    if (strip_index >= _dirty)
+      _dirty = strip_index + 1;
+  }
+
+  /**
+   * Mark the whole image as changed. Needed after writing to _c directly.
+   */
+  void touch() {
+    _dirty = STRIP_LENGTH;
+  }
+
+  void clear_dirty() {
+    _dirty = 0;
+  }
+
+private:
+  uint8_t* data() {
+    return &_c[0][0];
+  }
+  const uint8_t* data() const {
+    return &_c[0][0];
+  }
+
+  /**
+   * Read and write the pixel at an offset from the geometry (strip *
+   * STRIP_LENGTH + index).
+   */
+  uint8_t get(uint16_t o) const {
+    return unpack(data(), o);
+  }
+
+  void put(uint16_t o, uint8_t index) {
+    if (BPP == 8) {
+      data()[o] = index;
+      return;
+    }
+
+    uint8_t& b = data()[o / PIXELS_PER_BYTE];
+    uint8_t shift = (o % PIXELS_PER_BYTE) * BPP;
+    b = (b & ~(INDEX_MASK << shift)) | ((index & INDEX_MASK) << shift);
+  }
+
+  uint16_t _dirty;
 };
 
+typedef BasicImage<Panel32x32> Image;
+typedef BasicImage<Panel32x32, 4> Image4;
+typedef BasicImage<Panel32x32, 2> Image2;
+
 #endif
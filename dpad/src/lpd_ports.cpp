@@ -0,0 +1,134 @@
+#include "lpd_ports.h"
+
+#ifndef __AVR__
+
+PortEvent SimPorts::_trace[SIM_TRACE_LENGTH];
+uint16_t SimPorts::_trace_length = 0;
+uint32_t SimPorts::_dropped = 0;
+uint32_t SimPorts::_edges = 0;
+
+uint8_t SimPorts::_port1 = 0;
+uint8_t SimPorts::_port2 = 0;
+uint8_t SimPorts::_control = CONTROL_IDLE;
+uint8_t SimPorts::_shift[8];
+uint8_t SimPorts::_out[8];
+uint8_t SimPorts::_bits = 0;
+
+uint8_t SimPorts::_stream[8][SIM_STREAM_LENGTH];
+uint16_t SimPorts::_stream_length[8];
+
+bool SimSpiPorts::_shifting = false;
+uint32_t SimSpiPorts::_collisions = 0;
+
+void SimPorts::reset()
+{
+  _trace_length = 0;
+  _dropped = 0;
+  _edges = 0;
+  _bits = 0;
+  _control = CONTROL_IDLE;
+  memset(_shift, 0, sizeof(_shift));
+  memset(_out, 0, sizeof(_out));
+  memset(_stream_length, 0, sizeof(_stream_length));
+}
+
+void SimPorts::record(uint8_t port, uint8_t value)
+{
+  if (_trace_length < SIM_TRACE_LENGTH) {
+    _trace[_trace_length].port = port;
+    _trace[_trace_length].value = value;
+    ++_trace_length;
+  }
+  else
+    ++_dropped;
+}
+
+void SimPorts::control(uint8_t v)
+{
+  record(PortEvent::CONTROL, v);
+
+  // A low select bit holds the matching shift register on each data port in
+  // parallel load.
+  for (uint8_t k = 0; k < 4; ++k) {
+    if (!(v & (1 << k))) {
+      _shift[k] = _port1;
+      _shift[k + 4] = _port2;
+    }
+  }
+
+  // Each strip samples the top bit of its shift register on a rising edge,
+  // and the registers shift along with it. The inhibit is ORed into the
+  // clock, so only an edge with the inhibit already low counts.
+  const uint8_t clock_bits = CLOCK_HIGH_BIT | CLOCK_INHIBIT_HIGH_BIT;
+  if ((v & clock_bits) == CLOCK_HIGH_BIT && !(_control & clock_bits))
+    edge();
+
+  _control = v;
+}
+
+void SimPorts::edge()
+{
+  ++_edges;
+  for (uint8_t s = 0; s < 8; ++s) {
+    _out[s] = (_out[s] << 1) | (_shift[s] >> 7);
+    _shift[s] <<= 1;
+  }
+
+  if (++_bits == 8) {
+    _bits = 0;
+    for (uint8_t s = 0; s < 8; ++s)
+      if (_stream_length[s] < SIM_STREAM_LENGTH)
+        _stream[s][_stream_length[s]++] = _out[s];
+  }
+}
+
+void SimSpiPorts::clock_begin()
+{
+  control(CONTROL_CLOCK_LOW);
+  record(PortEvent::SPI_START, 0);
+
+  if (_shifting)
+    ++_collisions;
+  _shifting = true;
+
+  // SCK takes the place of the clock bit, so it's gated by the inhibit the
+  // same way.
+  if (!(_control & CLOCK_INHIBIT_HIGH_BIT))
+    for (uint8_t i = 0; i < 8; ++i)
+      edge();
+}
+
+void SimSpiPorts::clock_end()
+{
+  record(PortEvent::SPI_WAIT, 0);
+  _shifting = false;
+}
+
+uint32_t CycleCostModel::cycles(const PortEvent* trace, uint16_t length) const
+{
+  uint32_t total = 0;
+  uint32_t spi_start = 0;
+  for (uint16_t i = 0; i < length; ++i) {
+    switch (trace[i].port) {
+    case PortEvent::CONTROL:
+      total += control_cycles;
+      break;
+    case PortEvent::SPI_START:
+      total += data_cycles;
+      spi_start = total;
+      break;
+    case PortEvent::SPI_WAIT:
+      if (total - spi_start < spi_cycles)
+        total = spi_start + spi_cycles;
+      total += spi_poll_cycles;
+      continue;
+    default:
+      total += data_cycles;
+      break;
+    }
+    total += overhead_cycles;
+  }
+  return total;
+}
+
+#endif
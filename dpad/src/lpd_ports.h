@@ -0,0 +1,329 @@
+#ifndef LPD_PORTS_H__
+#define LPD_PORTS_H__
+
+#include <Arduino.h>
+
+/**
+ * Port backends for LPD8806x8. The driver never touches a register itself;
+ * instead it is parameterized on a backend class made up of static functions:
+ *
+ *   setup()        - make the data and control ports outputs and go idle
+ *   data(a, b)     - put a byte on each of the two data ports
+ *   control(v)     - store a whole value on the control port
+ *   clock_begin()  - start clocking one byte out of the shift registers
+ *   clock_end()    - wait for the byte to be out
+ *
+ * The data ports are only sampled on a load, so they may be written between
+ * clock_begin() and clock_end(); the control port may not. With a hardware
+ * clock the driver prepares the next group in between, while the last one is
+ * still shifting out.
+ *
+ * Since everything is static and inline, the AVR backend compiles down to the
+ * same register stores as writing the ports directly.
+ */
+
+/// PC0 - 37
+/// PC7 - 30
+
+// PA0 - 22
+// PA7 - 29
+
+// PL0 - 49
+// PL7 - 42
+
+#define LPD_PORT1         C
+#define LPD_PORT2         A
+#define LPD_CONTROL_PORT  L
+
+/**
+ * We only use 7 bits of the control port, but reserve the whole thing just in
+ * case.
+ */
+/**
+ * 0-3: select-bits
+ * 4: Clock Bit
+ * 5: Clock Inhibit Bit
+ */
+#define SELECT_STRIP0               0xfe
+#define SELECT_STRIP1               0xfd
+#define SELECT_STRIP2               0xfb
+#define SELECT_STRIP3               0xf7
+#define SELECT_MASK                 0x0f
+#define CLOCK_HIGH_BIT              0x10
+#define CLOCK_INHIBIT_HIGH_BIT      0x20
+
+/**
+ * Whole-port values for the control port. Since we own all of it, the hot
+ * loops store these directly instead of doing read-modify-write updates.
+ */
+#define CONTROL_IDLE                (CLOCK_INHIBIT_HIGH_BIT | SELECT_MASK)
+#define CONTROL_LOAD(x)             (CONTROL_IDLE & ~(1 << (x)))
+#define CONTROL_CLOCK_LOW           (SELECT_MASK)
+#define CONTROL_CLOCK_HIGH          (SELECT_MASK | CLOCK_HIGH_BIT)
+
+/**
+ * Clock one byte out of the shift registers by toggling the clock bit on the
+ * control port, for backends without a hardware clock. Here, we need to keep
+ * the load inhibit pin high, but the select bits don't matter. The inhibit
+ * has to come down while the clock is low, or the first edge is lost.
+ */
+template <class Ports>
+inline void bitbang_clock()
+{
+  Ports::control(CONTROL_CLOCK_LOW);
+  Ports::control(CONTROL_CLOCK_HIGH);
+
+  for (uint8_t i = 0; i < 7; ++i) {
+    Ports::control(CONTROL_CLOCK_LOW);
+    Ports::control(CONTROL_CLOCK_HIGH);
+  }
+
+  Ports::control(CONTROL_CLOCK_LOW);
+  Ports::control(CONTROL_IDLE);
+}
+
+#ifdef __AVR__
+
+#define PORT1_DATAf( x ) PORT ## x
+#define fPORT1_DATAf( x ) PORT1_DATAf( x )
+#define PORT1_DATA  fPORT1_DATAf( LPD_PORT1 )
+
+#define PORT2_DATAf( x ) PORT ## x
+#define fPORT2_DATAf( x ) PORT2_DATAf( x )
+#define PORT2_DATA  fPORT2_DATAf( LPD_PORT2 )
+
+#define CONTROL_DATAf( x ) PORT ## x
+#define fCONTROL_DATAf( x ) CONTROL_DATAf( x )
+#define CONTROL_PORT  fCONTROL_DATAf( LPD_CONTROL_PORT )
+
+
+#define PORT1_DDRf( x ) DDR ## x
+#define fPORT1_DDRf( x ) PORT1_DDRf( x )
+#define PORT1_DDR  fPORT1_DDRf( LPD_PORT1 )
+
+#define PORT2_DDRf( x ) DDR ## x
+#define fPORT2_DDRf( x ) PORT2_DDRf( x )
+#define PORT2_DDR  fPORT2_DDRf( LPD_PORT2 )
+
+#define CONTROL_DDRf( x ) DDR ## x
+#define fCONTROL_DDRf( x ) CONTROL_DDRf( x )
+#define CONTROL_DDR  fCONTROL_DDRf( LPD_CONTROL_PORT )
+
+/**
+ * Drives the real ports on the Mega2560.
+ */
+struct AvrPorts
+{
+  static void setup() {
+    PORT1_DDR = 0xff;
+    PORT2_DDR = 0xff;
+
+    CONTROL_DDR = 0xff;
+    CONTROL_PORT = CONTROL_IDLE;
+  }
+
+  static inline void data(uint8_t a, uint8_t b) {
+    PORT1_DATA = a;
+    PORT2_DATA = b;
+  }
+
+  static inline void control(uint8_t v) {
+    CONTROL_PORT = v;
+  }
+
+  static inline void clock_begin() {
+    bitbang_clock<AvrPorts>();
+  }
+
+  static inline void clock_end() { }
+};
+
+/**
+ * Clocks the shift registers from the SPI hardware, with SCK (PB1, pin 52)
+ * wired to the shift register clock in place of PL4. Each dummy byte written
+ * to SPDR makes the 8 clock edges in 16 cycles at fosc/2, and the CPU gets on
+ * with the next group meanwhile. MOSI is unused, and SS (PB0, pin 53) is an
+ * output so that the SPI stays master.
+ */
+struct AvrSpiPorts : public AvrPorts
+{
+  static void setup() {
+    AvrPorts::setup();
+
+    DDRB |= _BV(PB0) | _BV(PB1) | _BV(PB2);
+    SPCR = _BV(SPE) | _BV(MSTR);    // mode 0: SCK idles low
+    SPSR = _BV(SPI2X);              // fosc/2
+
+    // One byte with the clock inhibited, so that SPIF is set and the first
+    // clock_end() has nothing to wait for.
+    SPDR = 0;
+    while (!(SPSR & _BV(SPIF)))
+      ;
+  }
+
+  static inline void clock_begin() {
+    control(CONTROL_CLOCK_LOW);
+    SPDR = 0;
+  }
+
+  static inline void clock_end() {
+    while (!(SPSR & _BV(SPIF)))
+      ;
+  }
+};
+
+#else
+
+/**
+ * A single store to one of the ports.
+ */
+struct PortEvent
+{
+  enum Port { DATA1, DATA2, CONTROL, SPI_START, SPI_WAIT };
+
+  uint8_t port;
+  uint8_t value;
+};
+
+const uint16_t SIM_TRACE_LENGTH = 32768;
+const uint16_t SIM_STREAM_LENGTH = 1024;
+
+/**
+ * Host-side stand-in for the ports. Every store is appended to a trace, and
+ * the shift registers are modeled so that the bytes each strip would receive
+ * can be read back.
+ */
+struct SimPorts
+{
+  static void setup() {
+    reset();
+    control(CONTROL_IDLE);
+  }
+
+  static void data(uint8_t a, uint8_t b) {
+    record(PortEvent::DATA1, a);
+    record(PortEvent::DATA2, b);
+    _port1 = a;
+    _port2 = b;
+  }
+
+  static void control(uint8_t v);
+
+  static void clock_begin() {
+    bitbang_clock<SimPorts>();
+  }
+
+  static void clock_end() { }
+
+  /**
+   * Clear the trace and all of the strip streams.
+   */
+  static void reset();
+
+  static uint16_t trace_length() { return _trace_length; }
+  static const PortEvent* trace() { return _trace; }
+
+  /**
+   * Number of stores that didn't fit in the trace.
+   */
+  static uint32_t dropped() { return _dropped; }
+
+  /**
+   * Rising clock edges seen while the clock was enabled.
+   */
+  static uint32_t clock_edges() { return _edges; }
+
+  /**
+   * The bytes shifted out of a shift register since the last reset.
+   * Registers 0-3 are on port 1 and 4-7 on port 2.
+   */
+  static uint16_t stream_length(uint8_t strip) { return _stream_length[strip]; }
+  static const uint8_t* stream(uint8_t strip) { return _stream[strip]; }
+
+protected:
+  static void record(uint8_t port, uint8_t value);
+
+  /**
+   * One rising edge on the shift register clock.
+   */
+  static void edge();
+
+  static PortEvent _trace[SIM_TRACE_LENGTH];
+  static uint16_t _trace_length;
+  static uint32_t _dropped;
+  static uint32_t _edges;
+
+  static uint8_t _port1, _port2, _control;
+  static uint8_t _shift[8];
+  static uint8_t _out[8];
+  static uint8_t _bits;
+
+  static uint8_t _stream[8][SIM_STREAM_LENGTH];
+  static uint16_t _stream_length[8];
+};
+
+/**
+ * SimPorts with the SPI clocking the shift registers, like AvrSpiPorts. The
+ * 8 edges happen at clock_begin(), provided the inhibit is low; a load or
+ * another clock_begin() before clock_end() would upset a real shift, and is
+ * counted as a collision.
+ */
+struct SimSpiPorts : public SimPorts
+{
+  static void setup() {
+    SimPorts::setup();
+    _shifting = false;
+    _collisions = 0;
+  }
+
+  static void control(uint8_t v) {
+    if (_shifting && (v & SELECT_MASK) != SELECT_MASK)
+      ++_collisions;
+    SimPorts::control(v);
+  }
+
+  static void clock_begin();
+  static void clock_end();
+
+  static uint32_t collisions() { return _collisions; }
+
+private:
+  static bool _shifting;
+  static uint32_t _collisions;
+};
+
+/**
+ * Turns a port trace into an estimate of how long the AVR would have taken to
+ * produce it. The defaults assume a 16 MHz Mega2560 with the data ports in I/O
+ * space (ld + out) and the control port in extended I/O (ldi + sts), plus a
+ * little loop overhead per store. An SPI byte takes spi_cycles from the store
+ * to SPDR, and waiting for it costs whatever is left of that plus a pass
+ * through the SPIF polling loop.
+ */
+struct CycleCostModel
+{
+  CycleCostModel()
+    : f_cpu(16000000UL), data_cycles(3), control_cycles(3), overhead_cycles(1),
+      spi_cycles(16), spi_poll_cycles(3)
+  { }
+
+  uint32_t cycles(const PortEvent* trace, uint16_t length) const;
+
+  /**
+   * Estimated time for the trace, in microseconds.
+   */
+  uint32_t micros(const PortEvent* trace, uint16_t length) const {
+    return uint64_t(cycles(trace, length)) * 1000000UL / f_cpu;
+  }
+
+  uint32_t f_cpu;
+  uint8_t data_cycles;
+  uint8_t control_cycles;
+  uint8_t overhead_cycles;
+  uint8_t spi_cycles;
+  uint8_t spi_poll_cycles;
+};
+
+#endif
+
+#endif
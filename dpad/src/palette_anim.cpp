@@ -0,0 +1,160 @@
+#include <Arduino.h>
+#include "palette_anim.h"
+
+PaletteAnimator::PaletteAnimator(Palette* out)
+  : _out(out), _cycle_length(0), _cycle_period(0), _last_cycle(0),
+    _mode(PA_IDLE), _from(NULL), _to(NULL), _duration(0), _start(0),
+    _blend_from(NULL), _blend_to(NULL), _blend_from_generation(0),
+    _blend_to_generation(0), _blend_weight(0), _num_keys(0)
+{
+}
+
+void PaletteAnimator::set_cycle(uint16_t num, uint16_t period_ms)
+{
+  _cycle_length = num;
+  _cycle_period = period_ms;
+  _last_cycle = millis();
+}
+
+void PaletteAnimator::crossfade(const Palette* from, const Palette* to,
+                                uint16_t duration_ms, uint32_t now)
+{
+  _mode = PA_CROSSFADE;
+  _from = from;
+  _to = to;
+  _duration = duration_ms;
+  _start = now;
+}
+
+bool PaletteAnimator::add_keyframe(const Palette* p, uint16_t hold_ms,
+                                   uint16_t fade_ms)
+{
+  if (_num_keys == MAX_PALETTE_KEYFRAMES)
+    return false;
+
+  Keyframe& k = _keys[_num_keys++];
+  k.palette = p;
+  k.hold_ms = hold_ms;
+  k.fade_ms = fade_ms;
+  return true;
+}
+
+void PaletteAnimator::play(uint32_t now)
+{
+  if (_num_keys == 0)
+    return;
+
+  _mode = PA_KEYFRAMES;
+  _start = now;
+}
+
+void PaletteAnimator::stop()
+{
+  _mode = PA_IDLE;
+}
+
+void PaletteAnimator::clear_keyframes()
+{
+  if (_mode == PA_KEYFRAMES)
+    _mode = PA_IDLE;
+  _num_keys = 0;
+}
+
+bool PaletteAnimator::update(uint32_t now)
+{
+  bool changed = false;
+
+  switch (_mode) {
+  case PA_CROSSFADE: {
+    uint32_t elapsed = now - _start;
+    if (elapsed >= _duration) {
+      changed = blend(_from, _to, 256);
+      _mode = PA_IDLE;
+    }
+    else
+      changed = blend(_from, _to, elapsed * 256 / _duration);
+    break;
+  }
+
+  case PA_KEYFRAMES: {
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < _num_keys; ++i)
+      total += _keys[i].hold_ms + _keys[i].fade_ms;
+    if (total == 0) {
+      changed = blend(_keys[0].palette, _keys[0].palette, 0);
+      break;
+    }
+
+    uint32_t t = (now - _start) % total;
+    uint8_t i = 0;
+    while (t >= uint32_t(_keys[i].hold_ms) + _keys[i].fade_ms) {
+      t -= _keys[i].hold_ms + _keys[i].fade_ms;
+      ++i;
+    }
+
+    const Keyframe& k = _keys[i];
+    if (t < k.hold_ms)
+      changed = blend(k.palette, k.palette, 0);
+    else {
+      const Keyframe& next = _keys[i + 1 < _num_keys ? i + 1 : 0];
+      changed = blend(k.palette, next.palette,
+                      (t - k.hold_ms) * 256 / k.fade_ms);
+    }
+    break;
+  }
+
+  default:
+    break;
+  }
+
+  if (_cycle_period != 0 && _cycle_length != 0) {
+    uint32_t steps = (now - _last_cycle) / _cycle_period;
+    if (steps > 0) {
+      _last_cycle += steps * _cycle_period;
+      for (steps %= _cycle_length; steps > 0; --steps)
+        _out->cycle_colors(_cycle_length);
+      changed = true;
+    }
+  }
+
+  return changed;
+}
+
+/**
+ * Write from + (to - from) * weight / 256 into the output. The output's own
+ * cycle offset still applies on top, so fades and cycling combine.
+ */
+bool PaletteAnimator::blend(const Palette* from, const Palette* to,
+                            uint16_t weight)
+{
+  if (from == _blend_from && to == _blend_to && weight == _blend_weight &&
+      from->generation() == _blend_from_generation &&
+      to->generation() == _blend_to_generation)
+    return false;
+
+  _blend_from = from;
+  _blend_to = to;
+  _blend_from_generation = from->generation();
+  _blend_to_generation = to->generation();
+  _blend_weight = weight;
+
+  uint16_t size = _out->size();
+  if (from->size() < size)
+    size = from->size();
+  if (to->size() < size)
+    size = to->size();
+
+  for (uint16_t i = 0; i < size; ++i) {
+    const color& a = from->get(i);
+    const color& b = to->get(i);
+    color& c = _out->_c[i];
+    for (uint8_t ix = 0; ix < 3; ++ix) {
+      int16_t x = a.grb[ix] & 0x7f;
+      int16_t y = b.grb[ix] & 0x7f;
+      c.grb[ix] = 0x80 | (x + (((y - x) * int16_t(weight)) >> 8));
+    }
+  }
+
+  _out->touch();
+  return true;
+}
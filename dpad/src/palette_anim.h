@@ -0,0 +1,101 @@
+#ifndef PALETTE_ANIM_H__
+#define PALETTE_ANIM_H__
+
+#include <Arduino.h>
+#include "image.h"
+
+const uint8_t MAX_PALETTE_KEYFRAMES = 8;
+
+/**
+ * Drives the colors of one output palette over time: color cycling, a
+ * crossfade between two palettes, or a looping schedule of keyframe palettes
+ * with fades between them.
+ *
+ * Nothing is done per frame unless something visible changes. Cycling only
+ * moves the output palette's rotation offset, and fades only rewrite the
+ * output when the blend weight steps. The frame picks up the new colors on its
+ * next compile/show, through the palette's generation counter.
+ */
+class PaletteAnimator
+{
+public:
+  PaletteAnimator(Palette* out);
+
+  /**
+   * Rotate the first 'num' colors of the output every 'period_ms'. A period
+   * of 0 stops cycling.
+   */
+  void set_cycle(uint16_t num, uint16_t period_ms);
+
+  /**
+   * Fade the output from one palette to the other, starting at 'now'. The
+   * output stays at 'to' when the fade is done.
+   */
+  void crossfade(const Palette* from, const Palette* to,
+                 uint16_t duration_ms, uint32_t now);
+
+  /**
+   * Append a keyframe to the schedule: hold the palette for 'hold_ms', then
+   * fade to the next keyframe (wrapping to the first) over 'fade_ms'.
+   * Returns false if the schedule is full.
+   */
+  bool add_keyframe(const Palette* p, uint16_t hold_ms, uint16_t fade_ms);
+
+  /**
+   * Start running the keyframe schedule from the first keyframe.
+   */
+  void play(uint32_t now);
+
+  /**
+   * Stop fades and keyframes, leaving the output as it is.
+   */
+  void stop();
+
+  void clear_keyframes();
+
+  /**
+   * Advance everything to 'now'. Returns true if the output palette changed.
+   */
+  bool update(uint32_t now);
+
+private:
+  struct Keyframe
+  {
+    const Palette* palette;
+    uint16_t hold_ms;
+    uint16_t fade_ms;
+  };
+
+  enum Mode
+  {
+    PA_IDLE,
+    PA_CROSSFADE,
+    PA_KEYFRAMES
+  };
+
+  bool blend(const Palette* from, const Palette* to, uint16_t weight);
+
+  Palette* _out;
+
+  uint16_t _cycle_length;
+  uint16_t _cycle_period;
+  uint32_t _last_cycle;
+
+  uint8_t _mode;
+  const Palette* _from;
+  const Palette* _to;
+  uint16_t _duration;
+  uint32_t _start;
+
+  // Last blend written to the output, so unchanged weights are skipped.
+  const Palette* _blend_from;
+  const Palette* _blend_to;
+  uint16_t _blend_from_generation;
+  uint16_t _blend_to_generation;
+  uint16_t _blend_weight;
+
+  Keyframe _keys[MAX_PALETTE_KEYFRAMES];
+  uint8_t _num_keys;
+};
+
+#endif
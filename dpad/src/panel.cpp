@@ -0,0 +1,22 @@
+#include <Arduino.h>
+#include "panel.h"
+
+#define PANEL32X32_OFFSET(x, y) SerpentinePanel<32, 32, 8>::offset(x, y)
+#define PANEL32X32_OFFSETS_4(x, y)                                      \
+  PANEL32X32_OFFSET(x, y),     PANEL32X32_OFFSET(x, y + 1),             \
+  PANEL32X32_OFFSET(x, y + 2), PANEL32X32_OFFSET(x, y + 3)
+#define PANEL32X32_OFFSETS_COLUMN(x)                                    \
+  { PANEL32X32_OFFSETS_4(x, 0),  PANEL32X32_OFFSETS_4(x, 4),            \
+    PANEL32X32_OFFSETS_4(x, 8),  PANEL32X32_OFFSETS_4(x, 12),           \
+    PANEL32X32_OFFSETS_4(x, 16), PANEL32X32_OFFSETS_4(x, 20),           \
+    PANEL32X32_OFFSETS_4(x, 24), PANEL32X32_OFFSETS_4(x, 28) }
+#define PANEL32X32_OFFSETS_COLUMNS_4(x)                                 \
+  PANEL32X32_OFFSETS_COLUMN(x),     PANEL32X32_OFFSETS_COLUMN(x + 1),   \
+  PANEL32X32_OFFSETS_COLUMN(x + 2), PANEL32X32_OFFSETS_COLUMN(x + 3)
+
+const uint16_t PANEL32X32_OFFSETS[32][32] PROGMEM = {
+  PANEL32X32_OFFSETS_COLUMNS_4(0),  PANEL32X32_OFFSETS_COLUMNS_4(4),
+  PANEL32X32_OFFSETS_COLUMNS_4(8),  PANEL32X32_OFFSETS_COLUMNS_4(12),
+  PANEL32X32_OFFSETS_COLUMNS_4(16), PANEL32X32_OFFSETS_COLUMNS_4(20),
+  PANEL32X32_OFFSETS_COLUMNS_4(24), PANEL32X32_OFFSETS_COLUMNS_4(28)
+};
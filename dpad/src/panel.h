@@ -0,0 +1,98 @@
+#ifndef PANEL_H__
+#define PANEL_H__
+
+#include <Arduino.h>
+
+/**
+ * Panel geometries. A geometry describes how a WIDTH x HEIGHT grid of pixels
+ * is laid out over STRIPS strips of STRIP_LENGTH LEDs each:
+ *
+ *   offset(x, y)   - constexpr strip * STRIP_LENGTH + index of a pixel
+ *   lookup(x, y)   - the same thing, as fast as the geometry can manage it
+ *
+ * Image, CompiledFrame and the LPD8806x8 driver are all templated on the
+ * geometry, so buffers are sized to the panel and all of the layout math is
+ * resolved at compile time.
+ */
+
+/**
+ * Strips run in vertical segments of HEIGHT LEDs that alternate direction.
+ * The first half of the strips covers the left half of the panel, starting
+ * at the middle and working out; the second half covers the right half,
+ * starting at the middle and working out. Within a half, neighboring columns
+ * belong to neighboring strips.
+ */
+template <uint8_t W, uint8_t H, uint8_t S>
+struct SerpentinePanel
+{
+  static const uint8_t WIDTH = W;
+  static const uint8_t HEIGHT = H;
+  static const uint8_t STRIPS = S;
+
+  static const uint8_t STRIPS_PER_HALF = S / 2;
+  static const uint8_t SEGMENTS = W / S;
+  static const uint16_t STRIP_LENGTH = uint16_t(SEGMENTS) * H;
+
+  static constexpr uint16_t segment_offset(uint8_t m, uint8_t y) {
+    return m * H + (m % 2 == 0 ? y : H - 1 - y);
+  }
+
+  static constexpr uint16_t offset(uint8_t x, uint8_t y) {
+    return x >= W / 2
+      ? (STRIPS_PER_HALF + x % STRIPS_PER_HALF) * STRIP_LENGTH +
+        segment_offset((x - W / 2) / STRIPS_PER_HALF, y)
+      : (x % STRIPS_PER_HALF) * STRIP_LENGTH +
+        segment_offset(SEGMENTS - 1 - x / STRIPS_PER_HALF, y);
+  }
+
+  static uint16_t lookup(uint8_t x, uint8_t y) {
+    return offset(x, y);
+  }
+};
+
+/**
+ * N copies of a panel side by side, with each strip running on from a panel
+ * into the same strip of the panel to its right.
+ */
+template <class Panel, uint8_t N>
+struct ChainedPanels
+{
+  static const uint8_t WIDTH = Panel::WIDTH * N;
+  static const uint8_t HEIGHT = Panel::HEIGHT;
+  static const uint8_t STRIPS = Panel::STRIPS;
+  static const uint16_t STRIP_LENGTH = Panel::STRIP_LENGTH * N;
+
+  // Coordinates are bytes everywhere, so the chain has to be too.
+  static_assert(uint16_t(Panel::WIDTH) * N <= 255,
+                "ChainedPanels is wider than a uint8_t coordinate can reach");
+
+  static constexpr uint16_t offset(uint8_t x, uint8_t y) {
+    return (Panel::offset(x % Panel::WIDTH, y) / Panel::STRIP_LENGTH) *
+             STRIP_LENGTH +
+           (x / Panel::WIDTH) * Panel::STRIP_LENGTH +
+           Panel::offset(x % Panel::WIDTH, y) % Panel::STRIP_LENGTH;
+  }
+
+  static uint16_t lookup(uint8_t x, uint8_t y) {
+    return offset(x, y);
+  }
+};
+
+/**
+ * SerpentinePanel<32, 32, 8>::offset() for every pixel, indexed [x][y] and
+ * generated at compile time. Lives in program memory on the AVR.
+ */
+extern const uint16_t PANEL32X32_OFFSETS[32][32] PROGMEM;
+
+/**
+ * The original 32x32 panel: 8 strips of 128 LEDs. Lookups go through a table
+ * instead of doing the divides and the serpentine flip.
+ */
+struct Panel32x32 : public SerpentinePanel<32, 32, 8>
+{
+  static uint16_t lookup(uint8_t x, uint8_t y) {
+    return pgm_read_word(&PANEL32X32_OFFSETS[x][y]);
+  }
+};
+
+#endif
@@ -0,0 +1,38 @@
+#include <Arduino.h>
+#include "serial_receiver.h"
+
+SerialReceiver::SerialReceiver(Stream* in, FrameDecoder* decoder)
+  : _in(in), _decoder(decoder), _head(0), _count(0)
+{
+}
+
+void SerialReceiver::poll()
+{
+  // Anything that doesn't fit stays in the serial buffer for next time.
+  while (_count < RECEIVE_BUFFER_LENGTH && _in->available() > 0) {
+    uint16_t tail = _head + _count;
+    if (tail >= RECEIVE_BUFFER_LENGTH)
+      tail -= RECEIVE_BUFFER_LENGTH;
+
+    _buffer[tail] = _in->read();
+    ++_count;
+  }
+}
+
+uint8_t SerialReceiver::service(uint16_t budget)
+{
+  poll();
+
+  while (_count > 0 && budget-- > 0) {
+    uint8_t b = _buffer[_head];
+    if (++_head == RECEIVE_BUFFER_LENGTH)
+      _head = 0;
+    --_count;
+
+    uint8_t result = _decoder->feed(b);
+    if (result != FEED_MORE)
+      return result;
+  }
+
+  return FEED_MORE;
+}
@@ -0,0 +1,49 @@
+#ifndef SERIAL_RECEIVER_H__
+#define SERIAL_RECEIVER_H__
+
+#include <Arduino.h>
+#include "frame_decoder.h"
+
+const uint16_t RECEIVE_BUFFER_LENGTH = 256;
+
+/**
+ * Moves bytes from a serial port into a ring buffer, and from there into a
+ * FrameDecoder, a limited number at a time. Nothing ever waits for a byte:
+ * each tick takes whatever has arrived, so the panel keeps refreshing and
+ * animating while a frame comes in.
+ *
+ * The hardware serial buffer only holds 64 bytes, about 5 ms at 115200 baud,
+ * which is less than a full compile and show. poll() is cheap enough to call
+ * between any of the slow steps to keep it from overflowing.
+ */
+class SerialReceiver
+{
+public:
+  SerialReceiver(Stream* in, FrameDecoder* decoder);
+
+  /**
+   * Move whatever has arrived into the ring buffer.
+   */
+  void poll();
+
+  /**
+   * Poll, then decode up to 'budget' buffered bytes, stopping early at the
+   * end of a packet. Returns FEED_PACKET or FEED_ERROR if a packet ended, or
+   * FEED_MORE.
+   */
+  uint8_t service(uint16_t budget);
+
+  uint16_t buffered() const {
+    return _count;
+  }
+
+private:
+  Stream* _in;
+  FrameDecoder* _decoder;
+
+  uint8_t _buffer[RECEIVE_BUFFER_LENGTH];
+  uint16_t _head;
+  uint16_t _count;
+};
+
+#endif
@@ -1,8 +1,14 @@
 #include "image.h"
-#include <Wire.h>
+#include "i2c_queue.h"
 #include "clock.h"
+#include "soft_clock.h"
 #include "smart_card.h"
 #include "LPD8806x8.h"
+#include "palette_anim.h"
+#include "double_buffer.h"
+#include "frame_decoder.h"
+#include "serial_receiver.h"
+#include "asset_loader.h"
 //#include "test_image.h"
 
 uint8_t pin = 18;
@@ -13,125 +19,222 @@ uint8_t loadInhibitPin = 44;
 uint8_t indicator = 13;
 
 DS1307_Clock clock;
+SoftClock soft_clock(&clock);
+
+// With the DS1307's SQW/OUT wired to pin 2 (external interrupt 0), define
+// RTC_SQW to have the soft clock's seconds turn over on its edges.
+#ifdef RTC_SQW
+const uint8_t RTC_SQW_PIN = 2;
+const uint8_t RTC_SQW_INTERRUPT = 0;
+
+void rtc_sqw_edge()
+{
+  soft_clock.sqw_edge(millis());
+}
+#endif
 
 uint8_t datapin = 6;
 uint8_t clockpin = 7;
+// With SCK (pin 52) wired to the shift register clock in place of PL4, define
+// LPD_SPI_CLOCK to have the SPI hardware clock the registers (see
+// AvrSpiPorts).
+#ifdef LPD_SPI_CLOCK
+LPD8806x8Spi teststrip;
+#else
 LPD8806x8 teststrip;
+#endif
 
 const uint8_t STRIP_IMAGE_LENGTH = 128;
 
 StripImage stripImage(STRIP_IMAGE_LENGTH);
 Palette pal(256);
-Image img;
+DoubleBuffer<Image4> images;
+CompiledFrame frame;
+PaletteAnimator anim(&pal);
+FrameDecoder decoder(&images, &pal);
+SerialReceiver receiver(&Serial, &decoder);
+SmartCard card;
+AssetLoader assets(&card);
+AssetPlayer player(&assets, &images, &pal);
+
+const long SERIAL_BAUD = 115200;
+const uint8_t UPDATE_MS = 10;
+const uint16_t RECEIVE_BUDGET = 64;
+uint32_t last_update = 0;
+
+// Timer 2 interrupts this often to push out a slice of the frame.
+const uint16_t SCAN_HZ = 2000;
+// Groups loop() pushes out itself each time around while a frame is going
+// out, about 270 us' worth.
+const uint8_t LOOP_SCAN_GROUPS = 32;
+
+// A packet has flipped a new frame to the front, which isn't compiled yet.
+bool frame_waiting = false;
 
 void setup()
 {
-  Serial.begin(9600);
+  Serial.begin(SERIAL_BAUD);
   Serial.println("Starting...");
 
-  Serial.println("Loading palette.");
+  SmartCard::init();
+  clock.begin();
+#ifdef RTC_SQW
+  // SQW/OUT is open drain.
+  pinMode(RTC_SQW_PIN, INPUT_PULLUP);
+  clock.set_square_wave(true);
+  attachInterrupt(RTC_SQW_INTERRUPT, rtc_sqw_edge, RISING);
+#endif
+  decoder.set_card_writer(write_card);
+
+  if (load_card_assets(millis()))
+    Serial.println("Loaded the smart card.");
+  else {
+    Serial.println("Loading palette.");
   
-  for (int i = 0; i < 8; ++i)
-    pal.set_color_hsv(i, i*32, 255, 128);
-
-  for (int y = 0; y < 32; ++y)
-    for(int x = 0; x < 32; ++x)
-    {
-      int cx = x - 16;
-      int cy = y - 16;
-      img(x, 31-y) = ((cx + cy) / 4) % 8;
-    }
+    pal.fill_hsv_gradient(0, 8, 0, 7*32, 255, 128);
+
+    Image4& img = *images.back();
+    for (int y = 0; y < 32; ++y)
+      for(int x = 0; x < 32; ++x)
+      {
+        int cx = x - 16;
+        int cy = y - 16;
+        img.set_color(x, 31-y, ((cx + cy) / 4) % 8);
+      }
+    images.flip();
+  }
+
+  frame.compile(images.front(), &pal);
+  setupScanTimer();
 }
 
-uint8_t blocking_read()
+/**
+ * Start up into whatever is on the smart card (see asset_format.h): its
+ * first animation, or else its first palette and image. Returns false if
+ * there's nothing there.
+ */
+bool load_card_assets(uint32_t now)
 {
-  while ( !Serial.available() );
-  uint8_t x = Serial.read();
-  Serial.write('\n');
-  return x;
+  if (!assets.begin())
+    return false;
+
+  uint8_t a = assets.find(ASSET_ANIMATION);
+  if (a != ASSET_NONE)
+    return player.play(a, now);
+
+  uint8_t p = assets.find(ASSET_PALETTE);
+  if (p != ASSET_NONE && !assets.load_palette(p, &pal))
+    return false;
+
+  uint8_t image = min(assets.find(ASSET_IMAGE_4BIT),
+                      assets.find(ASSET_IMAGE_RLE));
+  return image != ASSET_NONE && player.show_image(image);
 }
 
-void read_color()
+/**
+ * PACKET_CARD_WRITE: the assets are about to change under the player.
+ */
+bool write_card(uint16_t address, const uint8_t* bytes, uint8_t size)
 {
-  uint8_t r = blocking_read();
-  uint8_t g = blocking_read();
-  uint8_t b = blocking_read();
-  pal.set_color(0, r, g, b);
-    
-  for (uint8_t y = 0; y < 32; ++y)
-    for (uint8_t x = 0; x < 32; ++x)
-      img(x, 31-y) = 0;
-  
-  teststrip.show(&img, &pal);
+  player.stop();
+  card.seek(address);
+  return card.write(bytes, size) == size;
 }
 
-void read_new_image()
+/**
+ * Timer 2 in CTC mode at SCAN_HZ, with the compare interrupt doing the
+ * scanout.
+ */
+void setupScanTimer()
 {
-  uint8_t num_p = Serial.read();
-  Serial.println((int)num_p);
-  for (uint8_t i = 0; i < num_p; ++i)
-  {
-    uint8_t r = blocking_read();
-    uint8_t g = blocking_read();
-    uint8_t b = blocking_read();
-    pal.set_color(i, r, g, b);
-  }
-  
-  for (uint8_t y = 0; y < 32; ++y)
-    for (uint8_t x = 0; x < 32; ++x)
-      img(x, 31-y) = blocking_read();
-  
-  teststrip.show(&img, &pal);
+  TCCR2A = _BV(WGM21);
+  TCCR2B = _BV(CS22);     // clk/64
+  OCR2A = F_CPU / 64 / SCAN_HZ - 1;
+  TIMSK2 = _BV(OCIE2A);
+}
+
+ISR(TIMER2_COMPA_vect)
+{
+  teststrip.service();
 }
 
 void loop()
 {
-  delay(100);
+  // Packets go into the back buffer as they arrive (see frame_packets.h),
+  // a few bytes each time around, while the front keeps being shown.
+  uint8_t received = receiver.service(RECEIVE_BUDGET);
+
+  // The sender waits for each answer, so answer as soon as the packet is
+  // in, and it can send the next one while this one goes out. If that one
+  // is in before this is compiled, it takes its place.
+  if (received == FEED_ERROR)
+    Serial.write(PACKET_NAK);
+  else if (received == FEED_PACKET) {
+    Serial.write(PACKET_ACK);
+    frame_waiting = true;
+  }
 
-  if (Serial.available())
-  {
-    switch(blocking_read())
-    {
-    case 0:
-      read_new_image();
-      break;
-    case 1:
-      read_color();
-      break;
-    default:
-      break;
-    }
+  // Frames from the link take over from the card.
+  if (decoder.busy() || received != FEED_MORE)
+    player.stop();
+
+  // The card's next step comes in a piece at a time, each time around, so
+  // it's never long before the receiver is serviced again.
+  player.update(millis());
+
+  // The last frame is still going out, and can't be recompiled until it's
+  // done. Help the timer push it out, with its interrupt held off so the two
+  // never scan at once.
+  if (teststrip.busy()) {
+    TIMSK2 = 0;
+    teststrip.scan(LOOP_SCAN_GROUPS);
+    TIMSK2 = _BV(OCIE2A);
+    return;
   }
 
-  //pal.cycle_colors(64);
-  teststrip.show(&img, &pal);
+  uint32_t now = millis();
+  if (!frame_waiting && now - last_update < UPDATE_MS)
+    return;
+  last_update = now;
+
+  // e.g. anim.set_cycle(64, 100) in setup() to cycle colors.
+  anim.update(now);
+  soft_clock.update(now);
+
+  // Both of these are nearly free when nothing has changed.
+  frame.compile(images.front(), &pal);
+  teststrip.begin_show(&frame);
+  frame_waiting = false;
 }
 
 void smart_card_test()
 {
-  uint16_t size = 5;
+  // Enough to cross a page boundary and come back around it.
+  const uint16_t size = 40;
+  uint8_t bytes[size];
 
   SmartCard::init();
   SmartCard card;
 
-  Serial.println(F("Writing ")); 
-  
   for (uint16_t i = 0; i < size; ++i)
-  {
-    card.write(i);
-    delay(5);
-  }
+    bytes[i] = i;
+
+  Serial.println(F("Writing ")); 
+  card.seek(10);
+  Serial.println( card.write(bytes, size) );
 
-  card.seek(0L);
+  memset(bytes, 0, size);
+  card.seek(10);
   
   Serial.println(F("Reading..."));
-  for (uint16_t i = 0; i < size; ++i)
+  uint16_t got = card.read(bytes, size);
+  for (uint16_t i = 0; i < got; ++i)
   {
-    Serial.print( card.read() );
+    Serial.print( bytes[i] ); Serial.print(' ');
   }
   Serial.println("");
 
-  card.seek(2L);
+  card.seek(12L);
   Serial.println(F("Reading..."));
   for (uint16_t i = 0; i < 3; ++i)
   {
@@ -144,7 +247,9 @@ void smart_card_test()
 
 void setupImageTest()
 {
-  uint8_t s, r;
+  const Image4& img = *images.front();
+  uint8_t s;
+  uint16_t r;
   for (uint8_t y = 0; y < 32; ++y)
   {
     img.rowcol(31, y, s, r);
@@ -178,11 +283,20 @@ void rtcSetup2()
 
 void rtcLoop2()
 {
-  delay(2000);
-  
-  ds1307_time time;
-  clock.get_time(&time);
-  clock.print_time(time);
+  static uint8_t last_second = 60;
+  uint32_t now = millis();
+
+  // The chip is only read now and then, in the background; in between, the
+  // time costs nothing.
+  soft_clock.update(now);
+  if (!soft_clock.valid())
+    return;
+
+  const ds1307_time& time = soft_clock.now(now);
+  if (time.seconds != last_second) {
+    last_second = time.seconds;
+    clock.print_time(time);
+  }
 }
 
 void setupLEDTest()
@@ -247,7 +361,10 @@ void sendP2SByte(uint8_t byte)
 
 void stripSpeedTest(void)
 {
+  Image4& img = *images.front();
   long start, elapsed;
+
+  teststrip.wait();
   Serial.print("Image speed:");
 
   start = micros();
@@ -259,6 +376,25 @@ void stripSpeedTest(void)
   Serial.print(elapsed);
   Serial.println(" us");
 
+  Serial.print("Image row speed:");
+  uint8_t row[32];
+  for (uint8_t i = 0; i < 32; ++i)
+    row[i] = i;
+  start = micros();
+  for (uint8_t j = 0; j < 32; ++j)
+    img.set_row(j, row);
+  elapsed = micros() - start;
+  Serial.print(elapsed);
+  Serial.println(" us");
+
+  Serial.print("Image column speed:");
+  start = micros();
+  for (uint8_t i = 0; i < 32; ++i)
+    img.set_column(i, row);
+  elapsed = micros() - start;
+  Serial.print(elapsed);
+  Serial.println(" us");
+
   Serial.print("Palette speed:");
   start = micros();
   for (uint16_t i = 0; i < 256; ++i)
@@ -269,9 +405,161 @@ void stripSpeedTest(void)
   Serial.println(" us");
 
   Serial.print("LPD8806x8 show speed: ");
+  img.touch();
   start = micros();
   teststrip.show(&img, &pal);
   elapsed = micros() - start;
   Serial.print(elapsed);
   Serial.println(" us");
 }
+
+void frameSpeedTest(void)
+{
+  Image4& img = *images.front();
+  const long frame_bytes =
+    (long(Image4::STRIP_LENGTH) * 3 + LPD8806x8::LATCH_BYTES) * Image4::STRIPS;
+  long start, elapsed;
+
+  // Let any scanout in progress finish before using the ports.
+  teststrip.wait();
+
+  Serial.print("Image/palette show: ");
+  img.touch();
+  start = micros();
+  teststrip.show(&img, &pal);
+  elapsed = micros() - start;
+  Serial.print(elapsed);
+  Serial.print(" us, ");
+  Serial.print(frame_bytes * 1000 / elapsed);
+  Serial.println(" KB/s");
+
+  Serial.print("Frame compile: ");
+  img.touch();
+  start = micros();
+  frame.compile(&img, &pal);
+  elapsed = micros() - start;
+  Serial.print(elapsed);
+  Serial.println(" us");
+
+  // The compiled show and the slice are timed with the timer off, so it
+  // neither counts in their times nor pushes slices of its own.
+  TIMSK2 = 0;
+  Serial.print("Compiled frame show: ");
+  start = micros();
+  teststrip.show(&frame);
+  elapsed = micros() - start;
+  Serial.print(elapsed);
+  Serial.print(" us, ");
+  Serial.print(frame_bytes * 1000 / elapsed);
+  Serial.println(" KB/s");
+
+  Serial.print("Scanout slice: ");
+  frame.invalidate();
+  teststrip.begin_show(&frame);
+  start = micros();
+  teststrip.service();
+  long slice = micros() - start;
+  while (teststrip.scan(0xffff))
+    ;
+  TIMSK2 = _BV(OCIE2A);
+  Serial.print(slice);
+  Serial.print(" us, ");
+  Serial.print(slice * SCAN_HZ / 10000);
+  Serial.println("% of the CPU");
+
+  Serial.print("Background scanout: ");
+  frame.invalidate();
+  start = micros();
+  teststrip.begin_show(&frame);
+  teststrip.wait();
+  elapsed = micros() - start;
+  Serial.print(elapsed);
+  Serial.println(" us to vsync");
+}
+
+void hsvSpeedTest(void)
+{
+  long start, elapsed;
+
+  Serial.print("Float HSV palette: ");
+  start = micros();
+  for (uint16_t i = 0; i < 256; ++i) {
+    float r, g, b;
+    HSVtoRGB(&r, &g, &b, float(i) * 360.0f / 255.0f, 1.0f, 0.5f);
+    pal.set_color(i, r * 255, g * 255, b * 255);
+  }
+  elapsed = micros() - start;
+  Serial.print(elapsed);
+  Serial.println(" us");
+
+  Serial.print("Integer HSV palette: ");
+  start = micros();
+  for (uint16_t i = 0; i < 256; ++i)
+    pal.set_color_hsv(i, i, 255, 128);
+  elapsed = micros() - start;
+  Serial.print(elapsed);
+  Serial.println(" us");
+
+  Serial.print("HSV gradient: ");
+  start = micros();
+  pal.fill_hsv_gradient(0, 256, 0, 255, 255, 128);
+  elapsed = micros() - start;
+  Serial.print(elapsed);
+  Serial.println(" us");
+}
+
+static void decode_byte(uint8_t b, void* context)
+{
+  static_cast<FrameDecoder*>(context)->feed(b);
+}
+
+static void protocolTestFrame(const char* name, FrameEncoder::Source source)
+{
+  FrameEncoder encoder(decode_byte, &decoder);
+  long start, elapsed;
+
+  Serial.print(name);
+  start = micros();
+  encoder.frame(source, NULL);
+  elapsed = micros() - start;
+
+  // Ten bits a byte on the wire, with the start and stop bits.
+  long wire = long(encoder.bytes()) * 100000 / (SERIAL_BAUD / 100);
+
+  Serial.print(encoder.bytes());
+  Serial.print(" bytes, ");
+  Serial.print(elapsed);
+  Serial.print(" us to code and decode, ");
+  Serial.print(1000000 / (wire + elapsed));
+  Serial.print(" frames/s at ");
+  Serial.print(SERIAL_BAUD);
+  Serial.println(" baud");
+}
+
+static uint8_t noisy_pixel(uint16_t k, void*)
+{
+  return (k * 37 + (k >> 3)) % FRAME_COLORS;
+}
+
+static uint8_t blocky_pixel(uint16_t k, void*)
+{
+  return ((k % FRAME_WIDTH) / 4 + (k / FRAME_WIDTH) / 8) % 8;
+}
+
+/**
+ * Frame rate the serial link manages for a noisy frame and a blocky one.
+ * The time on the device covers both ends of the link, so the real rate is a
+ * little better. The frames are worked out as they're coded, and go through
+ * the sketch's own decoder, so the test needs next to no memory. That can't
+ * be done in the middle of a packet from the link.
+ */
+void protocolSpeedTest(void)
+{
+  if (decoder.busy()) {
+    Serial.println(F("Protocol test: a packet is coming in"));
+    return;
+  }
+
+  protocolTestFrame("Raw frame: ", noisy_pixel);
+  protocolTestFrame("RLE frame: ", blocky_pixel);
+}
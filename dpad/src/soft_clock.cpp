@@ -0,0 +1,186 @@
+#include <Arduino.h>
+#include "soft_clock.h"
+
+/**
+ * Days in a month of 2000-2099, which is all the DS1307 counts.
+ */
+static uint8_t days_in_month(uint8_t month, uint8_t year)
+{
+  if (month == 2)
+    return year % 4 == 0 ? 29 : 28;
+  if (month == 4 || month == 6 || month == 9 || month == 11)
+    return 30;
+  return 31;
+}
+
+SoftClock::SoftClock(DS1307_Clock* rtc)
+  : _rtc(rtc), _second_ms(0), _valid(false), _reading(false),
+    _request_ms(0), _next_read_ms(0), _hunting(false), _hunt_seconds(0),
+    _hunt_request_ms(0), _edge(false), _edge_ms(0), _last_edge_ms(0),
+    _edges(false)
+{
+  memset(&_time, 0, sizeof(_time));
+}
+
+void SoftClock::update(uint32_t now)
+{
+  if (_reading) {
+    ds1307_time t;
+    if (_rtc->poll_time(&t)) {
+      _reading = false;
+      sync(t, now);
+    }
+    else if (!_rtc->requested()) {
+      // It failed, or was dropped for a blocking call on the chip.
+      _reading = false;
+      _hunting = false;
+      _next_read_ms = now + SOFT_CLOCK_RETRY_MS;
+    }
+    return;
+  }
+
+  if (int32_t(now - _next_read_ms) >= 0 && _rtc->request_time()) {
+    _reading = true;
+    _request_ms = now;
+  }
+}
+
+void SoftClock::sqw_edge(uint32_t now)
+{
+  _edge_ms = now;
+  _edge = true;
+}
+
+const ds1307_time& SoftClock::now(uint32_t ms)
+{
+  advance(ms);
+  return _time;
+}
+
+/**
+ * Add on the seconds gone by up to 'now'.
+ */
+void SoftClock::advance(uint32_t now)
+{
+  take_edge();
+  if (!_valid)
+    return;
+
+  // Halted, the time stays put until the chip starts again.
+  if (_rtc->halted()) {
+    _second_ms = now;
+    return;
+  }
+
+  if (_edges && now - _last_edge_ms > SOFT_CLOCK_EDGE_TIMEOUT_MS)
+    _edges = false;
+
+  while (int32_t(now - _second_ms) >= 1000) {
+    add_second();
+    _second_ms += 1000;
+  }
+}
+
+/**
+ * Line the seconds up with the last SQW edge, if there's been one since the
+ * last call. Only the last is kept, which is all that's needed.
+ */
+void SoftClock::take_edge()
+{
+  if (!_edge)
+    return;
+
+  uint8_t sreg = SREG;
+  cli();
+  uint32_t edge = _edge_ms;
+  _edge = false;
+  SREG = sreg;
+
+  _last_edge_ms = edge;
+  _edges = true;
+  if (!_valid || _rtc->halted())
+    return;
+
+  while (int32_t(edge - _second_ms) >= 1000) {
+    add_second();
+    _second_ms += 1000;
+  }
+
+  // Past the middle of the second, the edge starts the next one; otherwise
+  // it's the start of this one, a little off.
+  int32_t off = edge - _second_ms;
+  if (off >= 500)
+    add_second();
+  if (off > -500)
+    _second_ms = edge;
+}
+
+/**
+ * Take in the time read from the chip, which was asked for at _request_ms.
+ */
+void SoftClock::sync(const ds1307_time& t, uint32_t now)
+{
+  advance(now);
+  _next_read_ms = now + SOFT_CLOCK_RESYNC_MS;
+
+  if (_valid && _edges) {
+    // The seconds are right already. A second that turned over while the
+    // read was waiting for the bus leaves it unclear which one it got, so
+    // that read is made again.
+    if (int32_t(_second_ms - _request_ms) > 0)
+      _next_read_ms = now;
+    else
+      _time = t;
+    _hunting = false;
+    return;
+  }
+
+  // Near enough to be going on with.
+  if (!_valid) {
+    _time = t;
+    _second_ms = _request_ms;
+    _valid = true;
+  }
+
+  if (_rtc->halted()) {
+    _time = t;
+    _hunting = false;
+    return;
+  }
+
+  if (!_hunting || t.seconds == _hunt_seconds) {
+    _hunting = true;
+    _hunt_seconds = t.seconds;
+    _hunt_request_ms = _request_ms;
+    _next_read_ms = _request_ms + SOFT_CLOCK_HUNT_MS;
+    return;
+  }
+
+  // The second turned over between the last two reads.
+  _hunting = false;
+  _time = t;
+  _second_ms = _hunt_request_ms + (_request_ms - _hunt_request_ms) / 2;
+  advance(now);
+}
+
+void SoftClock::add_second()
+{
+  if (++_time.seconds < 60)
+    return;
+  _time.seconds = 0;
+  if (++_time.minutes < 60)
+    return;
+  _time.minutes = 0;
+  if (++_time.hours < 24)
+    return;
+  _time.hours = 0;
+
+  _time.day_of_week = _time.day_of_week % 7 + 1;
+  if (++_time.day <= days_in_month(_time.month, _time.year))
+    return;
+  _time.day = 1;
+  if (++_time.month <= 12)
+    return;
+  _time.month = 1;
+  _time.year = (_time.year + 1) % 100;
+}
@@ -0,0 +1,88 @@
+#ifndef SOFT_CLOCK_H__
+#define SOFT_CLOCK_H__
+
+#include <Arduino.h>
+#include "clock.h"
+
+// How often the DS1307 is read again to keep the time in step.
+const uint32_t SOFT_CLOCK_RESYNC_MS = 60000;
+// How soon to try again after a read fails.
+const uint16_t SOFT_CLOCK_RETRY_MS = 1000;
+// How often the chip is read while waiting for its second to turn over.
+const uint8_t SOFT_CLOCK_HUNT_MS = 50;
+// With no SQW edge for this long, the seconds go back to being timed from
+// the reads alone.
+const uint16_t SOFT_CLOCK_EDGE_TIMEOUT_MS = 2500;
+
+/**
+ * The time from the DS1307, kept in memory and carried on from millis(), so
+ * that asking for it costs nothing on the bus. The chip is read once to
+ * start, then again every SOFT_CLOCK_RESYNC_MS in the background, and the
+ * copy takes whatever it says.
+ *
+ * A read only gives the time to the second. To find where the chip's second
+ * starts, each resync goes on reading every SOFT_CLOCK_HUNT_MS until the
+ * seconds change, which lines the two up to within half that. With the
+ * chip's 1 Hz square wave on (DS1307_Clock::set_square_wave()) and wired to
+ * an interrupt that calls sqw_edge(), the edges do it instead, and one read
+ * is enough.
+ *
+ * While the chip's clock is halted (DS1307_Clock::disable()), so is this one.
+ */
+class SoftClock
+{
+public:
+  SoftClock(DS1307_Clock* rtc);
+
+  /**
+   * Call from loop(): takes in a read that's finished, and starts the next
+   * when it's due. Never waits for the bus. The first call starts the first
+   * read, and there's no time until it's in; see valid().
+   */
+  void update(uint32_t now);
+
+  /**
+   * The square wave rose at 'now': the chip's second has just turned over.
+   * Can be called from an interrupt.
+   */
+  void sqw_edge(uint32_t now);
+
+  bool valid() const {
+    return _valid;
+  }
+
+  /**
+   * The time at 'ms', from millis(). Only the whole seconds gone by since the
+   * last call are added on.
+   */
+  const ds1307_time& now(uint32_t ms);
+
+private:
+  void advance(uint32_t now);
+  void take_edge();
+  void sync(const ds1307_time& t, uint32_t now);
+  void add_second();
+
+  DS1307_Clock* _rtc;
+
+  ds1307_time _time;
+  uint32_t _second_ms;        // When the second in _time started
+  bool _valid;
+
+  bool _reading;
+  uint32_t _request_ms;
+  uint32_t _next_read_ms;
+
+  // Reading until the seconds change.
+  bool _hunting;
+  uint8_t _hunt_seconds;
+  uint32_t _hunt_request_ms;  // When the last read with the old seconds went
+
+  // From sqw_edge(), which may be an interrupt.
+  volatile bool _edge;
+  volatile uint32_t _edge_ms;
+  uint32_t _last_edge_ms;
+  bool _edges;                // Seconds are timed from the edges
+};
+
+#endif
@@ -0,0 +1,239 @@
+/**
+ * Runs SoftClock against a simulated DS1307 for half an hour, with
+ * millis() running fast or slow of the chip by a given amount, as the
+ * board's oscillator would. The soft clock is asked for the time every
+ * 10 ms, as a clock face redrawn each update would; each time is checked
+ * against the chip's, and how long they disagree for is reported, timed
+ * from the reads alone and with the 1 Hz SQW edges. So are the bus
+ * transfers it costs, next to reading the chip each time instead.
+ *
+ * It then checks that the time carries over the end of a day, February in
+ * a leap year and the end of the century the way the chip's does, and that
+ * it stops and starts with DS1307_Clock::disable() and enable().
+ *
+ *   clock_sim [-d drift_ppm]
+ *
+ * Exits with 1 if the time is ever out by more than a second, or wrong
+ * after a rollover or while halted.
+ *
+ * Build with:
+ *
+ *   g++ -O2 -Ihost -I../src -I../lib/I2CQueue -o clock_sim clock_sim.cpp \
+ *     host/twi_sim.cpp ../lib/I2CQueue/i2c_queue.cpp ../src/clock.cpp \
+ *     ../src/soft_clock.cpp
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "Arduino.h"
+#include "i2c_queue.h"
+#include "clock.h"
+#include "soft_clock.h"
+
+#define UPDATE_MS   10
+#define RUN_S       1800
+
+static long drift_ppm = 300;
+
+unsigned long millis()
+{
+  return uint64_t(SimTwi::now_us) * (1000000 + drift_ppm) / 1000000000;
+}
+
+unsigned long micros()
+{
+  return uint64_t(SimTwi::now_us) * (1000000 + drift_ppm) / 1000000;
+}
+
+static SimDS1307 rtc;
+static DS1307_Clock clock;
+
+static uint8_t from_bcd(uint8_t b)
+{
+  return (b & 0xf) + 10 * (b >> 4);
+}
+
+/**
+ * Seconds from the soft clock's time to the chip's, within a day.
+ */
+static long seconds_off(const ds1307_time& t)
+{
+  rtc.update();
+  long chip = from_bcd(rtc.registers[2]) * 3600L +
+    from_bcd(rtc.registers[1]) * 60 + from_bcd(rtc.registers[0] & 0x7f);
+  long soft = t.hours * 3600L + t.minutes * 60 + t.seconds;
+  long off = soft - chip;
+  if (off > 43200)
+    off -= 86400;
+  if (off < -43200)
+    off += 86400;
+  return off;
+}
+
+static bool same_date(const ds1307_time& t)
+{
+  rtc.update();
+  return t.day_of_week == rtc.registers[3] &&
+    t.day == from_bcd(rtc.registers[4]) &&
+    t.month == from_bcd(rtc.registers[5]) &&
+    t.year == from_bcd(rtc.registers[6]);
+}
+
+/**
+ * Run for 'seconds' of chip time, polling SQW every millisecond if 'sqw'.
+ * Returns the worst difference from the chip in seconds, and the time
+ * they disagreed for.
+ */
+static long run(SoftClock* soft, uint32_t seconds, bool sqw, bool* dates_ok,
+                uint32_t* off_ms)
+{
+  long worst = 0;
+  bool level = rtc.sqw();
+  uint32_t last_update = millis();
+
+  *off_ms = 0;
+  for (uint32_t ms = 0; ms < seconds * 1000; ++ms) {
+    SimTwi::advance(1000);
+
+    if (sqw) {
+      bool now_level = rtc.sqw();
+      if (now_level && !level)
+        soft->sqw_edge(millis());
+      level = now_level;
+    }
+
+    uint32_t now = millis();
+    if (now - last_update < UPDATE_MS)
+      continue;
+    last_update = now;
+
+    soft->update(now);
+    if (!soft->valid())
+      continue;
+
+    const ds1307_time& t = soft->now(now);
+    long off = seconds_off(t);
+    if (off != 0)
+      *off_ms += UPDATE_MS;
+    if (labs(off) > labs(worst))
+      worst = off;
+    if (off == 0 && !same_date(t))
+      *dates_ok = false;
+  }
+  return worst;
+}
+
+static bool drift_test(bool sqw)
+{
+  SoftClock soft(&clock);
+  bool dates_ok = true;
+  uint32_t off_ms;
+
+  clock.set_square_wave(sqw);
+  SimTwi::reset_counts();
+  long worst = run(&soft, RUN_S, sqw, &dates_ok, &off_ms);
+
+  printf("%-16s %6ld %10.3f%% %10lu %10lu\n", sqw ? "with SQW" : "reads alone",
+         worst, off_ms * 100.0 / (RUN_S * 1000.0),
+         (unsigned long)SimTwi::transfers,
+         (unsigned long)RUN_S * (1000 / UPDATE_MS) * 2);
+  return labs(worst) <= 1 && dates_ok;
+}
+
+/**
+ * Set the chip to a few seconds before 'when', and check the soft clock
+ * follows it over.
+ */
+static bool rollover_test(const char* what, ds1307_time when)
+{
+  SoftClock soft(&clock);
+  bool dates_ok = true;
+  uint32_t off_ms;
+
+  clock.set_time(when, true);
+  long worst = run(&soft, 10, true, &dates_ok, &off_ms);
+
+  bool ok = labs(worst) <= 1 && dates_ok;
+  const ds1307_time& t = soft.now(millis());
+  printf("%-24s 20%02u/%02u/%02u %02u:%02u:%02u day %u  %s\n", what, t.year,
+         t.month, t.day, t.hours, t.minutes, t.seconds, t.day_of_week,
+         ok ? "ok" : "WRONG");
+  return ok;
+}
+
+static bool halt_test()
+{
+  SoftClock soft(&clock);
+  bool dates_ok = true;
+  uint32_t off_ms;
+
+  ds1307_time t;
+  t.seconds = 0; t.minutes = 0; t.hours = 12;
+  t.day_of_week = 1; t.day = 1; t.month = 6; t.year = 20;
+  clock.set_time(t, true);
+  run(&soft, 3, true, &dates_ok, &off_ms);
+
+  clock.disable();
+  bool ok = (rtc.registers[0] & DS1307_CLOCK_HALT) && clock.halted();
+  uint8_t stopped = soft.now(millis()).seconds;
+  long worst = run(&soft, 5, true, &dates_ok, &off_ms);
+  ok = ok && soft.now(millis()).seconds == stopped;
+
+  clock.enable();
+  ok = ok && !(rtc.registers[0] & DS1307_CLOCK_HALT) && !clock.halted();
+  long after = run(&soft, 5, true, &dates_ok, &off_ms);
+  ok = ok && soft.now(millis()).seconds == (stopped + 5) % 60;
+
+  ok = ok && labs(worst) <= 1 && labs(after) <= 1 && dates_ok;
+  printf("%-24s %s\n", "disable() and enable()", ok ? "ok" : "WRONG");
+  return ok;
+}
+
+static ds1307_time date(uint8_t year, uint8_t month, uint8_t day,
+                        uint8_t day_of_week, uint8_t hours, uint8_t minutes,
+                        uint8_t seconds)
+{
+  ds1307_time t;
+  t.year = year; t.month = month; t.day = day; t.day_of_week = day_of_week;
+  t.hours = hours; t.minutes = minutes; t.seconds = seconds;
+  return t;
+}
+
+int main(int argc, char** argv)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "d:")) != -1) {
+    switch (opt) {
+    case 'd': drift_ppm = atol(optarg); break;
+    default:
+      fprintf(stderr, "usage: clock_sim [-d drift_ppm]\n");
+      return 1;
+    }
+  }
+
+  bool ok = true;
+  SimTwi::attach(&rtc);
+  clock.begin();
+  clock.set_time(date(14, 5, 9, CLOCK_WEEKDAY_FRIDAY, 21, 30, 0), true);
+
+  printf("millis() %+ld ppm from the chip, %u s\n", drift_ppm, RUN_S);
+  printf("%-16s %6s %11s %10s %10s\n", "", "worst", "time off", "xfers",
+         "polled");
+  ok = drift_test(false) && ok;
+  ok = drift_test(true) && ok;
+
+  ok = rollover_test("end of the day",
+                     date(14, 5, 9, CLOCK_WEEKDAY_FRIDAY, 23, 59, 55)) && ok;
+  ok = rollover_test("leap day",
+                     date(16, 2, 28, CLOCK_WEEKDAY_SUNDAY, 23, 59, 55)) && ok;
+  ok = rollover_test("end of February",
+                     date(15, 2, 28, CLOCK_WEEKDAY_SATURDAY, 23, 59, 55)) &&
+    ok;
+  ok = rollover_test("end of the century",
+                     date(99, 12, 31, CLOCK_WEEKDAY_THURSDAY, 23, 59, 55)) &&
+    ok;
+  ok = halt_test() && ok;
+
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,257 @@
+/**
+ * Runs SmartCard against a simulated 24C16 on the simulated TWI, checks
+ * that what it writes and reads back is what's on the chip, and reports the
+ * bus transfers and time each way takes per KB: the page writes, the
+ * sequential reads, reads a byte at a time through the cache, and the byte
+ * at a time transfers with a fixed 5 ms delay that the sketch used to make.
+ * The cache is checked in every block, across block boundaries and the end
+ * of the card, and after writes over what it holds. Reading the whole card
+ * with some work done on each byte shows how much of the bus time the read
+ * ahead hides.
+ *
+ *   eeprom_sim
+ *
+ * Exits with 1 on any mismatch.
+ *
+ * Build with:
+ *
+ *   g++ -O2 -Ihost -I../lib/SmartCard -I../lib/I2CQueue -o eeprom_sim \
+ *     eeprom_sim.cpp host/twi_sim.cpp ../lib/I2CQueue/i2c_queue.cpp \
+ *     ../lib/SmartCard/smart_card.cpp
+ */
+#include <stdio.h>
+#include "Arduino.h"
+#include "i2c_queue.h"
+#include "smart_card.h"
+
+unsigned long millis()
+{
+  return SimTwi::now_us / 1000;
+}
+
+unsigned long micros()
+{
+  return SimTwi::now_us;
+}
+
+static void delay(unsigned long ms)
+{
+  SimTwi::advance(ms * 1000);
+}
+
+static SimEeprom eeprom;
+
+static uint8_t pattern[SMART_CARD_LENGTH];
+static uint8_t buffer[SMART_CARD_LENGTH];
+
+struct Cost
+{
+  uint32_t transfers;
+  uint32_t polls;   // Of those, the ones the chip didn't answer
+  uint32_t us;
+};
+
+static uint32_t start_us;
+
+static void start()
+{
+  // Let anything in progress finish, so it isn't charged to the next test.
+  SimTwi::advance(eeprom.write_cycle_us);
+  SimTwi::reset_counts();
+  start_us = SimTwi::now_us;
+}
+
+static Cost cost()
+{
+  Cost c = { SimTwi::transfers, SimTwi::nacks, SimTwi::now_us - start_us };
+  return c;
+}
+
+static void report(const char* what, uint16_t bytes, Cost c)
+{
+  printf("%-26s %5u | %6u %6u %8.1f | %6.0f %6.0f %8.1f\n",
+         what, bytes, (unsigned)c.transfers, (unsigned)c.polls, c.us / 1000.0,
+         c.transfers * 1024.0 / bytes, c.polls * 1024.0 / bytes,
+         c.us * 1024.0 / bytes / 1000.0);
+}
+
+static bool check(const char* what, const uint8_t* a, const uint8_t* b,
+                  uint16_t size)
+{
+  for (uint16_t i = 0; i < size; ++i) {
+    if (a[i] != b[i]) {
+      printf("%s: MISMATCH at %u: %u, expected %u\n", what, i, a[i], b[i]);
+      return false;
+    }
+  }
+  return true;
+}
+
+static void fill_pattern(uint8_t seed)
+{
+  uint32_t x = seed * 2654435761u + 1;
+  for (uint16_t i = 0; i < SMART_CARD_LENGTH; ++i) {
+    x = x * 1103515245 + 12345;
+    pattern[i] = x >> 16;
+  }
+}
+
+// What smart_card_test() did before: a transfer per byte each way, and a
+// fixed delay after each write for the write cycle.
+static void write_bytewise(uint16_t address, const uint8_t* bytes,
+                           uint16_t size)
+{
+  I2CTransaction t;
+  uint8_t out[2];
+  for (uint16_t i = 0; i < size; ++i, ++address) {
+    out[0] = address & 0xff;
+    out[1] = bytes[i];
+    t.set(0x50 | (address >> 8), out, 2, NULL, 0);
+    I2CQueue::run(&t);
+    delay(5);
+  }
+}
+
+static void read_bytewise(uint16_t address, uint8_t* bytes, uint16_t size)
+{
+  I2CTransaction t;
+  uint8_t out;
+  for (uint16_t i = 0; i < size; ++i, ++address) {
+    out = address & 0xff;
+    t.set(0x50 | (address >> 8), &out, 1, bytes + i, 1);
+    I2CQueue::run(&t);
+  }
+}
+
+int main()
+{
+  bool ok = true;
+  printf("%-26s %5s | %-22s | %-22s\n", "", "", "total", "per KB");
+  printf("%-26s %5s | %6s %6s %8s | %6s %6s %8s\n", "", "bytes",
+         "xfers", "nacked", "ms", "xfers", "nacked", "ms");
+
+  SimTwi::attach(&eeprom);
+  SmartCard::init();
+  SmartCard card;
+
+  // The whole card, from the start.
+  fill_pattern(1);
+  start();
+  card.seek(0);
+  ok = card.write(pattern, SMART_CARD_LENGTH) == SMART_CARD_LENGTH && ok;
+  report("write(), whole card", SMART_CARD_LENGTH, cost());
+  ok = check("write(), whole card", eeprom.memory, pattern,
+             SMART_CARD_LENGTH) && ok;
+
+  start();
+  card.seek(0);
+  memset(buffer, 0, sizeof(buffer));
+  ok = card.read(buffer, SMART_CARD_LENGTH) == SMART_CARD_LENGTH && ok;
+  report("read(), whole card", SMART_CARD_LENGTH, cost());
+  ok = check("read(), whole card", buffer, pattern, SMART_CARD_LENGTH) && ok;
+
+  // Off page boundaries, and across a block. Everything else has to be left
+  // alone.
+  fill_pattern(2);
+  memcpy(buffer, eeprom.memory, SMART_CARD_LENGTH);
+  memcpy(buffer + 7, pattern, 700);
+  start();
+  card.seek(7);
+  ok = card.write(pattern, 700) == 700 && ok;
+  report("write(), 7 to 707", 700, cost());
+  ok = check("write(), 7 to 707", eeprom.memory, buffer,
+             SMART_CARD_LENGTH) && ok;
+
+  // Reading it back in odd sized pieces, which carry on from each other,
+  // and a byte at a time right after a write.
+  start();
+  card.seek(7);
+  for (uint16_t i = 0; i < 700; i += 13)
+    card.read(buffer + i, i + 13 > 700 ? 700 - i : 13);
+  report("read(), 13 at a time", 700, cost());
+  ok = check("read(), 13 at a time", buffer, pattern, 700) && ok;
+
+  card.seek(100);
+  card.write(0xa5);
+  ok = card.read() == eeprom.memory[101] && ok;
+  card.seek(100);
+  ok = card.read() == 0xa5 && ok;
+
+  // A byte at a time, all from the cache but the first of each line.
+  start();
+  card.seek(0);
+  for (uint16_t i = 0; i < SMART_CARD_LENGTH; ++i)
+    buffer[i] = card.read();
+  report("read(), a byte at a time", SMART_CARD_LENGTH, cost());
+  ok = check("read(), a byte at a time", buffer, eeprom.memory,
+             SMART_CARD_LENGTH) && ok;
+
+  // The same with 20 us of work on each byte, as decoding an asset would
+  // have, which the next line comes in behind.
+  start();
+  card.seek(0);
+  for (uint16_t i = 0; i < SMART_CARD_LENGTH; ++i) {
+    buffer[i] = card.read();
+    SimTwi::advance(20);
+  }
+  Cost c = cost();
+  report("read(), 20 us per byte", SMART_CARD_LENGTH, c);
+  printf("%-26s %5s | %15.1f\n", "  waiting on the bus", "",
+         (c.us - 20 * SMART_CARD_LENGTH) / 1000.0);
+  ok = check("read(), 20 us per byte", buffer, eeprom.memory,
+             SMART_CARD_LENGTH) && ok;
+
+  // From the middle of each block on into the next, and from the last block
+  // around to the first.
+  for (uint8_t block = 0; block < 8; ++block) {
+    uint16_t at = block * SMART_CARD_BLOCK_LENGTH + 200;
+    card.seek(at);
+    for (uint16_t i = 0; i < 100; ++i) {
+      uint8_t b = card.read();
+      if (b != eeprom.memory[(at + i) % SMART_CARD_LENGTH]) {
+        printf("block %u: MISMATCH at %u\n", block, at + i);
+        ok = false;
+        break;
+      }
+    }
+  }
+  ok = card.tell() == 7 * SMART_CARD_BLOCK_LENGTH + 300 - SMART_CARD_LENGTH &&
+    ok;
+
+  // Seeking back into the cache costs nothing.
+  card.seek(1000);
+  card.read();
+  SimTwi::reset_counts();
+  card.seek(1010);
+  card.read();
+  card.seek(1001);
+  card.read();
+  if (SimTwi::transfers != 0) {
+    printf("seek within the cache: %u transfers\n",
+           (unsigned)SimTwi::transfers);
+    ok = false;
+  }
+
+  // Writes over the cached bytes have to show up in later reads.
+  card.seek(1005);
+  uint8_t changed[3] = { 1, 2, 3 };
+  card.write(changed, sizeof(changed));
+  card.seek(1000);
+  card.read(buffer, 16);
+  ok = check("read after write", buffer, eeprom.memory + 1000, 16) && ok;
+  ok = buffer[5] == 1 && buffer[7] == 3 && ok;
+
+  // The old way, for comparison.
+  start();
+  write_bytewise(0, pattern, 1024);
+  report("old write + delay(5)", 1024, cost());
+  ok = check("byte at a time", eeprom.memory, pattern, 1024) && ok;
+
+  start();
+  read_bytewise(0, buffer, 1024);
+  report("old read, a byte each", 1024, cost());
+  ok = check("read byte at a time", buffer, pattern, 1024) && ok;
+
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
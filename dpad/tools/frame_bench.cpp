@@ -0,0 +1,293 @@
+/**
+ * Benchmarks the LPD8806x8 driver on the host. A fixed frame is shown through
+ * BasicLPD8806x8<SimPorts>, and the trace of port stores it leaves is turned
+ * into an estimate of the time the Mega2560 would take by the CycleCostModel,
+ * so changes to the driver can be compared without a board. The bytes each
+ * strip gets are checked against the frame on the way.
+ *
+ * The port stores leave out the work done between them, which is where
+ * show(Image*) and show(CompiledFrame*) differ: the first looks each byte up
+ * in the palette on the way out, the second sends bytes that compile() has
+ * looked up already. Those lookups are charged from estimates, and the rate
+ * the bytes go out at is printed for each, both counting the compile and
+ * for a compiled frame shown again as it is (after a palette cycle that
+ * doesn't touch it, say).
+ *
+ * Each is shown whole, then again with only the middle columns changed,
+ * which goes out short and latches early.
+ *
+ * The packed Image4 and Image2 are checked too: that every pixel reads back
+ * as it was set, without upsetting its neighbors in the byte, that fill()
+ * reaches them all, and that both show() and compile() unpack them, whole
+ * and from the middle.
+ *
+ *   frame_bench
+ *
+ * Exits with 1 if the trace overflows, a strip gets anything other than its
+ * pixels and the latch, or a packed image loses a pixel.
+ *
+ * Build with:
+ *
+ *   g++ -O2 -Ihost -I../src -I../lib/Gamma -o frame_bench frame_bench.cpp \
+ *     ../src/image.cpp ../src/panel.cpp ../src/LPD8806x8.cpp \
+ *     ../src/lpd_ports.cpp
+ */
+#include <stdio.h>
+
+#include <Arduino.h>
+#include "LPD8806x8.h"
+
+// Cost estimates for the work between stores, in cycles.
+static const uint8_t UNPACK_CYCLES = 4;     // fetch a byte from an image
+static const uint8_t SHIFT_CYCLES = 4;      // mask each packed index out of it
+static const uint8_t LOOKUP_CYCLES = 14;    // find a color in the palette
+static const uint8_t COPY_CYCLES = 4;       // store a looked up byte
+
+static const uint8_t STRIPS = Panel32x32::STRIPS;
+static const uint8_t LATCH_BYTES = BasicLPD8806x8<SimPorts>::LATCH_BYTES;
+
+static uint8_t expected[STRIPS][SIM_STREAM_LENGTH];
+static BasicLPD8806x8<SimPorts> strip;
+
+/**
+ * What each strip should get for the first 'length' LEDs of the image: GRB
+ * as the palette has it, then the latch.
+ */
+template <class I>
+static uint16_t expect(const I& img, const Palette& pal, uint16_t length)
+{
+  uint16_t n = 0;
+  for (uint8_t s = 0; s < STRIPS; ++s) {
+    n = 0;
+    for (uint16_t i = 0; i < length; ++i)
+      for (uint8_t ix = 0; ix < 3; ++ix)
+        expected[s][n++] = pal.get(img.index(s, i)).grb[ix];
+    for (uint8_t i = 0; i < LATCH_BYTES; ++i)
+      expected[s][n++] = 0;
+  }
+  return n;
+}
+
+/**
+ * Cycles to unpack 'length' LEDs of every strip: a byte is fetched for each
+ * PIXELS_PER_BYTE of them, and packed ones are then masked out one by one,
+ * shifting the byte on by a constant BPP.
+ */
+static uint32_t unpack_cycles(uint16_t length, uint8_t bpp)
+{
+  uint32_t cycles = uint32_t(length) * bpp / 8 * UNPACK_CYCLES;
+  if (bpp != 8)
+    cycles += uint32_t(length) * SHIFT_CYCLES;
+  return cycles * STRIPS;
+}
+
+/**
+ * Cycles show(Image*) spends between stores for 'length' LEDs: the indices
+ * of each LED of every strip are unpacked once, and looked up for each color.
+ */
+static uint32_t show_cycles(uint16_t length, uint8_t bpp = 8)
+{
+  return unpack_cycles(length, bpp) +
+    uint32_t(length) * STRIPS * 3 * LOOKUP_CYCLES;
+}
+
+/**
+ * Cycles compile() takes for 'length' LEDs: each color is looked up once,
+ * and its three bytes copied into the frame.
+ */
+static uint32_t compile_cycles(uint16_t length, uint8_t bpp = 8)
+{
+  return unpack_cycles(length, bpp) +
+    uint32_t(length) * STRIPS * (LOOKUP_CYCLES + 3 * COPY_CYCLES);
+}
+
+/**
+ * Check what the strips got since the last SimPorts::reset(), and print the
+ * cost of sending it plus 'cycles' of work besides the stores.
+ */
+static bool report(const char* what, uint16_t length, uint32_t cycles)
+{
+  bool ok = SimPorts::dropped() == 0;
+  for (uint8_t s = 0; s < STRIPS; ++s)
+    ok = ok && SimPorts::stream_length(s) == length &&
+      !memcmp(SimPorts::stream(s), expected[s], length);
+
+  CycleCostModel cost;
+  cycles += cost.cycles(SimPorts::trace(), SimPorts::trace_length());
+  double us = cycles * 1e6 / cost.f_cpu;
+  printf("%-36s %6u %8u %8lu %8.0f %10.0f  %s\n", what, length,
+         SimPorts::trace_length(), (unsigned long)SimPorts::clock_edges(),
+         us, length * STRIPS * 1e6 / us, ok ? "ok" : "WRONG");
+  return ok;
+}
+
+/**
+ * Change the middle columns. The strips start from the middle of the panel,
+ * so those are all in the first segment.
+ */
+template <class I>
+static void paint_middle(I* img)
+{
+  for (uint8_t x = 12; x < 20; ++x)
+    for (uint8_t y = 0; y < I::HEIGHT; ++y)
+      img->set_color(x, y, 255 - y);
+}
+
+/**
+ * Change the middle columns and the LED after them, so that the dirty part
+ * of a packed image doesn't end on a whole byte.
+ */
+template <class I>
+static void paint_past_middle(I* img)
+{
+  paint_middle(img);
+  uint16_t next = img->dirty_length();
+  for (uint8_t x = 0; x < I::WIDTH; ++x)
+    for (uint8_t y = 0; y < I::HEIGHT; ++y)
+      if (I::geometry::lookup(x, y) % I::STRIP_LENGTH == next)
+        img->set_color(x, y, 1);
+}
+
+/**
+ * Compile the image and show it.
+ */
+template <class I>
+static bool compiled_test(const char* what, CompiledFrame* frame, I* img,
+                          const Palette& pal, uint16_t dirty)
+{
+  uint16_t length = expect(*img, pal, dirty);
+  frame->compile(img, &pal);
+  SimPorts::reset();
+  strip.show(frame);
+  return report(what, length, compile_cycles(dirty, 8 / I::PIXELS_PER_BYTE));
+}
+
+static bool check(const char* what, bool ok)
+{
+  printf("%-36s %s\n", what, ok ? "ok" : "WRONG");
+  return ok;
+}
+
+/**
+ * Set every pixel of a packed image, and of an Image to check it against,
+ * then make sure they agree everywhere, show it and compile it.
+ */
+template <class I>
+static bool packed_test(const char* name, const Palette& pal)
+{
+  static I img;
+  static Image wide;
+  static CompiledFrame frame;
+  const uint8_t bpp = 8 / I::PIXELS_PER_BYTE;
+  char what[40];
+
+  // Every index in every position in the byte, and the bits above the
+  // index dropped.
+  for (uint8_t x = 0; x < I::WIDTH; ++x)
+    for (uint8_t y = 0; y < I::HEIGHT; ++y) {
+      uint8_t index = x * 7 + y * 3;
+      img.set_color(x, y, index);
+      wide.set_color(x, y, index & I::INDEX_MASK);
+    }
+
+  bool same = sizeof(img._c) == sizeof(wide._c) / I::PIXELS_PER_BYTE;
+  for (uint8_t x = 0; x < I::WIDTH; ++x)
+    for (uint8_t y = 0; y < I::HEIGHT; ++y)
+      same = same && img.get_color(x, y) == wide.get_color(x, y);
+  for (uint8_t s = 0; s < STRIPS; ++s)
+    for (uint16_t n = 0; n < I::STRIP_LENGTH; ++n)
+      same = same && img.index(s, n) == wide.index(s, n) &&
+        I::unpack(img._c[s], n) == wide.index(s, n);
+  snprintf(what, sizeof(what), "%s set_color() and unpack()", name);
+  bool ok = check(what, same);
+
+  I filled;
+  bool fills = true;
+  for (uint16_t index = 0; index <= I::INDEX_MASK + 1; ++index) {
+    filled.clear_dirty();
+    filled.fill(index);
+    fills = fills && filled.dirty_length() == I::STRIP_LENGTH;
+    for (uint8_t s = 0; s < STRIPS; ++s)
+      for (uint16_t n = 0; n < I::STRIP_LENGTH; ++n)
+        fills = fills && filled.index(s, n) == (index & I::INDEX_MASK);
+  }
+  snprintf(what, sizeof(what), "%s fill()", name);
+  ok = check(what, fills) && ok;
+
+  uint16_t length = expect(img, pal, I::STRIP_LENGTH);
+  SimPorts::reset();
+  strip.show(&img, &pal);
+  snprintf(what, sizeof(what), "show(%s*)", name);
+  ok = report(what, length, show_cycles(I::STRIP_LENGTH, bpp)) && ok;
+
+  img.touch();
+  snprintf(what, sizeof(what), "compile(%s*), show(Compiled*)", name);
+  ok = compiled_test(what, &frame, &img, pal, I::STRIP_LENGTH) && ok;
+
+  paint_past_middle(&img);
+  uint16_t dirty = img.dirty_length();
+  length = expect(img, pal, dirty);
+  SimPorts::reset();
+  strip.show(&img, &pal);
+  snprintf(what, sizeof(what), "show(%s*), middle", name);
+  ok = report(what, length, show_cycles(dirty, bpp)) && ok;
+
+  paint_past_middle(&img);
+  snprintf(what, sizeof(what), "compile(%s*), middle", name);
+  return compiled_test(what, &frame, &img, pal, img.dirty_length()) && ok;
+}
+
+/**
+ * Show a frame compiled already, as it is.
+ */
+static bool again_test(const char* what, CompiledFrame* frame, Image* img,
+                       const Palette& pal)
+{
+  uint16_t length = expect(*img, pal, Image::STRIP_LENGTH);
+  frame->invalidate();
+  SimPorts::reset();
+  strip.show(frame);
+  return report(what, length, 0);
+}
+
+int main()
+{
+  Palette pal(256);
+  pal.fill_hsv_gradient(0, 256, 0, 255, 255, 255);
+
+  static Image img;
+  for (uint8_t x = 0; x < Image::WIDTH; ++x)
+    for (uint8_t y = 0; y < Image::HEIGHT; ++y)
+      img.set_color(x, y, x * 8 + y * 3);
+  static Image compiled_img = img;
+
+  printf("%-36s %6s %8s %8s %8s %10s\n", "", "bytes", "stores", "edges",
+         "us", "bytes/s");
+
+  bool ok = true;
+  uint16_t length = expect(img, pal, Image::STRIP_LENGTH);
+  SimPorts::reset();
+  strip.show(&img, &pal);
+  ok = report("show(Image*)", length, show_cycles(Image::STRIP_LENGTH)) && ok;
+
+  paint_middle(&img);
+  uint16_t dirty = img.dirty_length();
+  length = expect(img, pal, dirty);
+  SimPorts::reset();
+  strip.show(&img, &pal);
+  ok = report("show(Image*), middle", length, show_cycles(dirty)) && ok;
+
+  static CompiledFrame frame;
+  ok = compiled_test("compile(), show(Compiled*)", &frame, &compiled_img, pal,
+                     Image::STRIP_LENGTH) && ok;
+  ok = again_test("show(Compiled*) again", &frame, &compiled_img, pal) && ok;
+  paint_middle(&compiled_img);
+  ok = compiled_test("compile(), show(Compiled*), middle", &frame,
+                     &compiled_img, pal, compiled_img.dirty_length()) && ok;
+
+  ok = packed_test<Image4>("Image4", pal) && ok;
+  ok = packed_test<Image2>("Image2", pal) && ok;
+
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+/**
+ * Checks the gamma tables from libraries/Gamma against the hand-written
+ * ones they replaced: image.cpp's 7-bit table for the LPD8806, and kbled's
+ * 8-bit table for NeoPixels. Prints each entry that differs.
+ *
+ *   gamma_check
+ *
+ * Exits with 1 if the 7-bit table differs at all, or the 8-bit one by more
+ * than a level anywhere.
+ *
+ * Build with:
+ *
+ *   g++ -std=c++11 -O2 -Ihost -I../lib/Gamma -o gamma_check gamma_check.cpp
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "Arduino.h"
+#include "gamma.h"
+
+// dpad/src/image.cpp, before the generated table.
+static const uint8_t image_gamma[256] = {
+    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,
+    1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  2,  2,  2,  2,
+    2,  2,  2,  2,  2,  3,  3,  3,  3,  3,  3,  3,  3,  4,  4,  4,
+    4,  4,  4,  4,  5,  5,  5,  5,  5,  6,  6,  6,  6,  6,  7,  7,
+    7,  7,  7,  8,  8,  8,  8,  9,  9,  9,  9, 10, 10, 10, 10, 11,
+   11, 11, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 15, 15, 16, 16,
+   16, 17, 17, 17, 18, 18, 18, 19, 19, 20, 20, 21, 21, 21, 22, 22,
+   23, 23, 24, 24, 24, 25, 25, 26, 26, 27, 27, 28, 28, 29, 29, 30,
+   30, 31, 32, 32, 33, 33, 34, 34, 35, 35, 36, 37, 37, 38, 38, 39,
+   40, 40, 41, 41, 42, 43, 43, 44, 45, 45, 46, 47, 47, 48, 49, 50,
+   50, 51, 52, 52, 53, 54, 55, 55, 56, 57, 58, 58, 59, 60, 61, 62,
+   62, 63, 64, 65, 66, 67, 67, 68, 69, 70, 71, 72, 73, 74, 74, 75,
+   76, 77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 88, 89, 90, 91,
+   92, 93, 94, 95, 96, 97, 98, 99,100,101,102,104,105,106,107,108,
+  109,110,111,113,114,115,116,117,118,120,121,122,123,125,126,127};
+
+// kbled/src/sketch.ino, before the generated table: levels from x = 35 up.
+// Below that they were worked out in code.
+static const uint8_t kbled_gamma_e[221] = {
+         3, 3, 3, 3, 3, 4, 4, 4, 4, 5,  5,  5,  5,
+6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10, 11, 11,
+11, 12, 12, 13, 13, 13, 14, 14, 15, 15, 16, 16, 17, 17, 18, 18,
+19, 19, 20, 21, 21, 22, 22, 23, 23, 24, 25, 25, 26, 27, 27, 28,
+29, 29, 30, 31, 31, 32, 33, 34, 34, 35, 36, 37, 37, 38, 39, 40,
+40, 41, 42, 43, 44, 45, 46, 46, 47, 48, 49, 50, 51, 52, 53, 54,
+55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70,
+71, 72, 73, 74, 76, 77, 78, 79, 80, 81, 83, 84, 85, 86, 88, 89,
+90, 91, 93, 94, 95, 96, 98, 99,100,102,103,104,106,107,109,110,
+111,113,114,116,117,119,120,121,123,124,126,128,129,131,132,134,
+135,137,138,140,142,143,145,146,148,150,151,153,155,157,158,160,
+162,163,165,167,169,170,172,174,176,178,179,181,183,185,187,189,
+191,193,194,196,198,200,202,204,206,208,210,212,214,216,218,220,
+222,224,227,229,231,233,235,237,239,241,244,246,248,250,252,255};
+
+static uint8_t kbled_gamma(uint8_t x)
+{
+  if (x < 22)
+    return 0;
+  else if (x < 29)
+    return 1;
+  else if (x < 35)
+    return 2;
+  return kbled_gamma_e[x - 35];
+}
+
+/**
+ * Prints the entries of Table that differ from old(), and returns the
+ * largest difference.
+ */
+template<class Table, class Old>
+static int compare(const char* name, Old old)
+{
+  int count = 0, worst = 0;
+  for (int x = 0; x < 256; ++x) {
+    int diff = int(Table::lookup(x)) - int(old(x));
+    if (diff == 0)
+      continue;
+    printf("  %s[%3d] = %3d, was %3d\n", name, x, Table::lookup(x), old(x));
+    ++count;
+    if (abs(diff) > worst)
+      worst = abs(diff);
+  }
+  printf("%s: %d of 256 differ, by at most %d\n", name, count, worst);
+  return worst;
+}
+
+static uint8_t image_old(uint8_t x)
+{
+  return image_gamma[x];
+}
+
+int main()
+{
+  int image = compare<GammaTable<250, 7> >("GammaTable<250, 7>", image_old);
+  int kbled = compare<GammaTable<224, 8> >("GammaTable<224, 8>", kbled_gamma);
+  return (image == 0 && kbled <= 1) ? 0 : 1;
+}
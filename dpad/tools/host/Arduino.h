@@ -0,0 +1,73 @@
+#ifndef HOST_ARDUINO_H__
+#define HOST_ARDUINO_H__
+
+/**
+ * Just enough of the Arduino core to build the panel code on the host, for
+ * the simulations in dpad/tools. Time is whatever the simulation says it is:
+ * it provides millis() and micros(). The TWI registers are simulated in
+ * twi_sim.cpp.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define F_CPU 16000000UL
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define _BV(b) (1 << (b))
+#define ISR(vector) extern "C" void vector(void)
+
+// Interrupts only happen where the simulation delivers them, so there's
+// nothing to turn off.
+extern uint8_t SREG;
+static inline void cli() { }
+
+#define PROGMEM
+typedef unsigned char prog_uchar;
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+
+unsigned long millis();
+unsigned long micros();
+
+#define F(s) s
+
+// Serial prints to stdout.
+class HostSerial
+{
+public:
+  void print(const char* s) { fputs(s, stdout); }
+  void print(char c) { putchar(c); }
+  void print(uint8_t n) { printf("%u", n); }
+  void print(int n) { printf("%d", n); }
+  void print(unsigned n) { printf("%u", n); }
+  void print(long n) { printf("%ld", n); }
+  void print(unsigned long n) { printf("%lu", n); }
+
+  template <class T> void println(T v) {
+    print(v);
+    println();
+  }
+  void println() { putchar('\n'); }
+};
+
+extern HostSerial Serial;
+
+class Stream
+{
+public:
+  virtual ~Stream() { }
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual size_t write(uint8_t b) = 0;
+};
+
+#include "twi_sim.h"
+
+#endif
@@ -0,0 +1,426 @@
+#include <stdio.h>
+#include "Arduino.h"
+#include "i2c_queue.h"
+
+// A little for each start and stop.
+#define START_US  5
+
+#define TW_START            0x08
+#define TW_REP_START        0x10
+#define TW_MT_SLA_ACK       0x18
+#define TW_MT_SLA_NACK      0x20
+#define TW_MT_DATA_ACK      0x28
+#define TW_MT_DATA_NACK     0x30
+#define TW_MR_SLA_ACK       0x40
+#define TW_MR_SLA_NACK      0x48
+#define TW_MR_DATA_ACK      0x50
+#define TW_MR_DATA_NACK     0x58
+#define TW_BUS_ERROR        0x00
+
+#define MAX_DEVICES 4
+
+extern "C" void TWI_vect(void);
+
+HostSerial Serial;
+
+uint8_t SREG;
+uint8_t TWBR;
+uint8_t TWSR;
+uint8_t TWDR;
+SimTWCR TWCR;
+
+uint32_t SimTwi::now_us = 0;
+uint32_t SimTwi::transfers = 0;
+uint32_t SimTwi::bus_bytes = 0;
+uint32_t SimTwi::nacks = 0;
+uint32_t SimTwi::interrupts = 0;
+
+enum Phase
+{
+  PHASE_IDLE,       // no start yet
+  PHASE_ADDRESS,    // start sent, TWDR holds SLA+R/W
+  PHASE_TRANSMIT,
+  PHASE_RECEIVE,
+  PHASE_NONE        // addressed nobody; everything is NACKed
+};
+
+static SimI2CDevice* devices[MAX_DEVICES];
+static uint8_t device_count;
+static SimI2CDevice* device;    // The one addressed
+static uint8_t phase = PHASE_IDLE;
+
+static uint8_t control;         // TWEN, TWIE, TWEA as last written
+static bool interrupt_flag;     // TWINT: the TWI is waiting on the code
+static bool event_pending;
+static uint32_t event_at;
+static uint8_t event_status;
+static uint8_t event_data;
+static bool event_has_data;
+
+static uint32_t byte_us()
+{
+  // SCL is F_CPU / (16 + 2 * TWBR), and a byte is 9 clocks with the ack.
+  return 9 * (16 + 2 * uint32_t(TWBR)) / (F_CPU / 1000000);
+}
+
+static void schedule(uint32_t us, uint8_t status)
+{
+  event_pending = true;
+  event_at = SimTwi::now_us + us;
+  event_status = status;
+  event_has_data = false;
+}
+
+static SimI2CDevice* find(uint8_t address)
+{
+  for (uint8_t i = 0; i < device_count; ++i)
+    if (devices[i]->answers(address))
+      return devices[i];
+  return NULL;
+}
+
+static void stop()
+{
+  if (device)
+    device->stop();
+  device = NULL;
+  phase = PHASE_IDLE;
+}
+
+SimTWCR& SimTWCR::operator=(int v)
+{
+  control = v & (_BV(TWEN) | _BV(TWIE) | _BV(TWEA));
+
+  // Nothing happens until the code clears TWINT by writing it.
+  if (!(v & _BV(TWINT)))
+    return *this;
+  interrupt_flag = false;
+
+  if (v & _BV(TWSTO)) {
+    stop();
+    SimTwi::now_us += START_US;
+    if (v & _BV(TWSTA)) {
+      ++SimTwi::transfers;
+      schedule(START_US, TW_START);
+      phase = PHASE_ADDRESS;
+    }
+    return *this;
+  }
+
+  if (v & _BV(TWSTA)) {
+    ++SimTwi::transfers;
+    schedule(START_US, phase == PHASE_IDLE ? TW_START : TW_REP_START);
+    phase = PHASE_ADDRESS;
+    return *this;
+  }
+
+  ++SimTwi::bus_bytes;
+  switch (phase) {
+  case PHASE_ADDRESS: {
+    bool read = TWDR & 1;
+    if (device)
+      device->stop();
+    device = find(TWDR >> 1);
+    bool ack = device && device->start(TWDR >> 1, read);
+    if (!ack) {
+      ++SimTwi::nacks;
+      device = NULL;
+      phase = PHASE_NONE;
+      schedule(byte_us(), read ? TW_MR_SLA_NACK : TW_MT_SLA_NACK);
+    }
+    else {
+      phase = read ? PHASE_RECEIVE : PHASE_TRANSMIT;
+      schedule(byte_us(), read ? TW_MR_SLA_ACK : TW_MT_SLA_ACK);
+    }
+    break;
+  }
+
+  case PHASE_TRANSMIT:
+    if (device->write(TWDR))
+      schedule(byte_us(), TW_MT_DATA_ACK);
+    else {
+      ++SimTwi::nacks;
+      schedule(byte_us(), TW_MT_DATA_NACK);
+    }
+    break;
+
+  case PHASE_RECEIVE:
+    schedule(byte_us(),
+             (v & _BV(TWEA)) ? TW_MR_DATA_ACK : TW_MR_DATA_NACK);
+    event_data = device->read();
+    event_has_data = true;
+    break;
+
+  default:
+    // Carrying on after a NACK instead of stopping.
+    schedule(byte_us(), TW_BUS_ERROR);
+    break;
+  }
+  return *this;
+}
+
+SimTWCR::operator uint8_t() const
+{
+  // Stops go out at once, so TWSTO always reads as clear.
+  return control | (interrupt_flag ? _BV(TWINT) : 0);
+}
+
+void SimTwi::attach(SimI2CDevice* d)
+{
+  if (device_count < MAX_DEVICES)
+    devices[device_count++] = d;
+}
+
+void SimTwi::reset_counts()
+{
+  transfers = 0;
+  bus_bytes = 0;
+  nacks = 0;
+  interrupts = 0;
+}
+
+bool SimTwi::pending()
+{
+  return event_pending;
+}
+
+static void deliver()
+{
+  event_pending = false;
+  TWSR = event_status;
+  if (event_has_data)
+    TWDR = event_data;
+  interrupt_flag = true;
+
+  if ((control & _BV(TWEN)) && (control & _BV(TWIE))) {
+    ++SimTwi::interrupts;
+    SimTwi::now_us += SimTwi::INTERRUPT_US;
+    TWI_vect();
+  }
+}
+
+void SimTwi::advance(uint32_t us)
+{
+  uint32_t until = now_us + us;
+  while (event_pending && int32_t(event_at - until) <= 0) {
+    if (int32_t(event_at - now_us) > 0)
+      now_us = event_at;
+    deliver();
+  }
+  if (int32_t(until - now_us) > 0)
+    now_us = until;
+}
+
+void SimTwi::step()
+{
+  if (event_pending) {
+    if (int32_t(event_at - now_us) > 0)
+      now_us = event_at;
+    deliver();
+  }
+  else
+    ++now_us;
+}
+
+void i2c_idle()
+{
+  SimTwi::step();
+}
+
+SimEeprom::SimEeprom()
+  : write_cycle_us(3000), write_cycles(0), _busy_until_us(0), _pointer(0),
+    _have_address(false), _page_mask(0)
+{
+  memset(memory, 0xff, sizeof(memory));
+}
+
+bool SimEeprom::busy() const
+{
+  return int32_t(_busy_until_us - SimTwi::now_us) > 0;
+}
+
+bool SimEeprom::answers(uint8_t address) const
+{
+  return (address & 0xf8) == 0x50;
+}
+
+bool SimEeprom::start(uint8_t address, bool read)
+{
+  if (busy())
+    return false;
+
+  // The block comes from the device address.
+  _pointer = ((address & 0x7) << 8) | (_pointer & 0xff);
+  _have_address = read;
+  _page_mask = 0;
+  return true;
+}
+
+bool SimEeprom::write(uint8_t b)
+{
+  if (!_have_address) {
+    _pointer = (_pointer & 0x700) | b;
+    _have_address = true;
+    return true;
+  }
+
+  // Within the page, wrapping around.
+  uint8_t offset = _pointer % PAGE_LENGTH;
+  _page[offset] = b;
+  _page_mask |= 1 << offset;
+  _pointer = (_pointer & ~(PAGE_LENGTH - 1)) | ((offset + 1) % PAGE_LENGTH);
+  return true;
+}
+
+uint8_t SimEeprom::read()
+{
+  // Sequential reads run on through the whole chip.
+  uint8_t b = memory[_pointer];
+  _pointer = (_pointer + 1) % LENGTH;
+  return b;
+}
+
+void SimEeprom::stop()
+{
+  if (_page_mask == 0)
+    return;
+
+  uint16_t page = _pointer & ~(PAGE_LENGTH - 1);
+  for (uint8_t i = 0; i < PAGE_LENGTH; ++i)
+    if (_page_mask & (1 << i))
+      memory[page + i] = _page[i];
+  _page_mask = 0;
+  _busy_until_us = SimTwi::now_us + write_cycle_us;
+  ++write_cycles;
+}
+
+static uint8_t from_bcd(uint8_t b)
+{
+  return (b & 0xf) + 10 * (b >> 4);
+}
+
+static uint8_t to_bcd(uint8_t n)
+{
+  return (n % 10) | ((n / 10) << 4);
+}
+
+SimDS1307::SimDS1307()
+  : _second_us(0), _pointer(0), _have_address(false)
+{
+  memset(registers, 0, sizeof(registers));
+  // Powered up for the first time: halted, at 2000/01/01 00:00:00.
+  registers[0] = 0x80;
+  registers[3] = 1;
+  registers[4] = 1;
+  registers[5] = 1;
+}
+
+void SimDS1307::tick()
+{
+  static const uint8_t month_days[12] = {
+    31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+  };
+
+  uint8_t s = from_bcd(registers[0] & 0x7f) + 1;
+  if (s < 60) {
+    registers[0] = to_bcd(s);
+    return;
+  }
+  registers[0] = 0;
+
+  uint8_t m = from_bcd(registers[1]) + 1;
+  if (m < 60) {
+    registers[1] = to_bcd(m);
+    return;
+  }
+  registers[1] = 0;
+
+  // 24 hour mode only.
+  uint8_t h = from_bcd(registers[2] & 0x3f) + 1;
+  if (h < 24) {
+    registers[2] = to_bcd(h);
+    return;
+  }
+  registers[2] = 0;
+
+  registers[3] = registers[3] % 7 + 1;
+  uint8_t year = from_bcd(registers[6]);
+  uint8_t month = from_bcd(registers[5]);
+  uint8_t days = month_days[(month - 1) % 12] +
+    (month == 2 && year % 4 == 0 ? 1 : 0);
+  uint8_t d = from_bcd(registers[4]) + 1;
+  if (d <= days) {
+    registers[4] = to_bcd(d);
+    return;
+  }
+  registers[4] = 1;
+
+  if (month < 12) {
+    registers[5] = to_bcd(month + 1);
+    return;
+  }
+  registers[5] = 1;
+  registers[6] = to_bcd((year + 1) % 100);
+}
+
+void SimDS1307::update()
+{
+  if (registers[0] & 0x80) {
+    _second_us = SimTwi::now_us;
+    return;
+  }
+  while (SimTwi::now_us - _second_us >= 1000000) {
+    tick();
+    _second_us += 1000000;
+  }
+}
+
+bool SimDS1307::sqw()
+{
+  update();
+  uint8_t control = registers[7];
+  if (!(control & 0x10))
+    return control & 0x80;
+  if ((control & 0x03) != 0)
+    return false;   // Only 1 Hz is simulated
+  return !(registers[0] & 0x80) && SimTwi::now_us - _second_us < 500000;
+}
+
+bool SimDS1307::answers(uint8_t address) const
+{
+  return address == ADDRESS;
+}
+
+bool SimDS1307::start(uint8_t, bool read)
+{
+  update();
+  _have_address = read;
+  return true;
+}
+
+bool SimDS1307::write(uint8_t b)
+{
+  if (!_have_address) {
+    _pointer = b % LENGTH;
+    _have_address = true;
+    return true;
+  }
+
+  // Writing the seconds restarts the count to the next one.
+  if (_pointer == 0)
+    _second_us = SimTwi::now_us;
+  registers[_pointer] = b;
+  _pointer = (_pointer + 1) % LENGTH;
+  return true;
+}
+
+uint8_t SimDS1307::read()
+{
+  uint8_t b = registers[_pointer];
+  _pointer = (_pointer + 1) % LENGTH;
+  return b;
+}
+
+void SimDS1307::stop()
+{
+}
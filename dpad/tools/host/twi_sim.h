@@ -0,0 +1,158 @@
+#ifndef HOST_TWI_SIM_H__
+#define HOST_TWI_SIM_H__
+
+/**
+ * The AVR's TWI registers, on a simulated I2C bus with simulated devices on
+ * it. Each step the TWI is set going on takes the time it would on the
+ * wire, at the clock rate TWBR gives; then the status comes up in TWSR and
+ * TWI_vect is called, as the interrupt would be. Time only passes through
+ * SimTwi::advance() (or i2c_idle(), while I2CQueue waits), and it's what the
+ * simulation's millis() and micros() should return.
+ */
+
+#include <stdint.h>
+
+#define TWINT 7
+#define TWEA  6
+#define TWSTA 5
+#define TWSTO 4
+#define TWWC  3
+#define TWEN  2
+#define TWIE  0
+
+extern uint8_t TWBR;
+extern uint8_t TWSR;
+extern uint8_t TWDR;
+
+class SimTWCR
+{
+public:
+  SimTWCR& operator=(int v);
+  operator uint8_t() const;
+};
+
+extern SimTWCR TWCR;
+
+/**
+ * Something on the bus. start() and write() return whether the device
+ * acknowledges.
+ */
+class SimI2CDevice
+{
+public:
+  virtual ~SimI2CDevice() { }
+  virtual bool answers(uint8_t address) const = 0;
+  virtual bool start(uint8_t address, bool read) = 0;
+  virtual bool write(uint8_t b) = 0;
+  virtual uint8_t read() = 0;
+  virtual void stop() = 0;
+};
+
+class SimTwi
+{
+public:
+  static uint32_t now_us;
+
+  // Per start condition, so a random read (address write, repeated start,
+  // read) is two.
+  static uint32_t transfers;
+  static uint32_t bus_bytes;
+  static uint32_t nacks;
+  // Time spent in TWI_vect, at an estimated cost per call.
+  static uint32_t interrupts;
+  static const uint32_t INTERRUPT_US = 4;
+
+  static void attach(SimI2CDevice* device);
+  static void reset_counts();
+
+  /**
+   * Move time on, delivering whatever the TWI finishes along the way.
+   */
+  static void advance(uint32_t us);
+
+  /**
+   * Move time on to whatever the TWI finishes next, or by a microsecond if
+   * it's idle.
+   */
+  static void step();
+
+  static bool pending();
+};
+
+/**
+ * The 24C16 on the smart card: 2K in 8 blocks of 256, at addresses
+ * 0x50-0x57. A write wraps around within its 16-byte page and takes effect
+ * at the stop, and while the chip is busy writing it doesn't acknowledge its
+ * address at all.
+ */
+class SimEeprom : public SimI2CDevice
+{
+public:
+  static const uint16_t LENGTH = 2048;
+  static const uint8_t PAGE_LENGTH = 16;
+
+  SimEeprom();
+
+  uint8_t memory[LENGTH];
+  uint32_t write_cycle_us;
+  uint32_t write_cycles;
+
+  bool busy() const;
+
+  virtual bool answers(uint8_t address) const;
+  virtual bool start(uint8_t address, bool read);
+  virtual bool write(uint8_t b);
+  virtual uint8_t read();
+  virtual void stop();
+
+private:
+  uint32_t _busy_until_us;
+  uint16_t _pointer;
+  bool _have_address;
+
+  // Bytes written since the start, held until the stop.
+  uint8_t _page[PAGE_LENGTH];
+  uint16_t _page_mask;
+};
+
+/**
+ * The DS1307 clock, at 0x68: the time in BCD in registers 0-6, the control
+ * register at 7 and RAM after that. The time counts on in simulated time
+ * unless the CH bit (7 of the seconds) is set.
+ */
+class SimDS1307 : public SimI2CDevice
+{
+public:
+  static const uint8_t ADDRESS = 0x68;
+  static const uint8_t LENGTH = 64;
+
+  SimDS1307();
+
+  uint8_t registers[LENGTH];
+
+  /**
+   * Bring the registers up to the current time.
+   */
+  void update();
+
+  /**
+   * The SQW/OUT pin, with the square wave enabled at 1 Hz: high for the
+   * first half of each second.
+   */
+  bool sqw();
+
+  virtual bool answers(uint8_t address) const;
+  virtual bool start(uint8_t address, bool read);
+  virtual bool write(uint8_t b);
+  virtual uint8_t read();
+  virtual void stop();
+
+private:
+  void tick();
+
+  uint32_t _second_us;   // When the current second started
+  uint8_t _pointer;
+  bool _have_address;
+};
+
+#endif
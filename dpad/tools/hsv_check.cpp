@@ -0,0 +1,115 @@
+/**
+ * Checks hsv_to_rgb() against the floating point HSVtoRGB() it stands in for,
+ * over every hue, saturation and value, and times the two. The float result
+ * is scaled to 0-255 and rounded, and then both go through the LED gamma
+ * table (GammaTable<250, 7>, as image.cpp uses) before they're compared,
+ * since that's what reaches the strip. Prints how many components differ by
+ * each amount, before and after the gamma table.
+ *
+ *   hsv_check
+ *
+ * The times are for the host, so they only say how the two compare; on the
+ * AVR, without a floating point unit, the gap is much wider.
+ *
+ * Exits with 1 if any gamma corrected component differs by more than 1.
+ *
+ * Build with:
+ *
+ *   g++ -O2 -Ihost -I../src -I../lib/Gamma -o hsv_check hsv_check.cpp \
+ *     ../src/image.cpp
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "Arduino.h"
+#include "gamma.h"
+#include "image.h"
+
+static const uint32_t INPUTS = 1UL << 24;
+
+typedef GammaTable<250, 7> LedGamma;
+
+// Keeps the timed loops from being optimized away.
+static volatile uint8_t sink;
+
+static uint8_t to_byte(float c)
+{
+  return uint8_t(c * 255.0f + 0.5f);
+}
+
+static void reference(uint8_t h, uint8_t s, uint8_t v,
+                      uint8_t* r, uint8_t* g, uint8_t* b)
+{
+  float fr, fg, fb;
+  HSVtoRGB(&fr, &fg, &fb, h * 360.0f / 255.0f, s / 255.0f, v / 255.0f);
+  *r = to_byte(fr);
+  *g = to_byte(fg);
+  *b = to_byte(fb);
+}
+
+static double seconds_since(clock_t start)
+{
+  return double(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main()
+{
+  // Components off by 0, 1, 2 and more, as they are and gamma corrected.
+  uint32_t off[4] = { 0, 0, 0, 0 }, gamma_off[4] = { 0, 0, 0, 0 };
+  int worst = 0;
+  uint32_t worst_input = 0;
+
+  for (uint32_t k = 0; k < INPUTS; ++k) {
+    uint8_t h = k >> 16, s = k >> 8, v = k;
+    uint8_t c[3], e[3];
+    hsv_to_rgb(h, s, v, &c[0], &c[1], &c[2]);
+    reference(h, s, v, &e[0], &e[1], &e[2]);
+
+    for (uint8_t i = 0; i < 3; ++i) {
+      int d = abs(int(c[i]) - int(e[i]));
+      ++off[d < 3 ? d : 3];
+      d = abs(int(LedGamma::lookup(c[i])) - int(LedGamma::lookup(e[i])));
+      ++gamma_off[d < 3 ? d : 3];
+      if (d > worst) {
+        worst = d;
+        worst_input = k;
+      }
+    }
+  }
+
+  clock_t start = clock();
+  for (uint32_t k = 0; k < INPUTS; ++k) {
+    uint8_t r, g, b;
+    hsv_to_rgb(k >> 16, k >> 8, k, &r, &g, &b);
+    sink = r ^ g ^ b;
+  }
+  double int_s = seconds_since(start);
+
+  start = clock();
+  for (uint32_t k = 0; k < INPUTS; ++k) {
+    uint8_t r, g, b;
+    reference(k >> 16, k >> 8, k, &r, &g, &b);
+    sink = r ^ g ^ b;
+  }
+  double float_s = seconds_since(start);
+
+  printf("%-12s %10s %10s %10s %10s\n", "", "same", "off by 1", "off by 2",
+         "more");
+  printf("%-12s %10lu %10lu %10lu %10lu\n", "components",
+         (unsigned long)off[0], (unsigned long)off[1], (unsigned long)off[2],
+         (unsigned long)off[3]);
+  printf("%-12s %10lu %10lu %10lu %10lu\n", "gamma 2.5",
+         (unsigned long)gamma_off[0], (unsigned long)gamma_off[1],
+         (unsigned long)gamma_off[2], (unsigned long)gamma_off[3]);
+  printf("worst gamma corrected %d, at h %lu s %lu v %lu\n", worst,
+         (unsigned long)(worst_input >> 16),
+         (unsigned long)((worst_input >> 8) & 0xff),
+         (unsigned long)(worst_input & 0xff));
+  printf("%-12s %10.1f ns\n", "hsv_to_rgb", int_s * 1e9 / INPUTS);
+  printf("%-12s %10.1f ns\n", "HSVtoRGB", float_s * 1e9 / INPUTS);
+
+  bool ok = worst <= 1;
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,353 @@
+/**
+ * Runs I2CQueue on the simulated TWI, with the smart card's 24C16 and the
+ * DS1307 on the bus. Checks that transactions finish in the order they were
+ * submitted, each with its callback, that one to an address nobody answers
+ * ends in a NACK, and that a callback can submit the next transaction.
+ *
+ * Then runs a loop like the sketch's, on a card packed with a palette and
+ * an animation of a 4-bit, two run-length and a delta image: a frame out
+ * every pass, AssetPlayer::update() taking the next step in a piece at a
+ * time, and the time read from the clock once a second. Each step is checked
+ * against the image it was packed from as it comes to the front. The longest
+ * pass is reported with the clock read in the background through
+ * DS1307_Clock, and with it read the blocking way, in the loop; and next to
+ * them, how long a step takes loaded all at once with
+ * AssetLoader::load_image().
+ *
+ *   i2c_sim
+ *
+ * Exits with 1 if anything is wrong.
+ *
+ * Build with:
+ *
+ *   g++ -O2 -Ihost -I../src -I../lib/SmartCard -I../lib/I2CQueue \
+ *     -I../lib/Gamma -o i2c_sim i2c_sim.cpp host/twi_sim.cpp \
+ *     ../lib/I2CQueue/i2c_queue.cpp ../lib/SmartCard/smart_card.cpp \
+ *     ../src/clock.cpp ../src/asset_loader.cpp ../src/image.cpp \
+ *     ../src/panel.cpp ../src/frame_packets.cpp
+ */
+#include <stdio.h>
+#include "Arduino.h"
+#include "i2c_queue.h"
+#include "smart_card.h"
+#include "clock.h"
+#include "asset_loader.h"
+
+// What a pass of the loop costs besides the bus: putting a frame out, and
+// decoding each byte of an image taken from the card.
+#define FRAME_US      2000
+#define DECODE_US     20
+
+// How long each step of the animation is up.
+#define HOLD_MS       100
+#define STEPS         4
+
+unsigned long millis()
+{
+  return SimTwi::now_us / 1000;
+}
+
+unsigned long micros()
+{
+  return SimTwi::now_us;
+}
+
+static SimEeprom eeprom;
+static SimDS1307 rtc;
+
+static uint8_t step_images[STEPS][FRAME_PIXELS];
+static uint16_t card_at;
+
+static void append(uint8_t b, void*)
+{
+  eeprom.memory[card_at++] = b;
+}
+
+static void entry(uint8_t asset, uint8_t type, uint16_t offset)
+{
+  uint8_t* e = eeprom.memory + ASSET_HEADER_LENGTH +
+    asset * ASSET_ENTRY_LENGTH;
+  uint16_t length = card_at - offset;
+  e[0] = type;
+  e[1] = offset & 0xff;
+  e[2] = offset >> 8;
+  e[3] = length & 0xff;
+  e[4] = length >> 8;
+}
+
+/**
+ * Pack the card: a palette of 16 colors, then an image for each step, and
+ * the animation. Returns the animation's asset.
+ */
+static uint8_t pack_card()
+{
+  const uint8_t count = 2 + STEPS;
+  FrameEncoder encoder(append, NULL);
+
+  // Stripes that shift from step to step, with a diagonal across them, so
+  // the run-length images are a few hundred bytes each.
+  for (uint8_t k = 0; k < STEPS; ++k)
+    for (uint16_t p = 0; p < FRAME_PIXELS; ++p) {
+      uint8_t x = p % FRAME_WIDTH, y = p / FRAME_WIDTH;
+      step_images[k][p] = x == (y + 5 * k) % FRAME_WIDTH ? 15 :
+        ((x + 3 * k) / 8 + y / 4) % 15;
+    }
+
+  memset(eeprom.memory, 0xff, SimEeprom::LENGTH);
+  card_at = ASSET_HEADER_LENGTH + count * ASSET_ENTRY_LENGTH;
+
+  uint16_t at = card_at;
+  append(0, NULL);
+  append(16, NULL);
+  for (uint8_t i = 0; i < 16; ++i) {
+    append(i * 16, NULL);
+    append(255 - i * 16, NULL);
+    append(i * 8, NULL);
+  }
+  entry(0, ASSET_PALETTE, at);
+
+  at = card_at;
+  for (uint16_t p = 0; p < FRAME_PIXELS; p += 2)
+    append(step_images[0][p] | (step_images[0][p + 1] << 4), NULL);
+  entry(1, ASSET_IMAGE_4BIT, at);
+
+  for (uint8_t k = 1; k < STEPS; ++k) {
+    at = card_at;
+    bool delta = k == 2;
+    encoder.code_only(step_images[k], delta ? step_images[k - 1] : NULL);
+    entry(1 + k, delta ? ASSET_IMAGE_DELTA : ASSET_IMAGE_RLE, at);
+  }
+
+  at = card_at;
+  append(0, NULL);
+  append(STEPS, NULL);
+  for (uint8_t k = 0; k < STEPS; ++k) {
+    append(1 + k, NULL);
+    append(HOLD_MS & 0xff, NULL);
+    append(HOLD_MS >> 8, NULL);
+  }
+  entry(count - 1, ASSET_ANIMATION, at);
+
+  uint16_t crc = CRC16_INIT;
+  for (uint16_t i = ASSET_HEADER_LENGTH; i < card_at; ++i)
+    crc = crc16_update(crc, eeprom.memory[i]);
+  const uint8_t header[ASSET_HEADER_LENGTH] = {
+    ASSET_MAGIC_0, ASSET_MAGIC_1, ASSET_VERSION, count,
+    uint8_t(card_at & 0xff), uint8_t(card_at >> 8),
+    uint8_t(crc & 0xff), uint8_t(crc >> 8)
+  };
+  memcpy(eeprom.memory, header, sizeof(header));
+  return count - 1;
+}
+
+static bool same_image(const Image4* img, const uint8_t* indices)
+{
+  for (uint16_t p = 0; p < FRAME_PIXELS; ++p)
+    if (img->get_color(p % FRAME_WIDTH, FRAME_HEIGHT - 1 - p / FRAME_WIDTH) !=
+        indices[p])
+      return false;
+  return true;
+}
+
+static uint8_t order[8];
+static uint8_t finished;
+
+static void record(I2CTransaction* t)
+{
+  order[finished++] = *(uint8_t*)t->context;
+}
+
+// Reads the seconds register three times over, resubmitting itself.
+static uint8_t again;
+static uint8_t seconds[3];
+
+static void resubmit(I2CTransaction* t)
+{
+  if (t->status == I2C_DONE && again < 3) {
+    seconds[again++] = t->in[0];
+    if (again < 3)
+      I2CQueue::submit(t);
+  }
+}
+
+static bool queue_test()
+{
+  bool ok = true;
+  static const uint8_t ids[3] = { 0, 1, 2 };
+  static const uint8_t zero = 0;
+  uint8_t card_bytes[8], clock_bytes[7], x = 0x5a;
+
+  I2CTransaction t[3];
+  t[0].set(0x50, &zero, 1, card_bytes, sizeof(card_bytes));
+  t[1].set(SimDS1307::ADDRESS, &zero, 1, clock_bytes, sizeof(clock_bytes));
+  t[2].set(0x20, &x, 1, NULL, 0);
+  for (uint8_t i = 0; i < 3; ++i) {
+    t[i].callback = record;
+    t[i].context = (void*)&ids[i];
+    ok = I2CQueue::submit(&t[i]) && ok;
+  }
+
+  // Still on the bus or waiting for it, so it can't go in again.
+  ok = !I2CQueue::submit(&t[1]) && ok;
+
+  I2CQueue::wait(&t[2]);
+  ok = finished == 3 && order[0] == 0 && order[1] == 1 && order[2] == 2 && ok;
+  ok = t[0].status == I2C_DONE && t[1].status == I2C_DONE && ok;
+  ok = t[2].status == I2C_NACK && I2CQueue::idle() && ok;
+  ok = memcmp(card_bytes, eeprom.memory, sizeof(card_bytes)) == 0 && ok;
+  ok = memcmp(clock_bytes, rtc.registers, sizeof(clock_bytes)) == 0 && ok;
+
+  I2CTransaction r;
+  uint8_t s;
+  r.set(SimDS1307::ADDRESS, &zero, 1, &s, 1);
+  r.callback = resubmit;
+  I2CQueue::submit(&r);
+  while (again < 3)
+    i2c_idle();
+  ok = seconds[0] == rtc.registers[0] && ok;
+
+  printf("queue: %s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+/**
+ * Ten seconds of the loop, playing the animation from the card. Returns the
+ * longest pass in us, checks each step as it comes to the front and the time
+ * read against the clock's.
+ */
+static uint32_t loop_test(uint8_t animation, bool background, bool* ok)
+{
+  static DoubleBuffer<Image4> images;
+  static Palette pal(256);
+  SmartCard card;
+  AssetLoader loader(&card);
+  AssetPlayer player(&loader, &images, &pal);
+  DS1307_Clock clock;
+  uint32_t longest = 0;
+  uint32_t last_request = SimTwi::now_us;
+  uint8_t reads = 0;
+  uint16_t shown = 0;
+  ds1307_time time;
+
+  // Before the loop, as setup() does.
+  if (!loader.begin() || !player.play(animation, millis()))
+    *ok = false;
+  clock.request_time();
+
+  uint32_t end = SimTwi::now_us + 10000000;
+  while (int32_t(end - SimTwi::now_us) > 0) {
+    uint32_t pass = SimTwi::now_us;
+
+    SimTwi::advance(FRAME_US);
+
+    // The bytes it decoded, going by how far on the card it got.
+    uint16_t at = card.tell();
+    if (player.update(millis())) {
+      if (!same_image(images.front(), step_images[shown % STEPS]))
+        *ok = false;
+      ++shown;
+    }
+    uint16_t decoded = card.tell() - at;
+    if (decoded <= ASSET_LOAD_BUDGET)
+      SimTwi::advance(decoded * DECODE_US);
+
+    bool got = false;
+    if (background) {
+      got = clock.poll_time(&time);
+      if (SimTwi::now_us - last_request >= 1000000) {
+        clock.request_time();
+        last_request = SimTwi::now_us;
+      }
+    }
+    else if (SimTwi::now_us - last_request >= 1000000) {
+      // What get_time() does, without its printing.
+      static const uint8_t zero = 0;
+      I2CTransaction t;
+      uint8_t bytes[7];
+      t.set(SimDS1307::ADDRESS, &zero, 1, bytes, sizeof(bytes));
+      got = I2CQueue::run(&t) == I2C_DONE;
+      time.seconds = (bytes[0] & 0xf) + 10 * ((bytes[0] >> 4) & 0x7);
+      last_request = SimTwi::now_us;
+    }
+
+    if (got) {
+      ++reads;
+      rtc.update();
+      if (time.seconds != (rtc.registers[0] & 0xf) +
+          10 * ((rtc.registers[0] >> 4) & 0x7))
+        *ok = false;
+    }
+
+    if (SimTwi::now_us - pass > longest)
+      longest = SimTwi::now_us - pass;
+  }
+
+  // The card's read ahead is still in the queue, and goes with the card.
+  while (!I2CQueue::idle())
+    i2c_idle();
+
+  // Each step is up for HOLD_MS, and comes in well within that.
+  if (!player.playing() || shown < 10000 / HOLD_MS * 9 / 10 || reads < 9)
+    *ok = false;
+  return longest;
+}
+
+/**
+ * The longest step loaded all at once, as AssetPlayer::update() used to, with
+ * each byte decoded costing the same as in the loop.
+ */
+static uint32_t whole_step_test(bool* ok)
+{
+  static Image4 img;
+  SmartCard card;
+  AssetLoader loader(&card);
+  uint32_t longest = 0;
+
+  if (!loader.begin())
+    *ok = false;
+  for (uint8_t k = 0; k < STEPS; ++k) {
+    const uint8_t* e = eeprom.memory + ASSET_HEADER_LENGTH +
+      (1 + k) * ASSET_ENTRY_LENGTH;
+    uint16_t length = e[3] | (e[4] << 8);
+
+    uint32_t start = SimTwi::now_us;
+    if (!loader.load_image(1 + k, &img))
+      *ok = false;
+    uint32_t us = SimTwi::now_us - start + length * DECODE_US;
+    if (us > longest)
+      longest = us;
+  }
+
+  while (!I2CQueue::idle())
+    i2c_idle();
+  return longest;
+}
+
+int main()
+{
+  bool ok = true;
+
+  SimTwi::attach(&eeprom);
+  SimTwi::attach(&rtc);
+  I2CQueue::begin();
+
+  for (uint16_t i = 0; i < SimEeprom::LENGTH; ++i)
+    eeprom.memory[i] = i * 7;
+  rtc.registers[0] = 0x00;   // Running, from 00:00:00
+
+  ok = queue_test() && ok;
+
+  uint8_t animation = pack_card();
+  uint32_t blocking = loop_test(animation, false, &ok);
+  uint32_t background = loop_test(animation, true, &ok);
+  uint32_t whole = whole_step_test(&ok);
+  printf("card: %u bytes, %u steps of %u ms\n", card_at, STEPS, HOLD_MS);
+  printf("longest pass, with %u us of frame and up to %u us of decoding:\n",
+         FRAME_US, ASSET_LOAD_BUDGET * DECODE_US);
+  printf("  clock read in the loop     %6u us\n", (unsigned)blocking);
+  printf("  clock read in background   %6u us\n", (unsigned)background);
+  printf("  a step loaded at once      %6u us\n", (unsigned)whole);
+
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
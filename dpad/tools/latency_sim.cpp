@@ -0,0 +1,406 @@
+/**
+ * Simulates the dpad sketch's loop() against a serial link, to measure how
+ * long a frame takes from the moment the host starts sending it until it's
+ * on the strips, and how long the display goes without a refresh while
+ * frames come in.
+ *
+ *   latency_sim [-b baud] [-n frames] [-c cycle_ms]
+ *
+ * Two loops are compared: the one that stops everything until a packet is
+ * in, and the one that receives through a SerialReceiver a few bytes per
+ * tick. Palette cycling runs the whole time (every cycle_ms, default 50), so
+ * the display has something to keep up with.
+ *
+ * The second is the sketch's loop(): the frame goes out in the background
+ * from a timer interrupt at SCAN_HZ, with loop() sending slices of its own
+ * whenever it comes around, and a packet is answered as soon as its frame is
+ * flipped to the front, so the host sends the next one while it goes out.
+ * The interrupts that have come due are run at the start of each pass. Either way, the latency runs until the frame has finished going
+ * out, not just until the answer.
+ *
+ * Time on the device is charged from estimates: a fixed cost per byte
+ * received, per LED compiled and per loop, and the CycleCostModel of the
+ * port stores for the scanout, which goes out in slices with the serial port
+ * serviced in between.
+ * The 64-byte hardware serial buffer is modeled, and bytes that arrive while
+ * it's full are counted as dropped.
+ *
+ * Build with:
+ *
+ *   g++ -O2 -Ihost -I../src -I../lib/Gamma -o latency_sim latency_sim.cpp \
+ *     ../src/image.cpp ../src/panel.cpp ../src/palette_anim.cpp \
+ *     ../src/LPD8806x8.cpp ../src/lpd_ports.cpp ../src/frame_packets.cpp \
+ *     ../src/frame_decoder.cpp ../src/serial_receiver.cpp
+ */
+#include <stdio.h>
+#include <unistd.h>
+
+#include <deque>
+#include <vector>
+
+#include <Arduino.h>
+#include "LPD8806x8.h"
+#include "double_buffer.h"
+#include "frame_decoder.h"
+#include "palette_anim.h"
+#include "serial_receiver.h"
+
+// Device-side cost estimates, in microseconds.
+static const double BYTE_US = 6.0;          // read, buffer and decode a byte
+static const double COMPILE_LED_US = 20.0;  // compile one LED of all strips
+static const double LOOP_US = 4.0;          // a loop() that does nothing
+
+static const uint16_t HARDWARE_BUFFER_LENGTH = 64;
+static const uint8_t UPDATE_MS = 10;
+static const double TIMEOUT_US = 100000;    // host gives up on an answer
+static const uint16_t RECEIVE_BUDGET = 64;
+static const double SCAN_US = 1e6 / 2000;   // the sketch's SCAN_HZ
+static const uint8_t LOOP_SCAN_GROUPS = 32;
+
+static double now_us = 0;
+
+unsigned long millis()
+{
+  return (unsigned long)(now_us / 1000);
+}
+
+unsigned long micros()
+{
+  return (unsigned long)now_us;
+}
+
+/**
+ * The serial port on the device, with the host on the other end. The host
+ * sends one packet at a time and waits for the answer.
+ */
+class SimSerial : public Stream
+{
+public:
+  SimSerial(long baud)
+    : byte_us(10e6 / baud), next_arrival(0), dropped(0), answer(0) { }
+
+  void send(const std::vector<uint8_t>& packet) {
+    wire.insert(wire.end(), packet.begin(), packet.end());
+    next_arrival = now_us + byte_us;
+    answer = 0;
+  }
+
+  int available() {
+    arrive();
+    return buffer.size();
+  }
+
+  int read() {
+    arrive();
+    if (buffer.empty())
+      return -1;
+
+    now_us += BYTE_US;
+    uint8_t b = buffer.front();
+    buffer.pop_front();
+    return b;
+  }
+
+  size_t write(uint8_t b) {
+    answer = b;
+    return 1;
+  }
+
+  double byte_us;
+  double next_arrival;
+  std::deque<uint8_t> wire;
+  std::deque<uint8_t> buffer;
+  uint32_t dropped;
+
+  uint8_t answer;
+
+private:
+  /**
+   * Move everything that's come off the wire by now into the buffer.
+   */
+  void arrive() {
+    while (!wire.empty() && next_arrival <= now_us) {
+      if (buffer.size() < HARDWARE_BUFFER_LENGTH)
+        buffer.push_back(wire.front());
+      else
+        ++dropped;
+      wire.pop_front();
+      next_arrival += byte_us;
+    }
+  }
+};
+
+struct Device
+{
+  Device(long baud)
+    : serial(baud), pal(256), decoder(&images, &pal),
+      receiver(&serial, &decoder), anim(&pal), frames_waiting(0),
+      frames_going(0), next_scan(0), last_update(0), last_show(0),
+      max_gap(0) { }
+
+  void show() {
+    now_us += COMPILE_LED_US * images.front()->dirty_length();
+    frame.compile(images.front(), &pal);
+    receiver.poll();
+
+    // The timer interrupt pushes the frame out a slice at a time, and the
+    // serial port gets serviced in between.
+    strip.begin_show(&frame);
+    bool busy;
+    do {
+      SimPorts::reset();
+      busy = strip.scan(strip.SCAN_GROUPS);
+      now_us += cost.micros(SimPorts::trace(), SimPorts::trace_length());
+      receiver.poll();
+    } while (busy);
+    shown();
+  }
+
+  /**
+   * A frame has finished going out.
+   */
+  void shown() {
+    if (now_us - last_show > max_gap)
+      max_gap = now_us - last_show;
+    last_show = now_us;
+
+    for (; frames_going > 0; --frames_going)
+      shown_at.push_back(now_us);
+  }
+
+  /**
+   * loop() from before SerialReceiver: drain the serial port, and don't show
+   * anything in the middle of a packet.
+   */
+  void blocking_loop() {
+    bool done = false;
+    while (serial.available() && !done) {
+      switch (decoder.feed(serial.read())) {
+      case FEED_PACKET: done = true; break;
+      case FEED_ERROR: serial.write(PACKET_NAK); break;
+      default: break;
+      }
+    }
+
+    now_us += LOOP_US;
+    if (decoder.busy())
+      return;
+    frames_going = done;
+    update(done);
+  }
+
+  /**
+   * loop() as it is in the sketch.
+   */
+  void receiver_loop() {
+    scan_interrupts();
+
+    uint8_t received = receiver.service(RECEIVE_BUDGET);
+    if (received == FEED_ERROR)
+      serial.write(PACKET_NAK);
+    else if (received == FEED_PACKET) {
+      serial.write(PACKET_ACK);
+      ++frames_waiting;
+    }
+
+    now_us += LOOP_US;
+    if (strip.busy()) {
+      SimPorts::reset();
+      if (!strip.scan(LOOP_SCAN_GROUPS))
+        shown();
+      now_us += cost.micros(SimPorts::trace(), SimPorts::trace_length());
+      return;
+    }
+
+    uint32_t now = millis();
+    if (frames_waiting == 0 && now - last_update < UPDATE_MS)
+      return;
+    last_update = now;
+
+    anim.update(now);
+    now_us += COMPILE_LED_US * images.front()->dirty_length();
+    frame.compile(images.front(), &pal);
+    frames_going = frames_waiting;
+    frames_waiting = 0;
+
+    // The interrupts that came due while the strips were idle had nothing
+    // to send.
+    while (next_scan <= now_us)
+      next_scan += SCAN_US;
+    strip.begin_show(&frame);
+    if (!strip.busy())
+      shown();    // nothing had changed
+  }
+
+  /**
+   * The timer interrupts that have come due, each sending a slice of the
+   * frame going out.
+   */
+  void scan_interrupts() {
+    for (; next_scan <= now_us; next_scan += SCAN_US) {
+      if (!strip.busy())
+        continue;
+      SimPorts::reset();
+      bool busy = strip.scan(strip.SCAN_GROUPS);
+      now_us += cost.micros(SimPorts::trace(), SimPorts::trace_length());
+      if (!busy)
+        shown();
+    }
+  }
+
+  void update(bool done) {
+    uint32_t now = millis();
+    if (!done && now - last_update < UPDATE_MS)
+      return;
+    last_update = now;
+
+    anim.update(now);
+    show();
+    if (done)
+      serial.write(PACKET_ACK);
+  }
+
+  SimSerial serial;
+  DoubleBuffer<Image4> images;
+  Palette pal;
+  CompiledFrame frame;
+  FrameDecoder decoder;
+  SerialReceiver receiver;
+  PaletteAnimator anim;
+  BasicLPD8806x8<SimPorts> strip;
+  CycleCostModel cost;
+
+  // Frames that came in since the last compile, and those in the frame
+  // going out. A frame can be flipped over by the next before it's
+  // compiled; it then reaches the strips, as far as the host can tell, with
+  // the one that replaced it.
+  uint16_t frames_waiting;
+  uint16_t frames_going;
+  // When each frame that came in finished going out.
+  std::vector<double> shown_at;
+  double next_scan;
+
+  uint32_t last_update;
+  double last_show;
+  double max_gap;
+};
+
+static void append(uint8_t b, void* context)
+{
+  static_cast<std::vector<uint8_t>*>(context)->push_back(b);
+}
+
+/**
+ * A frame of moving diagonal stripes, in raster order.
+ */
+static void make_frame(uint16_t f, uint8_t* raster)
+{
+  for (uint16_t k = 0; k < FRAME_PIXELS; ++k) {
+    uint8_t x = k % FRAME_WIDTH, y = k / FRAME_WIDTH;
+    raster[k] = ((x + y + f) / 4) % 8;
+  }
+}
+
+static void run(const char* name, bool blocking, long baud, int frames,
+                uint16_t cycle_ms)
+{
+  now_us = 0;
+  Device* device = new Device(baud);
+  device->pal.fill_hsv_gradient(0, 8, 0, 7 * 32, 255, 128);
+  device->anim.set_cycle(8, cycle_ms);
+
+  std::vector<uint8_t> packet;
+  FrameEncoder encoder(append, &packet);
+  uint8_t previous[FRAME_PIXELS], raster[FRAME_PIXELS];
+
+  // When each frame that was taken was first sent.
+  std::vector<double> sent_at;
+  int nak = 0, resent = 0;
+  double start = now_us;
+
+  for (int f = 0; f < frames; ++f) {
+    make_frame(f, raster);
+    packet.clear();
+    if (f == 0)
+      encoder.frame(raster);
+    else
+      encoder.delta(raster, previous);
+    memcpy(previous, raster, sizeof(raster));
+
+    // Like send_frames, send again on a NAK or when there's no answer.
+    double first_sent = now_us;
+    bool taken = false;
+    for (int attempt = 0; attempt < 3 && !taken; ++attempt) {
+      if (attempt > 0)
+        ++resent;
+
+      device->serial.send(packet);
+      double deadline = now_us + packet.size() * device->serial.byte_us +
+        TIMEOUT_US;
+      while (device->serial.answer == 0 && now_us < deadline) {
+        if (blocking)
+          device->blocking_loop();
+        else
+          device->receiver_loop();
+      }
+      taken = device->serial.answer == PACKET_ACK;
+    }
+
+    if (taken)
+      sent_at.push_back(first_sent);
+    else
+      ++nak;
+  }
+
+  // The last frames may still be on their way to the strips.
+  while (device->shown_at.size() < sent_at.size()) {
+    if (blocking)
+      device->blocking_loop();
+    else
+      device->receiver_loop();
+  }
+
+  double total_latency = 0, max_latency = 0;
+  for (size_t i = 0; i < sent_at.size(); ++i) {
+    double latency = device->shown_at[i] - sent_at[i];
+    total_latency += latency;
+    if (latency > max_latency)
+      max_latency = latency;
+  }
+
+  double seconds = (now_us - start) / 1e6;
+  printf("%s:\n", name);
+  printf("  %d frames, %.1f frames/s, %d lost, %d sent again, "
+         "%u bytes dropped\n", frames, frames / seconds, nak, resent,
+         device->serial.dropped);
+  if (frames > nak)
+    printf("  latency %.1f ms average, %.1f ms worst\n",
+           total_latency / (frames - nak) / 1000, max_latency / 1000);
+  printf("  longest time without a refresh: %.1f ms\n",
+         device->max_gap / 1000);
+
+  delete device;
+}
+
+int main(int argc, char** argv)
+{
+  long baud = 115200;
+  int frames = 100;
+  uint16_t cycle_ms = 50;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "b:n:c:")) != -1) {
+    switch (opt) {
+    case 'b': baud = atol(optarg); break;
+    case 'n': frames = atoi(optarg); break;
+    case 'c': cycle_ms = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: latency_sim [-b baud] [-n frames] [-c cycle_ms]\n");
+      return 1;
+    }
+  }
+
+  run("Blocking loop", true, baud, frames, cycle_ms);
+  run("SerialReceiver loop", false, baud, frames, cycle_ms);
+  return 0;
+}
@@ -0,0 +1,241 @@
+/**
+ * Packs a palette and frames into assets for the smart card (see
+ * src/asset_format.h), so the panel starts up showing them.
+ *
+ *   pack_assets [-b baud] [-p palette.rgb] [-t hold_ms] [-o card.bin]
+ *     frames.idx [device]
+ *
+ * The files are the ones send_frames takes. Each frame becomes an image:
+ * 4-bit if that's shortest, run-length coded otherwise, and after the first,
+ * a delta when that's shorter still. More than one frame makes an animation
+ * too, showing each for hold_ms (default 100) and looping.
+ *
+ * The card image is written to card.bin if given, and to the card in the
+ * panel through the serial link if there's a device. The header goes last,
+ * so the card doesn't look valid to the panel until everything is there.
+ *
+ * Build with:
+ *
+ *   g++ -O2 -I../src -o pack_assets pack_assets.cpp serial_link.cpp \
+ *     ../src/frame_packets.cpp
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "asset_format.h"
+#include "frame_packets.h"
+#include "serial_link.h"
+
+struct Asset
+{
+  uint8_t type;
+  std::vector<uint8_t> payload;
+};
+
+static void put16(std::vector<uint8_t>* out, uint16_t v)
+{
+  out->push_back(v & 0xff);
+  out->push_back(v >> 8);
+}
+
+/**
+ * The shortest coding of a frame, as a delta from 'previous' if that's
+ * given.
+ */
+static Asset image(const uint8_t* indices, const uint8_t* previous)
+{
+  Asset a;
+  FrameEncoder encoder(append, &a.payload);
+
+  a.type = ASSET_IMAGE_RLE;
+  encoder.code_only(indices, NULL);
+
+  if (previous &&
+      FrameEncoder::coded_length(indices, previous) < a.payload.size()) {
+    a.type = ASSET_IMAGE_DELTA;
+    a.payload.clear();
+    encoder.code_only(indices, previous);
+  }
+
+  if (ASSET_IMAGE_4BIT_LENGTH < a.payload.size()) {
+    a.type = ASSET_IMAGE_4BIT;
+    a.payload.clear();
+    for (uint16_t i = 0; i < FRAME_PIXELS; i += 2)
+      a.payload.push_back(indices[i] | (indices[i + 1] << 4));
+  }
+  return a;
+}
+
+/**
+ * Lay the assets out after the header and directory. Returns false if
+ * they don't fit.
+ */
+static bool pack(const std::vector<Asset>& assets, std::vector<uint8_t>* card)
+{
+  uint32_t offset = ASSET_HEADER_LENGTH + assets.size() * ASSET_ENTRY_LENGTH;
+
+  card->assign(ASSET_HEADER_LENGTH, 0);
+  for (size_t i = 0; i < assets.size(); ++i) {
+    card->push_back(assets[i].type);
+    put16(card, offset);
+    put16(card, assets[i].payload.size());
+    offset += assets[i].payload.size();
+  }
+  for (size_t i = 0; i < assets.size(); ++i)
+    card->insert(card->end(), assets[i].payload.begin(),
+                 assets[i].payload.end());
+  if (assets.size() > 255 || card->size() > ASSET_CARD_LENGTH)
+    return false;
+
+  uint16_t crc = CRC16_INIT;
+  for (size_t i = ASSET_HEADER_LENGTH; i < card->size(); ++i)
+    crc = crc16_update(crc, (*card)[i]);
+
+  (*card)[0] = ASSET_MAGIC_0;
+  (*card)[1] = ASSET_MAGIC_1;
+  (*card)[2] = ASSET_VERSION;
+  (*card)[3] = assets.size();
+  (*card)[4] = card->size() & 0xff;
+  (*card)[5] = card->size() >> 8;
+  (*card)[6] = crc & 0xff;
+  (*card)[7] = crc >> 8;
+  return true;
+}
+
+static bool write_card(int fd, const std::vector<uint8_t>& card,
+                       size_t at, size_t size)
+{
+  Packet packet;
+  FrameEncoder encoder(append, &packet);
+
+  for (size_t i = 0; i < size; i += PACKET_CARD_BYTES) {
+    size_t n = size - i < PACKET_CARD_BYTES ? size - i : PACKET_CARD_BYTES;
+    packet.clear();
+    encoder.card_write(at + i, n, &card[at + i]);
+    if (!send_packet(fd, packet)) {
+      fprintf(stderr, "card write at %zu wasn't taken\n", at + i);
+      return false;
+    }
+  }
+  return true;
+}
+
+static void usage()
+{
+  fprintf(stderr,
+          "usage: pack_assets [-b baud] [-p palette.rgb] [-t hold_ms] "
+          "[-o card.bin] frames.idx [device]\n");
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  long baud = 115200;
+  long hold_ms = 100;
+  const char* palette_path = NULL;
+  const char* out_path = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "b:p:t:o:")) != -1) {
+    switch (opt) {
+    case 'b': baud = atol(optarg); break;
+    case 'p': palette_path = optarg; break;
+    case 't': hold_ms = atol(optarg); break;
+    case 'o': out_path = optarg; break;
+    default: usage();
+    }
+  }
+  if (optind >= argc || baud_constant(baud) == 0 || hold_ms < 0 ||
+      hold_ms > 0xffff)
+    usage();
+
+  const char* frames_path = argv[optind];
+  const char* device = optind + 1 < argc ? argv[optind + 1] : NULL;
+
+  std::vector<uint8_t> rgb, frames;
+  if (palette_path && !read_file(palette_path, &rgb))
+    return 1;
+  if (!read_file(frames_path, &frames))
+    return 1;
+  if (rgb.size() % 3 != 0 || rgb.size() > 3 * 256 ||
+      frames.size() % FRAME_PIXELS != 0 || frames.empty()) {
+    fprintf(stderr, "palette or frames have the wrong size\n");
+    return 1;
+  }
+  for (size_t i = 0; i < frames.size(); ++i) {
+    if (frames[i] >= FRAME_COLORS) {
+      fprintf(stderr, "frame %zu uses color %u; the panel only shows the "
+              "first %u\n", i / FRAME_PIXELS, frames[i], FRAME_COLORS);
+      return 1;
+    }
+  }
+
+  std::vector<Asset> assets;
+  uint8_t palette = ASSET_NONE;
+  if (!rgb.empty()) {
+    Asset a;
+    a.type = ASSET_PALETTE;
+    a.payload.push_back(0);
+    a.payload.push_back(rgb.size() / 3);  // 256 wraps to 0
+    a.payload.insert(a.payload.end(), rgb.begin(), rgb.end());
+    palette = assets.size();
+    assets.push_back(a);
+  }
+
+  size_t count = frames.size() / FRAME_PIXELS;
+  size_t first_image = assets.size();
+  size_t types[ASSET_ANIMATION + 1] = { 0 };
+  for (size_t i = 0; i < count; ++i) {
+    const uint8_t* frame = &frames[i * FRAME_PIXELS];
+    assets.push_back(image(frame, i > 0 ? frame - FRAME_PIXELS : NULL));
+    ++types[assets.back().type];
+  }
+
+  if (count > 1) {
+    Asset a;
+    a.type = ASSET_ANIMATION;
+    a.payload.push_back(palette);
+    a.payload.push_back(count);
+    for (size_t i = 0; i < count; ++i) {
+      a.payload.push_back(first_image + i);
+      put16(&a.payload, hold_ms);
+    }
+    assets.push_back(a);
+  }
+
+  std::vector<uint8_t> card;
+  bool fits = count <= 255 && pack(assets, &card);
+
+  fprintf(stderr, "palette: %zu colors\n", rgb.size() / 3);
+  fprintf(stderr, "images: %zu (%zu 4-bit, %zu rle, %zu delta)\n", count,
+          types[ASSET_IMAGE_4BIT], types[ASSET_IMAGE_RLE],
+          types[ASSET_IMAGE_DELTA]);
+  fprintf(stderr, "card: %zu of %d bytes\n", card.size(), ASSET_CARD_LENGTH);
+  if (!fits) {
+    fprintf(stderr, "that doesn't fit on the card\n");
+    return 1;
+  }
+
+  if (out_path) {
+    FILE* f = fopen(out_path, "wb");
+    if (!f || fwrite(&card[0], 1, card.size(), f) != card.size()) {
+      perror(out_path);
+      return 1;
+    }
+    fclose(f);
+  }
+
+  if (device) {
+    int fd = open_serial(device, baud);
+    // Everything after the header, then the header.
+    if (fd < 0 ||
+        !write_card(fd, card, ASSET_HEADER_LENGTH,
+                    card.size() - ASSET_HEADER_LENGTH) ||
+        !write_card(fd, card, 0, ASSET_HEADER_LENGTH))
+      return 1;
+    close(fd);
+  }
+  return 0;
+}
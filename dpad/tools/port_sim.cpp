@@ -0,0 +1,135 @@
+/**
+ * Runs the same frames out through both port backends on the host: SimPorts,
+ * which clocks the shift registers by toggling the control port, and
+ * SimSpiPorts, which clocks them from the SPI as AvrSpiPorts does. The bytes
+ * each of the 8 strips would receive are decoded from the modeled shift
+ * registers and checked against the frame and against each other, and the
+ * CycleCostModel estimate of a frame is printed for each backend.
+ *
+ * Two frames are sent: a whole one, then one with only the middle columns
+ * changed, which goes out short and latches early.
+ *
+ *   port_sim
+ *
+ * Exits with 1 if a strip gets anything other than its pixels and the latch,
+ * the two backends differ, the trace overflows or the SPI backend loads a
+ * register while a byte is still shifting out.
+ *
+ * Build with:
+ *
+ *   g++ -O2 -Ihost -I../src -I../lib/Gamma -o port_sim port_sim.cpp \
+ *     ../src/image.cpp ../src/panel.cpp ../src/LPD8806x8.cpp \
+ *     ../src/lpd_ports.cpp
+ */
+#include <stdio.h>
+
+#include <Arduino.h>
+#include "LPD8806x8.h"
+
+static const uint8_t STRIPS = Panel32x32::STRIPS;
+static const uint16_t STRIP_LENGTH = Panel32x32::STRIP_LENGTH;
+static const uint8_t LATCH_BYTES = BasicLPD8806x8<SimPorts>::LATCH_BYTES;
+
+static uint8_t expected[STRIPS][SIM_STREAM_LENGTH];
+static uint8_t sent[STRIPS][SIM_STREAM_LENGTH];
+static uint16_t sent_length[STRIPS];
+
+/**
+ * What each strip should get for the first 'length' LEDs of the image: GRB
+ * as the palette has it, then the latch.
+ */
+static uint16_t expect(const Image& img, const Palette& pal, uint16_t length)
+{
+  uint16_t n = 0;
+  for (uint8_t s = 0; s < STRIPS; ++s) {
+    n = 0;
+    for (uint16_t i = 0; i < length; ++i)
+      for (uint8_t ix = 0; ix < 3; ++ix)
+        expected[s][n++] = pal.get(img.index(s, i)).grb[ix];
+    for (uint8_t i = 0; i < LATCH_BYTES; ++i)
+      expected[s][n++] = 0;
+  }
+  return n;
+}
+
+/**
+ * Scan the frame out and check what the strips got.
+ */
+template <class Ports>
+static bool send(BasicLPD8806x8<Ports>* strip, CompiledFrame* frame,
+                 uint16_t length, uint32_t* us)
+{
+  Ports::setup();
+  strip->show(frame);
+
+  bool ok = Ports::dropped() == 0;
+  for (uint8_t s = 0; s < STRIPS; ++s) {
+    sent_length[s] = Ports::stream_length(s);
+    memcpy(sent[s], Ports::stream(s), sent_length[s]);
+    ok = ok && sent_length[s] == length &&
+      !memcmp(sent[s], expected[s], length);
+  }
+  *us = CycleCostModel().micros(Ports::trace(), Ports::trace_length());
+  return ok;
+}
+
+/**
+ * Compile the image and send it through both backends.
+ */
+static bool frame_test(const char* what, Image* img, const Palette& pal,
+                       uint16_t dirty)
+{
+  static CompiledFrame bitbang_frame, spi_frame;
+  static BasicLPD8806x8<SimPorts> bitbang;
+  static BasicLPD8806x8<SimSpiPorts> spi;
+
+  uint16_t length = expect(*img, pal, dirty);
+
+  Image copy = *img;
+  bitbang_frame.compile(img, &pal);
+  spi_frame.compile(&copy, &pal);
+
+  uint32_t bitbang_us, spi_us;
+  bool bitbang_ok = send(&bitbang, &bitbang_frame, length, &bitbang_us);
+  static uint8_t bitbang_sent[STRIPS][SIM_STREAM_LENGTH];
+  memcpy(bitbang_sent, sent, sizeof(sent));
+
+  bool spi_ok = send(&spi, &spi_frame, length, &spi_us);
+  uint32_t collisions = SimSpiPorts::collisions();
+  bool same = !memcmp(bitbang_sent, sent, sizeof(sent));
+
+  bool ok = bitbang_ok && spi_ok && same && collisions == 0;
+  printf("%-16s %6u %10lu %10lu %10s %10lu  %s\n", what, length,
+         (unsigned long)bitbang_us, (unsigned long)spi_us,
+         same ? "same" : "DIFFERENT", (unsigned long)collisions,
+         ok ? "ok" : "WRONG");
+  return ok;
+}
+
+int main()
+{
+  Palette pal(256);
+  pal.fill_hsv_gradient(0, 256, 0, 255, 255, 255);
+
+  static Image img;
+  for (uint8_t x = 0; x < Image::WIDTH; ++x)
+    for (uint8_t y = 0; y < Image::HEIGHT; ++y)
+      img.set_color(x, y, x * 8 + y * 3);
+
+  printf("%-16s %6s %10s %10s %10s %10s\n", "", "bytes", "bitbang us",
+         "spi us", "streams", "collisions");
+
+  bool ok = true;
+  ok = frame_test("whole frame", &img, pal, STRIP_LENGTH) && ok;
+
+  // The strips start from the middle of the panel, so the middle columns
+  // are all in their first segment.
+  img.clear_dirty();
+  for (uint8_t x = 12; x < 20; ++x)
+    for (uint8_t y = 0; y < Image::HEIGHT; ++y)
+      img.set_color(x, y, 255 - y);
+  ok = frame_test("middle columns", &img, pal, img.dirty_length()) && ok;
+
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+/**
+ * Host side of the dpad frame protocol (see src/frame_packets.h).
+ *
+ *   send_frames [-b baud] [-p palette.rgb] frames.idx [device]
+ *
+ * frames.idx is any number of 1024-byte frames of palette indices in raster
+ * order, from 0 to FRAME_COLORS - 1, and palette.rgb is r, g, b bytes for up
+ * to 256 colors. Every frame after the first is sent as a delta when that's
+ * shorter.
+ *
+ * With a device, the packets are sent one at a time, waiting for the panel to
+ * answer each one and sending it again on a PACKET_NAK. Without one, nothing
+ * is sent; the packets are only coded, and the frame rate the link would
+ * manage at the given baud rate is reported.
+ *
+ * Build with:
+ *
+ *   g++ -O2 -I../src -o send_frames send_frames.cpp serial_link.cpp \
+ *     ../src/frame_packets.cpp
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "frame_packets.h"
+#include "serial_link.h"
+
+static void usage()
+{
+  fprintf(stderr,
+          "usage: send_frames [-b baud] [-p palette.rgb] frames.idx [device]\n");
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  long baud = 115200;
+  const char* palette_path = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "b:p:")) != -1) {
+    switch (opt) {
+    case 'b': baud = atol(optarg); break;
+    case 'p': palette_path = optarg; break;
+    default: usage();
+    }
+  }
+  if (optind >= argc || baud_constant(baud) == 0)
+    usage();
+
+  const char* frames_path = argv[optind];
+  const char* device = optind + 1 < argc ? argv[optind + 1] : NULL;
+
+  std::vector<uint8_t> rgb, frames;
+  if (palette_path && !read_file(palette_path, &rgb))
+    return 1;
+  if (!read_file(frames_path, &frames))
+    return 1;
+  if (rgb.size() % 3 != 0 || rgb.size() > 3 * 256 ||
+      frames.size() % FRAME_PIXELS != 0) {
+    fprintf(stderr, "palette or frames have the wrong size\n");
+    return 1;
+  }
+  for (size_t i = 0; i < frames.size(); ++i) {
+    if (frames[i] >= FRAME_COLORS) {
+      fprintf(stderr, "frame %zu uses color %u; the panel only shows the "
+              "first %u\n", i / FRAME_PIXELS, frames[i], FRAME_COLORS);
+      return 1;
+    }
+  }
+
+  int fd = -1;
+  if (device && (fd = open_serial(device, baud)) < 0)
+    return 1;
+
+  Packet packet;
+  FrameEncoder encoder(append, &packet);
+  uint32_t palette_bytes = 0;
+
+  for (size_t i = 0; i < rgb.size() / 3; i += PACKET_PALETTE_COLORS) {
+    size_t n = rgb.size() / 3 - i;
+    if (n > PACKET_PALETTE_COLORS)
+      n = PACKET_PALETTE_COLORS;
+
+    packet.clear();
+    encoder.palette(i, n, &rgb[3 * i]);
+    palette_bytes += packet.size();
+    if (fd >= 0 && !send_packet(fd, packet)) {
+      fprintf(stderr, "palette packet %zu wasn't taken\n", i / 16);
+      return 1;
+    }
+  }
+
+  size_t count = frames.size() / FRAME_PIXELS;
+  uint32_t frame_bytes = 0;
+  size_t types[PACKET_FRAME_DELTA + 1] = { 0 };
+
+  for (size_t i = 0; i < count; ++i) {
+    const uint8_t* frame = &frames[i * FRAME_PIXELS];
+
+    packet.clear();
+    uint8_t type = i == 0
+      ? encoder.frame(frame)
+      : encoder.delta(frame, frame - FRAME_PIXELS);
+    ++types[type];
+    frame_bytes += packet.size();
+
+    if (fd >= 0 && !send_packet(fd, packet)) {
+      fprintf(stderr, "frame %zu wasn't taken\n", i);
+      return 1;
+    }
+  }
+
+  // Ten bits a byte on the wire, with the start and stop bits.
+  double seconds = frame_bytes * 10.0 / baud;
+  double raw_seconds = double(count) * (FRAME_PIXELS + PACKET_HEADER_LENGTH +
+                                        PACKET_CRC_LENGTH + 1) * 10.0 / baud;
+
+  fprintf(stderr, "palette: %u bytes\n", palette_bytes);
+  fprintf(stderr, "frames: %zu (%zu raw, %zu rle, %zu delta), %u bytes, "
+          "%.1f bytes/frame\n", count, types[PACKET_FRAME_RAW],
+          types[PACKET_FRAME_RLE], types[PACKET_FRAME_DELTA], frame_bytes,
+          count ? double(frame_bytes) / count : 0.0);
+  if (seconds > 0)
+    fprintf(stderr, "at %ld baud: %.1f frames/s (%.1f frames/s raw)\n",
+            baud, count / seconds, count / raw_seconds);
+
+  if (fd >= 0)
+    close(fd);
+  return 0;
+}
@@ -0,0 +1,85 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "frame_packets.h"
+#include "serial_link.h"
+
+static const int RETRIES = 3;
+
+void append(uint8_t b, void* context)
+{
+  static_cast<Packet*>(context)->push_back(b);
+}
+
+speed_t baud_constant(long baud)
+{
+  switch (baud) {
+  case 9600: return B9600;
+  case 19200: return B19200;
+  case 38400: return B38400;
+  case 57600: return B57600;
+  case 115200: return B115200;
+  case 230400: return B230400;
+  default: return 0;
+  }
+}
+
+int open_serial(const char* device, long baud)
+{
+  int fd = open(device, O_RDWR | O_NOCTTY);
+  if (fd < 0) {
+    perror(device);
+    return -1;
+  }
+
+  struct termios t;
+  tcgetattr(fd, &t);
+  cfmakeraw(&t);
+  cfsetispeed(&t, baud_constant(baud));
+  cfsetospeed(&t, baud_constant(baud));
+  t.c_cc[VMIN] = 0;
+  t.c_cc[VTIME] = 10;  // tenths of a second to wait for an answer
+  tcsetattr(fd, TCSANOW, &t);
+
+  // Opening the port resets the board; give it time to start up, and drop
+  // whatever it printed while doing so.
+  sleep(2);
+  tcflush(fd, TCIFLUSH);
+  return fd;
+}
+
+bool send_packet(int fd, const Packet& p)
+{
+  for (int attempt = 0; attempt < RETRIES; ++attempt) {
+    if (write(fd, &p[0], p.size()) != ssize_t(p.size())) {
+      perror("write");
+      return false;
+    }
+
+    uint8_t answer;
+    while (read(fd, &answer, 1) == 1) {
+      if (answer == PACKET_ACK)
+        return true;
+      if (answer == PACKET_NAK)
+        break;
+    }
+  }
+  return false;
+}
+
+bool read_file(const char* path, std::vector<uint8_t>* out)
+{
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+
+  uint8_t buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    out->insert(out->end(), buffer, buffer + n);
+  fclose(f);
+  return true;
+}
@@ -0,0 +1,41 @@
+#ifndef SERIAL_LINK_H__
+#define SERIAL_LINK_H__
+
+/**
+ * The host end of the serial link to the panel, shared by the tools that
+ * send it packets (see src/frame_packets.h).
+ */
+
+#include <stdint.h>
+#include <termios.h>
+
+#include <vector>
+
+typedef std::vector<uint8_t> Packet;
+
+/**
+ * FrameEncoder sink that appends to a Packet.
+ */
+void append(uint8_t b, void* context);
+
+/**
+ * The termios speed for a baud rate, or 0 if it isn't one the panel can
+ * use.
+ */
+speed_t baud_constant(long baud);
+
+/**
+ * Open the panel's serial port, and wait for the board to come out of the
+ * reset that opening it causes. Returns -1 on failure.
+ */
+int open_serial(const char* device, long baud);
+
+/**
+ * Send a packet and wait for the answer. Returns false if the panel never
+ * took it.
+ */
+bool send_packet(int fd, const Packet& p);
+
+bool read_file(const char* path, std::vector<uint8_t>* out);
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef GAMMA_H__
+#define GAMMA_H__
+
+#include <Arduino.h>
+
+/**
+ * Gamma correction tables, generated by the compiler and kept in PROGMEM.
+ *
+ *   GammaTable<250, 7>::lookup(x)
+ *
+ * maps an 8-bit level x to round(127 * (x / 255) ^ 2.5). The gamma is given
+ * in hundredths so it can be a template parameter, and the output can have
+ * any depth up to 8 bits: 7 for the LPD8806, 8 for NeoPixels. Each gamma
+ * and depth that's used gets its own 256-byte table in flash, and a lookup
+ * is one pgm_read_byte().
+ *
+ * The math below only has to be good enough to round to the right level;
+ * on an AVR the compiler evaluates it in 32-bit floats.
+ */
+
+constexpr double gamma_square(double x)
+{
+  return x * x;
+}
+
+// 2 * atanh(z), from z + z^3/3 + z^5/5 + ..., for |z| <= 1/3
+constexpr double gamma_atanh2(double z2, double term, int n)
+{
+  return n > 12 ? 0 : term / (2 * n + 1) + gamma_atanh2(z2, term * z2, n + 1);
+}
+
+// ln(y) for y >= 1: halve down to [1, 2), then ln(m) = 2 atanh((m-1)/(m+1))
+constexpr double gamma_ln(double y, int halvings = 0)
+{
+  return y >= 2 ? gamma_ln(y / 2, halvings + 1) :
+    halvings * 0.69314718055994531 +
+    2 * gamma_atanh2(gamma_square((y - 1) / (y + 1)), (y - 1) / (y + 1), 0);
+}
+
+// e^t from its series, for |t| <= 1/2
+constexpr double gamma_exp_series(double t, double term, int n)
+{
+  return n > 12 ? 0 : term + gamma_exp_series(t, term * t / (n + 1), n + 1);
+}
+
+// e^t for t <= 0: halve t into range, then square back up
+constexpr double gamma_exp(double t)
+{
+  return t < -0.5 ? gamma_square(gamma_exp(t / 2)) :
+    gamma_exp_series(t, 1, 0);
+}
+
+/**
+ * round(max * (x / 255) ^ (gamma_x100 / 100)), max = 2^bits - 1.
+ */
+constexpr uint8_t gamma_level(uint8_t x, uint16_t gamma_x100, uint8_t bits)
+{
+  return x == 0 ? 0 :
+    uint8_t(((1 << bits) - 1) *
+            gamma_exp(gamma_x100 / 100.0 * (gamma_ln(x) - gamma_ln(255))) +
+            0.5);
+}
+
+static_assert(gamma_level(128, 250, 7) == 23,
+              "gamma_level() has to work out at compile time");
+
+#define GAMMA_LEVEL_4(x)                                        \
+  gamma_level((x), GAMMA_X100, BITS),                           \
+  gamma_level((x) + 1, GAMMA_X100, BITS),                       \
+  gamma_level((x) + 2, GAMMA_X100, BITS),                       \
+  gamma_level((x) + 3, GAMMA_X100, BITS)
+#define GAMMA_LEVEL_16(x)                                       \
+  GAMMA_LEVEL_4(x), GAMMA_LEVEL_4((x) + 4),                     \
+  GAMMA_LEVEL_4((x) + 8), GAMMA_LEVEL_4((x) + 12)
+#define GAMMA_LEVEL_64(x)                                       \
+  GAMMA_LEVEL_16(x), GAMMA_LEVEL_16((x) + 16),                  \
+  GAMMA_LEVEL_16((x) + 32), GAMMA_LEVEL_16((x) + 48)
+
+template<uint16_t GAMMA_X100, uint8_t BITS>
+struct GammaTable
+{
+  static_assert(BITS >= 1 && BITS <= 8, "levels have to fit in a byte");
+
+  static const uint8_t table[256];
+
+  static uint8_t lookup(uint8_t x) {
+    return pgm_read_byte(&table[x]);
+  }
+};
+
+template<uint16_t GAMMA_X100, uint8_t BITS>
+const uint8_t GammaTable<GAMMA_X100, BITS>::table[256] PROGMEM = {
+  GAMMA_LEVEL_64(0), GAMMA_LEVEL_64(64),
+  GAMMA_LEVEL_64(128), GAMMA_LEVEL_64(192)
+};
+
+#undef GAMMA_LEVEL_64
+#undef GAMMA_LEVEL_16
+#undef GAMMA_LEVEL_4
+
+#endif
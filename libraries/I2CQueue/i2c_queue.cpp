@@ -0,0 +1,170 @@
+#include <Arduino.h>
+#include "i2c_queue.h"
+
+// TWSR status codes, with the prescaler bits masked off.
+#define TW_START            0x08
+#define TW_REP_START        0x10
+#define TW_MT_SLA_ACK       0x18
+#define TW_MT_SLA_NACK      0x20
+#define TW_MT_DATA_ACK      0x28
+#define TW_MT_DATA_NACK     0x30
+#define TW_ARB_LOST         0x38
+#define TW_MR_SLA_ACK       0x40
+#define TW_MR_SLA_NACK      0x48
+#define TW_MR_DATA_ACK      0x50
+#define TW_MR_DATA_NACK     0x58
+#define TW_STATUS_MASK      0xf8
+
+// Writing TWINT clears it, which is what sets the TWI going on the next step.
+#define TWCR_NEXT  (_BV(TWINT) | _BV(TWEN) | _BV(TWIE))
+
+I2CTransaction* volatile I2CQueue::_head = NULL;
+I2CTransaction* volatile I2CQueue::_tail = NULL;
+uint8_t I2CQueue::_index = 0;
+
+// Whether the transaction on the bus is in its read part.
+static bool reading;
+
+void I2CQueue::begin(uint32_t frequency)
+{
+#ifdef __AVR__
+  // The internal pullups, as Wire has them.
+  digitalWrite(SDA, HIGH);
+  digitalWrite(SCL, HIGH);
+#endif
+
+  TWSR = 0;   // No prescaler
+  TWBR = ((F_CPU / frequency) - 16) / 2;
+  TWCR = _BV(TWEN) | _BV(TWIE);
+}
+
+bool I2CQueue::submit(I2CTransaction* t)
+{
+  if (t->busy())
+    return false;
+
+  t->status = I2C_QUEUED;
+  t->next = NULL;
+
+  uint8_t sreg = SREG;
+  cli();
+  if (_head == NULL) {
+    _head = _tail = t;
+    start();
+  }
+  else {
+    _tail->next = t;
+    _tail = t;
+  }
+  SREG = sreg;
+  return true;
+}
+
+uint8_t I2CQueue::wait(const I2CTransaction* t)
+{
+  while (t->busy()) {
+#ifndef __AVR__
+    i2c_idle();
+#endif
+  }
+  return t->status;
+}
+
+/**
+ * Put the transaction at the head of the queue on the bus.
+ */
+void I2CQueue::start()
+{
+  _head->status = I2C_BUSY;
+  _index = 0;
+  reading = _head->out_length == 0 && _head->in_length > 0;
+
+  // The stop ending the last transaction has to be out first.
+  while (TWCR & _BV(TWSTO))
+    ;
+  TWCR = TWCR_NEXT | _BV(TWSTA);
+}
+
+/**
+ * End the transaction at the head of the queue, and start the next.
+ */
+void I2CQueue::finish(uint8_t status)
+{
+  TWCR = TWCR_NEXT | _BV(TWSTO);
+
+  I2CTransaction* t = _head;
+  _head = t->next;
+  if (_head == NULL)
+    _tail = NULL;
+  else
+    start();
+
+  // Last, so that a transaction submitted from the callback queues up
+  // behind the rest.
+  t->status = status;
+  if (t->callback)
+    t->callback(t);
+}
+
+void I2CQueue::interrupt()
+{
+  I2CTransaction* t = _head;
+  if (t == NULL) {
+    TWCR = TWCR_NEXT | _BV(TWSTO);
+    return;
+  }
+
+  switch (TWSR & TW_STATUS_MASK) {
+  case TW_START:
+  case TW_REP_START:
+    TWDR = (t->address << 1) | (reading ? 1 : 0);
+    TWCR = TWCR_NEXT;
+    break;
+
+  case TW_MT_SLA_ACK:
+  case TW_MT_DATA_ACK:
+    if (_index < t->out_length) {
+      TWDR = t->out[_index++];
+      TWCR = TWCR_NEXT;
+    }
+    else if (t->in_length > 0) {
+      reading = true;
+      _index = 0;
+      TWCR = TWCR_NEXT | _BV(TWSTA);
+    }
+    else
+      finish(I2C_DONE);
+    break;
+
+  case TW_MR_SLA_ACK:
+    // Acknowledge every byte but the last.
+    TWCR = t->in_length > 1 ? TWCR_NEXT | _BV(TWEA) : TWCR_NEXT;
+    break;
+
+  case TW_MR_DATA_ACK:
+    t->in[_index++] = TWDR;
+    TWCR = _index + 1 < t->in_length ? TWCR_NEXT | _BV(TWEA) : TWCR_NEXT;
+    break;
+
+  case TW_MR_DATA_NACK:
+    t->in[_index++] = TWDR;
+    finish(I2C_DONE);
+    break;
+
+  case TW_MT_SLA_NACK:
+  case TW_MT_DATA_NACK:
+  case TW_MR_SLA_NACK:
+    finish(I2C_NACK);
+    break;
+
+  case TW_ARB_LOST:
+  default:
+    finish(I2C_ERROR);
+    break;
+  }
+}
+
+ISR(TWI_vect)
+{
+  I2CQueue::interrupt();
+}
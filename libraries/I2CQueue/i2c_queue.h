@@ -0,0 +1,123 @@
+#ifndef I2C_QUEUE_H__
+#define I2C_QUEUE_H__
+
+#include <Arduino.h>
+
+enum I2CStatus
+{
+  I2C_IDLE,       // never submitted
+  I2C_QUEUED,     // waiting for the transactions ahead of it
+  I2C_BUSY,       // on the bus
+  I2C_DONE,
+  I2C_NACK,       // the device didn't answer, or refused a byte
+  I2C_ERROR       // bus error
+};
+
+struct I2CTransaction;
+
+/**
+ * Called from the TWI interrupt when a transaction is over. It may submit
+ * more transactions, including the one it was called for.
+ */
+typedef void (*I2CCallback)(I2CTransaction* t);
+
+/**
+ * One transfer with a device: 'out_length' bytes from 'out', then, after a
+ * repeated start, 'in_length' bytes into 'in'. Either can be 0; with both 0
+ * the device is only addressed, which is how an EEPROM is polled for the end
+ * of a write.
+ *
+ * The descriptor and its buffers belong to the caller, and have to stay put
+ * until the transaction is over.
+ */
+struct I2CTransaction
+{
+  I2CTransaction()
+    : address(0), out(NULL), out_length(0), in(NULL), in_length(0),
+      callback(NULL), context(NULL), status(I2C_IDLE), next(NULL) { }
+
+  void set(uint8_t address, const uint8_t* out, uint8_t out_length,
+           uint8_t* in, uint8_t in_length) {
+    this->address = address;
+    this->out = out;
+    this->out_length = out_length;
+    this->in = in;
+    this->in_length = in_length;
+  }
+
+  bool busy() const {
+    return status == I2C_QUEUED || status == I2C_BUSY;
+  }
+
+  uint8_t address;
+  const uint8_t* out;
+  uint8_t out_length;
+  uint8_t* in;
+  uint8_t in_length;
+
+  I2CCallback callback;
+  void* context;
+
+  volatile uint8_t status;
+  I2CTransaction* volatile next;
+};
+
+/**
+ * Runs I2C transactions one after another from the TWI interrupt, so the
+ * code that submits them can get on with something else while they're on
+ * the bus: a transaction costs a few microseconds of interrupt time per
+ * byte, instead of the whole transfer time spent waiting in Wire.
+ *
+ * This takes over the TWI, so it can't be used alongside Wire.
+ */
+class I2CQueue
+{
+public:
+  static void begin(uint32_t frequency = 100000);
+
+  /**
+   * Add a transaction to the end of the queue. Returns false, and leaves it
+   * alone, if it's still in the queue from before.
+   */
+  static bool submit(I2CTransaction* t);
+
+  /**
+   * Wait for a transaction to be over, and return its status.
+   */
+  static uint8_t wait(const I2CTransaction* t);
+
+  /**
+   * Submit a transaction and wait for it.
+   */
+  static uint8_t run(I2CTransaction* t) {
+    if (!submit(t))
+      return I2C_ERROR;
+    return wait(t);
+  }
+
+  static bool idle() {
+    return _head == NULL;
+  }
+
+  /**
+   * The TWI interrupt.
+   */
+  static void interrupt();
+
+private:
+  static void start();
+  static void finish(uint8_t status);
+
+  static I2CTransaction* volatile _head;
+  static I2CTransaction* volatile _tail;
+  static uint8_t _index;
+};
+
+#ifndef __AVR__
+/**
+ * Called while waiting. The host simulation moves the bus along in it.
+ */
+void i2c_idle();
+#endif
+
+#endif
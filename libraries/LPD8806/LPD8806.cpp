@@ -68,11 +68,53 @@ a 'latch' anyway.
 #include "SPI.h"
 #include "LPD8806.h"
 
+LPD8806 * volatile LPD8806::asyncStrip = NULL;
+
+// True while the last byte written to SPDR was sent by polling, so SPIF has
+// to be waited on before writing the next one.  The SPI interrupt clears
+// SPIF by itself, so after a background show there's nothing to wait for.
+static volatile boolean spiPending = false;
+
+#ifdef LPD8806_AVR
+// Brightness scaling for a showAsync() without a second buffer to scale
+// into: done by the SPI interrupt, a byte at a time.
+static volatile uint8_t  asyncScale,     // 1-255, or 0 for none
+                         asyncThreshold, // Rounding for the next byte
+                         asyncStep;
+#endif
+
+// Bytes scaled at a time by show(), on the stack
+#define SCALE_CHUNK 24
+
+// Added to the rounding threshold from one byte to the next when
+// dithering, so neighbouring LEDs don't all round up on the same frames
+#define DITHER_STEP 0x9E
+
+// The host simulation counts each byte scaled (see extras/host).
+#ifndef LPD8806_SCALED
+#define LPD8806_SCALED()
+#endif
+
+// A byte from the pixel buffer, scaled by brightness + 1 (1-255; full
+// brightness is never scaled) and rounded up if the fraction left over is
+// at least 256 - t.  Latch bytes (0) stay 0.  Both factors fit in a byte,
+// so this is one 8x8 multiply.
+static inline uint8_t scaleByte(uint8_t b, uint8_t scale, uint8_t t) {
+  LPD8806_SCALED();
+  return b ? ((((b & 0x7f) * scale + t) >> 8) | 0x80) : 0;
+}
+
 /*****************************************************************************/
 
 // Constructor for use with hardware SPI (specific clock/data pins):
 LPD8806::LPD8806(uint16_t n) {
-  pixels = NULL;
+  pixels = backPixels = NULL;
+  ownsPixels = true;
+  brightness = 255;
+  dither = false;
+  ditherFrame = 0;
+  sendPtr = NULL;
+  sendCount = 0;
   begun  = false;
   updateLength(n);
   updatePins();
@@ -80,7 +122,13 @@ LPD8806::LPD8806(uint16_t n) {
 
 // Constructor for use with arbitrary clock/data pins:
 LPD8806::LPD8806(uint16_t n, uint8_t dpin, uint8_t cpin) {
-  pixels = NULL;
+  pixels = backPixels = NULL;
+  ownsPixels = true;
+  brightness = 255;
+  dither = false;
+  ditherFrame = 0;
+  sendPtr = NULL;
+  sendCount = 0;
   begun  = false;
   updateLength(n);
   updatePins(dpin, cpin);
@@ -93,7 +141,13 @@ LPD8806::LPD8806(uint16_t n, uint8_t dpin, uint8_t cpin) {
 // and updatePins() to establish the strip length and output pins!
 LPD8806::LPD8806(void) {
   numLEDs = numBytes = 0;
-  pixels  = NULL;
+  pixels  = backPixels = NULL;
+  ownsPixels = true;
+  brightness = 255;
+  dither = false;
+  ditherFrame = 0;
+  sendPtr = NULL;
+  sendCount = 0;
   begun   = false;
   updatePins(); // Must assume hardware SPI until pins are set
 }
@@ -134,7 +188,10 @@ void LPD8806::updatePins(uint8_t dpin, uint8_t cpin) {
 
   if(begun == true) { // If begin() was previously invoked...
     // If previously using hardware SPI, turn that off:
-    if(hardwareSPI == true) SPI.end();
+    if(hardwareSPI == true) {
+      wait();
+      SPI.end();
+    }
     startBitbang(); // Regardless, now enable 'soft' SPI outputs
   } // Otherwise, pins are not set to outputs until begin() is called.
 
@@ -162,11 +219,13 @@ void LPD8806::startSPI(void) {
 #if defined(__AVR_ATmega168__) || defined(__AVR_ATmega328P__) || defined (__AVR_ATmega328__) || defined(__AVR_ATmega8__) || (__AVR_ATmega1281__) || defined(__AVR_ATmega2561__) || defined(__AVR_ATmega2560__) || defined(__AVR_ATmega1280__)
 
   // Issue initial latch/reset to strip:
+  wait();
   SPDR = 0; // Issue initial byte
   for(uint16_t i=((numLEDs+31)/32)-1; i>0; i--) {
     while(!(SPSR & (1<<SPIF))); // Wait for prior byte out
     SPDR = 0;                   // Issue next byte
   }
+  spiPending = true;
 #else
   SPI.transfer(0);
   for(uint16_t i=((numLEDs+31)/32)-1; i>0; i--) {
@@ -199,13 +258,21 @@ void LPD8806::startBitbang() {
 // Change strip length (see notes with empty constructor, above):
 void LPD8806::updateLength(uint16_t n) {
   uint8_t latchBytes = (n + 31) / 32;
-  if(pixels != NULL) free(pixels); // Free existing data (if any)
+  boolean doubled = (backPixels != NULL);
+  wait(); // Can't free a buffer that's still going out
+  if(pixels != NULL && ownsPixels) free(pixels); // Free existing data (if any)
+  ownsPixels = true; // An attached buffer is dropped, not resized
+  if(doubled) {
+    free(backPixels);
+    backPixels = NULL;
+  }
   numLEDs    = n;
+  numBytes   = bufferSize(n);
   n         *= 3; // 3 bytes per pixel
-  numBytes   = n + latchBytes;
   if(NULL != (pixels = (uint8_t *)malloc(numBytes))) { // Alloc new data
     memset( pixels   , 0x80, n);          // Init to RGB 'off' state
     memset(&pixels[n], 0   , latchBytes); // Clear latch bytes
+    if(doubled) doubleBuffer(true);
   } else numLEDs = numBytes = 0; // else malloc failed
   // 'begun' state does not change -- pins retain prior modes
 }
@@ -214,48 +281,299 @@ uint16_t LPD8806::numPixels(void) {
   return numLEDs;
 }
 
+// Size of the buffer for n LEDs: 3 bytes each, then the latch
+uint16_t LPD8806::bufferSize(uint16_t n) {
+  return n * 3 + (n + 31) / 32;
+}
+
+// The buffer show() sends: numPixels() LEDs of 3 bytes in GRB order, each
+// with the high bit set, then the latch.  Effects can draw straight into it.
+uint8_t *LPD8806::getPixels(void) {
+  return pixels;
+}
+
+// Send from a buffer the sketch owns, of at least bufferSize(numPixels())
+// bytes, instead of allocating one; the color bytes are used as they are,
+// and the latch bytes are cleared.  Returns false (and changes nothing) if
+// the buffer is too small.  Turns off doubleBuffer(); updateLength() goes
+// back to a buffer of the strip's own.
+boolean LPD8806::attachBuffer(uint8_t *buf, uint16_t size) {
+  if(buf == NULL || size < numBytes) return false;
+  wait();
+  doubleBuffer(false);
+  if(pixels != NULL && ownsPixels) free(pixels);
+  pixels     = buf;
+  ownsPixels = false;
+  memset(&pixels[numLEDs * 3], 0, numBytes - numLEDs * 3); // Latch
+  return true;
+}
+
+// Make buf the attached buffer (see attachBuffer()), and hand back the one
+// it replaces, or NULL if buf is too small or the strip's own buffer is in
+// use.  Only pointers change, so a sketch can draw into one buffer while
+// another is shown.  After showAsync(), the buffer handed back is still
+// going out until busy() is false.
+uint8_t *LPD8806::swapBuffer(uint8_t *buf, uint16_t size) {
+  if(buf == NULL || size < numBytes || ownsPixels) return NULL;
+  uint8_t *old = pixels;
+  memset(&buf[numLEDs * 3], 0, numBytes - numLEDs * 3); // Latch
+  pixels = buf;
+  return old;
+}
+
 // This is how data is pushed to the strip.  Unfortunately, the company
 // that makes the chip didnt release the protocol document or you need
 // to sign an NDA or something stupid like that, but we reverse engineered
 // this from a strip controller and it seems to work very nicely!
 void LPD8806::show(void) {
-  uint8_t  *ptr = pixels;
-  uint16_t i    = numBytes;
+#ifdef LPD8806_AVR
+  wait(); // Let any background show finish first
+#endif
+  if(brightness == 255) {
+    send(pixels, numBytes);
+    return;
+  }
+
+  uint8_t step, t = scaleStart(&step), scale = brightness + 1;
+  const uint8_t *ptr = pixels;
+#ifdef LPD8806_AVR
+  if(hardwareSPI) {
+    // Scale each byte while the one before it shifts out, as the SPI
+    // interrupt does for showAsync()
+    if(numBytes == 0) return;
+    uint8_t next = scaleByte(*ptr++, scale, t);
+    if(spiPending) while(!(SPSR & (1<<SPIF)));
+    SPDR = next;
+    for(uint16_t i=numBytes-1; i>0; i--) {
+      t   += step;
+      next = scaleByte(*ptr++, scale, t);
+      while(!(SPSR & (1<<SPIF))); // Wait for prior byte out
+      SPDR = next;
+    }
+    spiPending = true;
+    return;
+  }
+#endif
+
+  // Scale a piece at a time into a scratch buffer, and send that
+  uint8_t chunk[SCALE_CHUNK];
+  for(uint16_t i=numBytes; i>0; ) {
+    uint8_t n = (i < SCALE_CHUNK) ? i : SCALE_CHUNK;
+    for(uint8_t k=0; k<n; k++, t+=step) chunk[k] = scaleByte(*ptr++, scale, t);
+    send(chunk, n);
+    i -= n;
+  }
+}
 
+// Send bytes from the pixel buffer, or a scaled copy of part of it.
+void LPD8806::send(uint8_t *ptr, uint16_t i) {
   // This doesn't need to distinguish among individual pixel color
   // bytes vs. latch data, etc.  Everything is laid out in one big
   // flat buffer and issued the same regardless of purpose.
   if(hardwareSPI) {
-    while(i--) {
-#if defined(__AVR_ATmega168__) || defined(__AVR_ATmega328P__) || defined (__AVR_ATmega328__) || defined(__AVR_ATmega8__) || (__AVR_ATmega1281__) || defined(__AVR_ATmega2561__) || defined(__AVR_ATmega2560__) || defined(__AVR_ATmega1280__)
+#ifdef LPD8806_AVR
+    if(i == 0) return;
+    if(spiPending) while(!(SPSR & (1<<SPIF)));
+    SPDR = *ptr++; // Issue first byte
+    while(--i) {
       while(!(SPSR & (1<<SPIF))); // Wait for prior byte out
       SPDR = *ptr++;              // Issue new byte
+    }
+    spiPending = true;
 #else
+ #ifdef SPI_HAS_TRANSACTION
+    // transfer() overwrites the buffer with whatever comes back, so send
+    // a copy of the pixels, in one batch; a scaled copy can go as it is.
+    if(ptr != pixels) {
+      SPI.transfer(ptr, i);
+      return;
+    }
+    if(backPixels != NULL) {
+      memcpy(backPixels, pixels, numBytes);
+      SPI.transfer(backPixels, numBytes);
+      return;
+    }
+ #endif
+    while(i--) {
       SPI.transfer(*ptr++);
-#endif
     }
+#endif
+  } else if(dataport != 0) {
+    bitbangPorts(ptr, i);
   } else {
+    // can't do low level bitbanging, revert to digitalWrite
     uint8_t p, bit;
 
     while(i--) {
       p = *ptr++;
       for(bit=0x80; bit; bit >>= 1) {
-	if (dataport != 0) {
-	  if(p & bit) *dataport |=  datapinmask;
-	  else        *dataport &= ~datapinmask;
-	  *clkport |=  clkpinmask;
-	  *clkport &= ~clkpinmask;
-	} else {
-	  if (p&bit) digitalWrite(datapin, HIGH);
-	  else digitalWrite(datapin, LOW);
-	  digitalWrite(clkpin, HIGH);
-	  digitalWrite(clkpin, LOW);
-	}
+	digitalWrite(datapin, (p & bit) ? HIGH : LOW);
+	digitalWrite(clkpin, HIGH);
+	digitalWrite(clkpin, LOW);
       }
     }
   }
 }
 
+// Soft SPI through the PORT registers.  The register values for data high,
+// data low and the clock are worked out once, so each bit is just stores,
+// with no read-modify-write; and each byte is unrolled.  This means other
+// pins on the same PORTs mustn't be changed from an interrupt meanwhile.
+void LPD8806::bitbangPorts(const uint8_t *ptr, uint16_t i) {
+  uint8_t p, dataHi, dataLo;
+
+  if(clkport == dataport) {
+    // Both on one PORT: data first, then clock high and low around it
+    dataLo = *dataport & ~(datapinmask | clkpinmask);
+    dataHi = dataLo | datapinmask;
+    uint8_t v;
+
+#define LPD8806_BIT(b)                   \
+    v = (p & (b)) ? dataHi : dataLo;     \
+    *dataport = v;                       \
+    *dataport = v | clkpinmask;          \
+    *dataport = v;
+
+    while(i--) {
+      p = *ptr++;
+      LPD8806_BIT(0x80) LPD8806_BIT(0x40) LPD8806_BIT(0x20) LPD8806_BIT(0x10)
+      LPD8806_BIT(0x08) LPD8806_BIT(0x04) LPD8806_BIT(0x02) LPD8806_BIT(0x01)
+    }
+#undef LPD8806_BIT
+  } else {
+    uint8_t clkHi, clkLo;
+    dataLo = *dataport & ~datapinmask;
+    dataHi = dataLo | datapinmask;
+    clkLo  = *clkport & ~clkpinmask;
+    clkHi  = clkLo | clkpinmask;
+
+#define LPD8806_BIT(b)                           \
+    *dataport = (p & (b)) ? dataHi : dataLo;     \
+    *clkport  = clkHi;                           \
+    *clkport  = clkLo;
+
+    while(i--) {
+      p = *ptr++;
+      LPD8806_BIT(0x80) LPD8806_BIT(0x40) LPD8806_BIT(0x20) LPD8806_BIT(0x10)
+      LPD8806_BIT(0x08) LPD8806_BIT(0x04) LPD8806_BIT(0x02) LPD8806_BIT(0x01)
+    }
+#undef LPD8806_BIT
+  }
+}
+
+// Push the strip out through the SPI transfer complete interrupt, one byte
+// per interrupt, and return right away.  Don't change the pixels until
+// busy() is false, unless double buffering is on: then the frame goes out
+// from the second buffer, and drawing carries on in a copy of it.  Falls
+// back to show() without hardware SPI on an AVR.
+void LPD8806::showAsync(void) {
+#ifdef LPD8806_AVR
+  if(!hardwareSPI || numBytes == 0) {
+    show();
+    return;
+  }
+
+  wait(); // One background show at a time; there's only the one SPI
+
+  uint8_t  step = 0, t = 0;
+  uint8_t  scale = 0; // Don't scale in the interrupt
+  const uint8_t *buf = pixels;
+  if(backPixels != NULL) {
+    if(brightness == 255) {
+      uint8_t *p = backPixels;
+      backPixels = pixels;
+      pixels     = p;
+    } else {
+      // The second buffer gets a scaled copy; nothing to swap
+      t = scaleStart(&step);
+      for(uint16_t i=0; i<numBytes; i++, t+=step)
+        backPixels[i] = scaleByte(pixels[i], brightness + 1, t);
+    }
+    buf = backPixels;
+  } else if(brightness != 255) {
+    t     = scaleStart(&step);
+    scale = brightness + 1;
+  }
+
+  if(spiPending) while(!(SPSR & (1<<SPIF)));
+  spiPending = false;
+  sendPtr    = buf + 1;
+  sendCount  = numBytes - 1;
+  asyncScale = scale;
+  asyncStep  = step;
+  asyncStrip = this;
+  if(scale) {
+    asyncThreshold = t + step;
+    SPDR = scaleByte(buf[0], scale, t);
+  } else {
+    SPDR = buf[0];
+  }
+  SPCR |= _BV(SPIE);
+
+  // Bring the drawing buffer up to date while the frame goes out
+  if(backPixels != NULL && brightness == 255)
+    memcpy(pixels, backPixels, numBytes);
+#else
+  show();
+#endif
+}
+
+boolean LPD8806::busy(void) {
+  return asyncStrip == this;
+}
+
+void LPD8806::wait(void) {
+  while(asyncStrip != NULL);
+}
+
+// Allocate (or free) the second buffer used by showAsync().  Returns false
+// if there isn't enough memory for it.
+boolean LPD8806::doubleBuffer(boolean on) {
+  wait();
+  if(on && !ownsPixels) return false; // Swap attached buffers instead
+  if(!on) {
+    if(backPixels != NULL) free(backPixels);
+    backPixels = NULL;
+    return true;
+  }
+
+  if(backPixels == NULL && numBytes > 0) {
+    if(NULL == (backPixels = (uint8_t *)malloc(numBytes))) return false;
+    memcpy(backPixels, pixels, numBytes);
+  }
+  return backPixels != NULL;
+}
+
+void LPD8806::spiInterrupt(void) {
+  LPD8806 *s = asyncStrip;
+  if(s == NULL) return;
+
+#ifdef LPD8806_AVR
+  uint16_t n = s->sendCount;
+  if(n > 0) {
+    const uint8_t *p = s->sendPtr;
+    if(asyncScale) {
+      uint8_t t = asyncThreshold;
+      SPDR = scaleByte(*p++, asyncScale, t);
+      asyncThreshold = t + asyncStep;
+    } else {
+      SPDR = *p++;
+    }
+    s->sendPtr   = p;
+    s->sendCount = n - 1;
+  } else {
+    SPCR      &= ~_BV(SPIE);
+    asyncStrip = NULL;
+  }
+#endif
+}
+
+#ifdef LPD8806_AVR
+ISR(SPI_STC_vect) {
+  LPD8806::spiInterrupt();
+}
+#endif
+
 // Convert separate R,G,B into combined 32-bit GRB color:
 uint32_t LPD8806::Color(byte r, byte g, byte b) {
   return ((uint32_t)(g | 0x80) << 16) |
@@ -283,6 +601,130 @@ void LPD8806::setPixelColor(uint16_t n, uint32_t c) {
   }
 }
 
+// Scale every color by (b + 1) / 256 as it goes out, without touching the
+// pixels: 255 (the default) is full brightness, and costs nothing.
+void LPD8806::setBrightness(uint8_t b) {
+  brightness = b;
+}
+
+uint8_t LPD8806::getBrightness(void) {
+  return brightness;
+}
+
+// With brightness scaling, round each color up or down from one show to
+// the next, in proportion to what's lost, instead of to the nearest: over
+// 16 shows, it averages out to the exact scaled color.  This gives dim
+// colors and slow fades the in-between levels 7 bits don't have.
+void LPD8806::setDither(boolean on) {
+  dither = on;
+}
+
+// The rounding threshold for the first byte of this show, and in 'step',
+// how much it goes up for each byte after.
+uint8_t LPD8806::scaleStart(uint8_t *step) {
+  if(!dither) {
+    *step = 0;
+    return 0x80; // Nearest
+  }
+  // Bit-reversed frame count: each 16 shows go through 16 even steps
+  uint8_t f = ditherFrame++ & 0x0f;
+  f = ((f & 1) << 3) | ((f & 2) << 1) | ((f & 4) >> 1) | ((f & 8) >> 3);
+  *step = DITHER_STEP;
+  return (f << 4) | 0x08;
+}
+
+LPD8806GRB LPD8806::encode(byte r, byte g, byte b) {
+  LPD8806GRB c;
+  c.g = g | 0x80;
+  c.r = r | 0x80;
+  c.b = b | 0x80;
+  return c;
+}
+
+LPD8806GRB LPD8806::encode(uint32_t c) {
+  return encode(c >> 8, c >> 16, c);
+}
+
+// Number of pixels from 'start' that are on the strip, at most 'count'
+uint16_t LPD8806::clip(uint16_t start, uint16_t count) {
+  if(start >= numLEDs) return 0;
+  return (count < numLEDs - start) ? count : numLEDs - start;
+}
+
+// Set 'count' pixels from 'start' to one color:
+void LPD8806::fill(uint16_t start, uint16_t count, LPD8806GRB c) {
+  uint8_t *p = &pixels[start * 3];
+  for(count = clip(start, count); count > 0; count--) {
+    *p++ = c.g;
+    *p++ = c.r;
+    *p++ = c.b;
+  }
+}
+
+void LPD8806::fill(uint16_t start, uint16_t count, uint32_t c) {
+  fill(start, count, encode(c));
+}
+
+// One color of a gradient, a pixel at a time: after i steps it's
+// from + (to - from) * i / steps, rounded, with the remainder carried
+// instead of dividing each time, so the last pixel is exactly 'to'.
+struct LPD8806Ramp {
+  uint8_t  value, step, rem;
+  boolean  up;
+  uint16_t err, steps;
+
+  LPD8806Ramp(uint8_t from, uint8_t to, uint16_t n) {
+    uint8_t d;
+    value = from & 0x7f;
+    to   &= 0x7f;
+    up    = (to >= value);
+    d     = up ? to - value : value - to;
+    step  = d / n;
+    rem   = d % n;
+    err   = n / 2; // Round to nearest
+    steps = n;
+  }
+
+  // This pixel's byte, then on to the next
+  uint8_t next(void) {
+    uint8_t v = value | 0x80, s = step;
+    err += rem;
+    if(err >= steps) {
+      err -= steps;
+      s++;
+    }
+    value = up ? value + s : value - s;
+    return v;
+  }
+};
+
+// Fade linearly from one color to another over 'count' pixels; the first
+// is 'from' and the last is 'to':
+void LPD8806::gradient(uint16_t start, uint16_t count,
+                       LPD8806GRB from, LPD8806GRB to) {
+  if(count == 0) return;
+  uint16_t n = clip(start, count), steps = (count > 1) ? count - 1 : 1;
+  LPD8806Ramp g(from.g, to.g, steps), r(from.r, to.r, steps),
+              b(from.b, to.b, steps);
+  uint8_t *p = &pixels[start * 3];
+  while(n--) {
+    *p++ = g.next();
+    *p++ = r.next();
+    *p++ = b.next();
+  }
+}
+
+// Copy 'count' pixels in to the buffer from 'start', as they'll be sent:
+// GRB, with the high bits already set.
+void LPD8806::writePixels(uint16_t start, const uint8_t *grb, uint16_t count) {
+  memcpy(&pixels[start * 3], grb, clip(start, count) * 3);
+}
+
+void LPD8806::writePixels(uint16_t start, const LPD8806GRB *grb,
+                          uint16_t count) {
+  writePixels(start, (const uint8_t *)grb, count);
+}
+
 // Query color from previously-set pixel (returns packed 32-bit GRB value)
 uint32_t LPD8806::getPixelColor(uint16_t n) {
   if(n < numLEDs) {
@@ -1,3 +1,6 @@
+#ifndef LPD8806_H
+#define LPD8806_H
+
 #if (ARDUINO >= 100)
  #include <Arduino.h>
 #else
@@ -5,6 +8,27 @@
  #include <pins_arduino.h>
 #endif
 
+// AVRs whose PORT and SPI registers are driven directly, rather than
+// through digitalWrite() and SPI.transfer():
+#if defined(__AVR_ATmega168__) || defined(__AVR_ATmega328P__) || defined (__AVR_ATmega328__) || defined(__AVR_ATmega8__) || (__AVR_ATmega1281__) || defined(__AVR_ATmega2561__) || defined(__AVR_ATmega2560__) || defined(__AVR_ATmega1280__)
+ #define LPD8806_AVR
+#endif
+
+// Pin PORT registers, as returned by portOutputRegister().  A host-side
+// simulation (see extras/host) can swap in a class that watches the pins.
+#ifdef LPD8806_PORT_TYPE
+typedef LPD8806_PORT_TYPE PortReg;
+#else
+typedef volatile uint8_t PortReg;
+#endif
+
+// A color as it goes out to the strip, and as it's kept in the pixel
+// buffer: GRB order, 7 bits each with the high bit set.  It can be copied
+// straight into the buffer.
+typedef struct {
+  uint8_t g, r, b;
+} LPD8806GRB;
+
 class LPD8806 {
 
  public:
@@ -15,16 +39,42 @@ class LPD8806 {
   void
     begin(void),
     show(void),
+    showAsync(void), // Start show() in the background (hardware SPI)
+    wait(void),      // Wait for a background show to finish
     setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b),
     setPixelColor(uint16_t n, uint32_t c),
+    fill(uint16_t start, uint16_t count, LPD8806GRB c),
+    fill(uint16_t start, uint16_t count, uint32_t c),
+    gradient(uint16_t start, uint16_t count, LPD8806GRB from, LPD8806GRB to),
+    writePixels(uint16_t start, const uint8_t *grb, uint16_t count),
+    writePixels(uint16_t start, const LPD8806GRB *grb, uint16_t count),
+    setBrightness(uint8_t b),    // Scale colors on the way out; 255 = full
+    setDither(boolean on),       // Dither the scaled colors over time
     updatePins(uint8_t dpin, uint8_t cpin), // Change pins, configurable
     updatePins(void),                       // Change pins, hardware SPI
     updateLength(uint16_t n);               // Change strip length
   uint16_t
     numPixels(void);
+  static uint16_t
+    bufferSize(uint16_t n);      // Bytes of GRB + latch for n LEDs
+  uint8_t
+    getBrightness(void),
+    *getPixels(void),            // The buffer show() sends
+    *swapBuffer(uint8_t *buf, uint16_t size); // Send from buf instead
+  boolean
+    busy(void),                  // True while a background show is running
+    doubleBuffer(boolean on),    // Keep a second buffer for showAsync()
+    attachBuffer(uint8_t *buf, uint16_t size); // Use the caller's buffer
   uint32_t
     Color(byte, byte, byte),
     getPixelColor(uint16_t n);
+  static LPD8806GRB
+    encode(byte r, byte g, byte b), // 7-bit R, G, B
+    encode(uint32_t c);             // Packed GRB, as from Color()
+
+  // Called from the SPI transfer complete interrupt; not for sketches.
+  static void
+    spiInterrupt(void);
 
  private:
 
@@ -33,14 +83,34 @@ class LPD8806 {
     numBytes;   // Size of 'pixels' buffer below
   uint8_t
     *pixels,    // Holds LED color values (3 bytes each) + latch
+    *backPixels, // Buffer being sent by showAsync() when double buffering
     clkpin    , datapin,     // Clock & data pin numbers
     clkpinmask, datapinmask; // Clock & data PORT bitmasks
-  volatile uint8_t
+  PortReg
     *clkport  , *dataport;   // Clock & data PORT registers
+  uint16_t
+    clip(uint16_t start, uint16_t count);
+  uint8_t
+    brightness,  // Scale for show(), less one: 255 = full
+    ditherFrame; // Counts shows, for dithering
+  uint8_t
+    scaleStart(uint8_t *step);
   void
+    send(uint8_t *ptr, uint16_t i),
     startBitbang(void),
-    startSPI(void);
+    startSPI(void),
+    bitbangPorts(const uint8_t *ptr, uint16_t i);
+  const uint8_t
+    * volatile sendPtr; // Next byte for the SPI interrupt to send
+  volatile uint16_t
+    sendCount;  // Bytes left for the SPI interrupt to send
+  static LPD8806 * volatile
+    asyncStrip; // Strip the SPI interrupt is sending
   boolean
+    ownsPixels,  // If 'false', 'pixels' belongs to the sketch
+    dither,      // If 'true', dither brightness scaling over time
     hardwareSPI, // If 'true', using hardware SPI
     begun;       // If 'true', begin() method was previously invoked
 };
+
+#endif // LPD8806_H
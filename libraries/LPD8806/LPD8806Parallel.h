@@ -0,0 +1,243 @@
+#ifndef LPD8806_PARALLEL_H
+#define LPD8806_PARALLEL_H
+
+#include "LPD8806.h"
+
+// Up to 8 strips of the same length, sharing one clock pin, with each data
+// pin on a different bit of one PORT.  Each clock edge sends a bit to every
+// strip at once: for each byte position, the bytes for all the strips are
+// transposed 8x8 so that PORT write k holds bit k of every strip's byte.
+// A show takes as many clock pulses as one strip would on its own, plus the
+// transposing, instead of N times as many; and no extra hardware.
+//
+// Pixels are addressed by strip, then by position along the strip, in the
+// same packed GRB colors as LPD8806.  If the data pins aren't all on one
+// PORT (or there are no PORT registers, off the AVR), show() falls back to
+// digitalWrite(), still sending to every strip on each clock pulse.
+
+static inline void lpd8806Transpose8(const uint8_t *in, uint8_t *out) {
+  // Hacker's Delight 7-3: out[i] bit 7-j is in[j] bit 7-i
+  uint32_t x, y, t;
+
+  x = ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) |
+      ((uint32_t)in[2] <<  8) |            in[3];
+  y = ((uint32_t)in[4] << 24) | ((uint32_t)in[5] << 16) |
+      ((uint32_t)in[6] <<  8) |            in[7];
+
+  t = (x ^ (x >> 7)) & 0x00AA00AA;  x = x ^ t ^ (t << 7);
+  t = (y ^ (y >> 7)) & 0x00AA00AA;  y = y ^ t ^ (t << 7);
+
+  t = (x ^ (x >> 14)) & 0x0000CCCC; x = x ^ t ^ (t << 14);
+  t = (y ^ (y >> 14)) & 0x0000CCCC; y = y ^ t ^ (t << 14);
+
+  t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);
+  y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+  x = t;
+
+  out[0] = x >> 24; out[1] = x >> 16; out[2] = x >> 8; out[3] = x;
+  out[4] = y >> 24; out[5] = y >> 16; out[6] = y >> 8; out[7] = y;
+}
+
+template<uint8_t N>
+class LPD8806Parallel {
+
+  static_assert(N >= 1 && N <= 8, "one PORT drives at most 8 strips");
+
+ public:
+
+  // dpins[s] is the data pin for strip s
+  LPD8806Parallel(uint16_t n, const uint8_t *dpins, uint8_t cpin) {
+    numLEDs = numBytes = 0;
+    pixels  = NULL;
+    updateLength(n);
+    updatePins(dpins, cpin);
+  }
+
+  ~LPD8806Parallel() {
+    if(pixels != NULL) free(pixels);
+  }
+
+  // The pixels belong to this object alone; a copy would free them twice
+  LPD8806Parallel(const LPD8806Parallel&) = delete;
+  LPD8806Parallel& operator=(const LPD8806Parallel&) = delete;
+
+  // Set the pins to outputs and latch whatever the strips last had
+  void begin(void) {
+    for(uint8_t s=0; s<N; s++) pinMode(datapins[s], OUTPUT);
+    pinMode(clkpin, OUTPUT);
+    show();
+  }
+
+  void show(void) {
+    if(dataport != 0) showPorts();
+    else              showPins();
+  }
+
+  void setPixelColor(uint8_t strip, uint16_t n,
+                     uint8_t r, uint8_t g, uint8_t b) {
+    if(strip < N && n < numLEDs) {
+      uint8_t *p = &pixels[strip * numBytes + n * 3];
+      *p++ = g | 0x80; // GRB, as LPD8806
+      *p++ = r | 0x80;
+      *p++ = b | 0x80;
+    }
+  }
+
+  // Set pixel color from 'packed' 32-bit GRB value, as LPD8806::Color()
+  void setPixelColor(uint8_t strip, uint16_t n, uint32_t c) {
+    if(strip < N && n < numLEDs) {
+      uint8_t *p = &pixels[strip * numBytes + n * 3];
+      *p++ = (c >> 16) | 0x80;
+      *p++ = (c >>  8) | 0x80;
+      *p++ =  c        | 0x80;
+    }
+  }
+
+  uint32_t getPixelColor(uint8_t strip, uint16_t n) {
+    if(strip < N && n < numLEDs) {
+      const uint8_t *p = &pixels[strip * numBytes + n * 3];
+      return ((uint32_t)(p[0] & 0x7f) << 16) |
+             ((uint32_t)(p[1] & 0x7f) <<  8) |
+              (uint32_t)(p[2] & 0x7f);
+    }
+    return 0;
+  }
+
+  uint32_t Color(byte r, byte g, byte b) {
+    return ((uint32_t)(g | 0x80) << 16) |
+           ((uint32_t)(r | 0x80) <<  8) |
+                       b | 0x80 ;
+  }
+
+  uint16_t numPixels(void) {
+    return numLEDs;
+  }
+
+  uint8_t numStrips(void) {
+    return N;
+  }
+
+  // Change the length of every strip; the pixels are cleared
+  void updateLength(uint16_t n) {
+    if(pixels != NULL) free(pixels);
+    numLEDs  = n;
+    numBytes = n * 3;
+    latchBytes = (n + 31) / 32;
+    if(NULL != (pixels = (uint8_t *)malloc(N * numBytes))) {
+      memset(pixels, 0x80, N * numBytes); // RGB 'off'
+    } else numLEDs = numBytes = 0;
+  }
+
+  void updatePins(const uint8_t *dpins, uint8_t cpin) {
+    clkpin   = cpin;
+    dataport = clkport = 0;
+    datamask = clkpinmask = 0;
+    for(uint8_t s=0; s<N; s++) datapins[s] = dpins[s];
+
+#ifdef LPD8806_AVR
+    uint8_t port = digitalPinToPort(dpins[0]);
+    for(uint8_t s=0; s<N; s++) {
+      if(digitalPinToPort(dpins[s]) != port) return; // Use digitalWrite()
+      datamask |= digitalPinToBitMask(dpins[s]);
+    }
+    // Which strip is on each bit of the PORT, in the transposer's order
+    memset(stripForBit, 0xff, sizeof(stripForBit));
+    for(uint8_t s=0; s<N; s++) {
+      uint8_t mask = digitalPinToBitMask(dpins[s]), bit = 0;
+      while(mask >>= 1) bit++;
+      stripForBit[7 - bit] = s;
+    }
+    dataport   = portOutputRegister(port);
+    clkport    = portOutputRegister(digitalPinToPort(cpin));
+    clkpinmask = digitalPinToBitMask(cpin);
+#endif
+  }
+
+ private:
+
+  // All the strips through the PORT registers.  As LPD8806::bitbangPorts(),
+  // the register values are worked out before the loop, so other pins on
+  // these PORTs mustn't be changed from an interrupt while this runs.
+  void showPorts(void) {
+    if(clkport == dataport) sendPorts<true>();
+    else                    sendPorts<false>();
+  }
+
+  template<bool Shared> void sendPorts(void) {
+    uint8_t in[8], out[8], v;
+    uint8_t dataLo, clkHi = 0, clkLo = 0;
+
+    dataLo = *dataport & ~datamask;
+    if(Shared) dataLo &= ~clkpinmask;
+    else {
+      clkLo = *clkport & ~clkpinmask;
+      clkHi = clkLo | clkpinmask;
+    }
+
+    for(uint8_t k=0; k<8; k++) in[k] = 0;
+    for(uint16_t i=0; i<numBytes; i++) {
+      for(uint8_t k=0; k<8; k++)
+        if(stripForBit[k] != 0xff)
+          in[k] = pixels[stripForBit[k] * numBytes + i];
+      lpd8806Transpose8(in, out);
+
+      for(uint8_t b=0; b<8; b++) {
+        v = dataLo | out[b];
+        *dataport = v;
+        if(Shared) {
+          *dataport = v | clkpinmask;
+          *dataport = v;
+        } else {
+          *clkport = clkHi;
+          *clkport = clkLo;
+        }
+      }
+    }
+
+    // Latch: data low on every strip at once
+    *dataport = dataLo;
+    for(uint16_t i=latchBytes*8; i>0; i--) {
+      if(Shared) {
+        *dataport = dataLo | clkpinmask;
+        *dataport = dataLo;
+      } else {
+        *clkport = clkHi;
+        *clkport = clkLo;
+      }
+    }
+  }
+
+  // The strips share a clock, so even without the PORTs every strip gets
+  // its bit before each clock pulse.
+  void showPins(void) {
+    for(uint16_t i=0; i<numBytes; i++) {
+      for(uint8_t bit=0x80; bit; bit >>= 1) {
+        for(uint8_t s=0; s<N; s++)
+          digitalWrite(datapins[s],
+                       (pixels[s * numBytes + i] & bit) ? HIGH : LOW);
+        digitalWrite(clkpin, HIGH);
+        digitalWrite(clkpin, LOW);
+      }
+    }
+    for(uint8_t s=0; s<N; s++) digitalWrite(datapins[s], LOW);
+    for(uint16_t i=latchBytes*8; i>0; i--) {
+      digitalWrite(clkpin, HIGH);
+      digitalWrite(clkpin, LOW);
+    }
+  }
+
+  uint16_t
+    numLEDs,    // Number of RGB LEDs in each strip
+    numBytes,   // Bytes of color per strip (no latch; that's sent once)
+    latchBytes;
+  uint8_t
+    *pixels,    // N strips of numBytes, one after another
+    datapins[N],
+    stripForBit[8], // Strip on PORT bit 7-k, or 0xff
+    clkpin,
+    datamask, clkpinmask;
+  PortReg
+    *clkport, *dataport;
+};
+
+#endif // LPD8806_PARALLEL_H
@@ -0,0 +1,64 @@
+// Times show() on a strip with bit-banged pins and with hardware SPI, each
+// at full brightness and dimmed with dithering, and prints microseconds per
+// 100 LEDs for each.  Nothing needs to be connected.
+//
+// This also builds on a PC against the simulated pins in extras/host, with
+// timings from its estimated cycle costs.  From this directory, with port
+// registers (as on an AVR):
+//   g++ -O2 -D__AVR_ATmega2560__ -I../../extras/host -I../.. -o benchmark
+//     -include Arduino.h -x c++ benchmark.ino -x none ../../LPD8806.cpp
+//     ../../extras/host/host_sim.cpp ../../extras/host/sketch_main.cpp
+// and the same without -D__AVR_ATmega2560__ for the digitalWrite() fallback
+// other boards get.
+
+#include "LPD8806.h"
+#include "SPI.h"
+
+int nLEDs = 160;
+
+int dataPin  = 2;
+int clockPin = 3;
+
+const int runs = 20;
+
+LPD8806 strip = LPD8806(nLEDs, dataPin, clockPin);
+
+unsigned long timeShow() {
+  strip.show(); // Settle any latch bytes from begin()
+  unsigned long start = micros();
+  for(int i=0; i<runs; i++) strip.show();
+  return (micros() - start) / runs;
+}
+
+unsigned long timeDimmed() {
+  strip.setBrightness(100);
+  strip.setDither(true);
+  unsigned long us = timeShow();
+  strip.setBrightness(255);
+  strip.setDither(false);
+  return us;
+}
+
+void report(const char *name, unsigned long us) {
+  Serial.print(name);
+  Serial.print(": ");
+  Serial.print(us * 100 / nLEDs);
+  Serial.println(" us per 100 LEDs");
+}
+
+void setup() {
+  Serial.begin(9600);
+
+  strip.begin();
+  for(int i=0; i<nLEDs; i++) strip.setPixelColor(i, i, 127 - i % 128, 42);
+
+  report("bit-bang", timeShow());
+  report("bit-bang, dimmed and dithered", timeDimmed());
+
+  strip.updatePins(); // Hardware SPI
+  report("hardware SPI", timeShow());
+  report("hardware SPI, dimmed and dithered", timeDimmed());
+}
+
+void loop() {
+}
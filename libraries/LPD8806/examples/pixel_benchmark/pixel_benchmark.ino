@@ -0,0 +1,60 @@
+// Times setting every pixel of a strip one call at a time, against fill(),
+// writePixels() and gradient(), and prints microseconds per 100 LEDs for
+// each.  Nothing needs to be connected; show() is never called.
+//
+// Unlike examples/benchmark, this is all CPU time, which the simulation in
+// extras/host doesn't count, so run it on a board.
+
+#include "LPD8806.h"
+#include "SPI.h"
+
+int nLEDs = 160;
+
+const int runs = 50;
+
+LPD8806 strip = LPD8806(nLEDs, 2, 3);
+
+LPD8806GRB frame[160];
+
+void report(const char *name, unsigned long start) {
+  unsigned long us = (micros() - start) / runs;
+  Serial.print(name);
+  Serial.print(": ");
+  Serial.print(us * 100 / nLEDs);
+  Serial.println(" us per 100 LEDs");
+}
+
+void setup() {
+  Serial.begin(9600);
+
+  uint32_t    color   = strip.Color(20, 40, 60);
+  LPD8806GRB  encoded = LPD8806::encode(color);
+  for(int i=0; i<nLEDs; i++) frame[i] = LPD8806::encode(i, 127 - i % 128, 42);
+
+  unsigned long start = micros();
+  for(int n=0; n<runs; n++)
+    for(int i=0; i<nLEDs; i++) strip.setPixelColor(i, 20, 40, 60);
+  report("setPixelColor(r, g, b) loop", start);
+
+  start = micros();
+  for(int n=0; n<runs; n++)
+    for(int i=0; i<nLEDs; i++) strip.setPixelColor(i, color);
+  report("setPixelColor(c) loop", start);
+
+  start = micros();
+  for(int n=0; n<runs; n++) strip.fill(0, nLEDs, encoded);
+  report("fill()", start);
+
+  start = micros();
+  for(int n=0; n<runs; n++) strip.writePixels(0, frame, nLEDs);
+  report("writePixels()", start);
+
+  start = micros();
+  for(int n=0; n<runs; n++)
+    strip.gradient(0, nLEDs, LPD8806::encode(127, 0, 0),
+                   LPD8806::encode(0, 0, 127));
+  report("gradient()", start);
+}
+
+void loop() {
+}
@@ -0,0 +1,98 @@
+// Just enough of the Arduino core to build LPD8806.cpp (and its examples)
+// on a PC.  The pins, their PORT registers and the AVR SPI registers are
+// simulated in host_sim.cpp, which also keeps an estimate of the time in
+// CPU cycles.
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARDUINO 105
+#define F_CPU   16000000UL
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH     1
+#define LOW      0
+#define OUTPUT   1
+#define INPUT    0
+#define MSBFIRST 1
+
+#define _BV(b) (1 << (b))
+#define ISR(vector) extern "C" void vector(void)
+
+#define SPIF 7
+#define SPIE 7
+
+// Adds to the simulated time; the SPI transfer in progress finishes (and
+// maybe interrupts) as it passes.
+void simTick(uint32_t cycles);
+
+// A PORT register.  Each access costs what it would as avr-gcc code going
+// through a pointer, and the simulation sees every change to the pins.
+class SimPort {
+ public:
+  SimPort &operator=(int v);
+  SimPort &operator|=(int mask);
+  SimPort &operator&=(int mask);
+  operator uint8_t();
+  uint8_t value;
+};
+
+#define LPD8806_PORT_TYPE SimPort
+
+// Scaling a byte to the brightness is arithmetic, which the register
+// traffic doesn't show, so LPD8806.cpp reports each one.
+void simScaled(void);
+#define LPD8806_SCALED() simScaled()
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+uint8_t digitalPinToPort(uint8_t pin);
+uint8_t digitalPinToBitMask(uint8_t pin);
+SimPort *portOutputRegister(uint8_t port);
+
+unsigned long micros(void);
+unsigned long millis(void);
+void delay(unsigned long ms);
+
+class SimSerial {
+ public:
+  void
+    begin(unsigned long),
+    print(const char *s),
+    print(long n),
+    print(unsigned long n),
+    print(int n),
+    print(unsigned int n),
+    println(void);
+  template<class T> void println(T v) { print(v); println(); }
+};
+
+extern SimSerial Serial;
+
+struct SimSPDR {
+  SimSPDR &operator=(int b);
+  operator uint8_t();
+};
+
+struct SimSPSR {
+  operator uint8_t();
+};
+
+struct SimSPCR {
+  SimSPCR &operator|=(int v);
+  SimSPCR &operator&=(int v);
+  operator uint8_t();
+};
+
+extern SimSPDR SPDR;
+extern SimSPSR SPSR;
+extern SimSPCR SPCR;
+
+extern "C" void SPI_STC_vect(void);
+
+#endif
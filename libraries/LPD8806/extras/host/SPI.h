@@ -0,0 +1,28 @@
+// SPI library stand-in for the host simulation; the clock divider sets how
+// long the fake peripheral takes to shift out a byte.
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+#include <Arduino.h>
+
+#define SPI_MODE0       0
+#define SPI_CLOCK_DIV2  2
+#define SPI_CLOCK_DIV4  4
+#define SPI_CLOCK_DIV8  8
+#define SPI_CLOCK_DIV16 16
+
+class SimSPIClass {
+ public:
+  void
+    begin(void),
+    end(void),
+    setBitOrder(uint8_t),
+    setDataMode(uint8_t),
+    setClockDivider(uint8_t div);
+  uint8_t
+    transfer(uint8_t b);
+};
+
+extern SimSPIClass SPI;
+
+#endif
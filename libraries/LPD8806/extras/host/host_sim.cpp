@@ -0,0 +1,228 @@
+// Simulated pins, PORT registers and SPI peripheral for building LPD8806 on a
+// PC.  The cycle costs are estimates for avr-gcc code on a 16 MHz AVR, not
+// measurements, and only the register traffic and the brightness scaling
+// are counted: loop and branch overhead in the code under test isn't.
+
+#include <stdio.h>
+#include "host_sim.h"
+#include "SPI.h"
+
+#define PORT_WRITE_CYCLES    2  // st through a pointer
+#define PORT_READ_CYCLES     2  // ld through a pointer
+#define PIN_WRITE_CYCLES    56  // digitalWrite(), pin lookup and all
+#define POLL_CYCLES          3  // in/sbrs/rjmp around the SPIF loop
+#define SPDR_WRITE_CYCLES    4  // ld + out to SPDR, and the loop counter
+#define SPCR_CYCLES          3  // in/ori/out on SPCR
+#define ISR_CYCLES          80  // vector, register save/restore, reti
+#define HANDLER_CYCLES      20  // spiInterrupt() apart from the SPDR write
+#define SCALE_CYCLES        12  // ld, and/mul/add/ori in scaleByte()
+
+#define SIM_PORTS 10 // Pins 0-79
+
+uint32_t
+  simNow, simIdleCycles, simIsrCycles, simCollisions, simPortAccesses,
+  simPinWrites;
+bool
+  simShifting, simInIsr;
+uint8_t
+  simSent[SIM_SENT_LENGTH];
+uint16_t
+  simSentLength;
+
+SimSPDR SPDR;
+SimSPSR SPSR;
+SimSPCR SPCR;
+SimSPIClass SPI;
+SimSerial Serial;
+
+static SimPort
+  ports[SIM_PORTS];
+static uint32_t
+  doneAt,       // When the byte being shifted out is done
+  byteCycles = 64;
+static bool
+  spif, spie;
+static uint8_t
+  sending;
+
+// Soft SPI decoding
+static uint8_t
+  watchData = 0xff, watchClock = 0xff, lastClock, bits, shift;
+
+static void send(uint8_t b) {
+  if(simSentLength < SIM_SENT_LENGTH) simSent[simSentLength++] = b;
+}
+
+static bool pin(uint8_t p) {
+  return ports[p / 8].value & _BV(p % 8);
+}
+
+// Sample the data pin on each rising edge of the clock pin.
+static void pinsChanged(void) {
+  if(watchClock == 0xff) return;
+  uint8_t clock = pin(watchClock);
+  if(clock && !lastClock) {
+    shift = (shift << 1) | pin(watchData);
+    if(++bits == 8) {
+      send(shift);
+      bits = 0;
+    }
+  }
+  lastClock = clock;
+}
+
+// Only the AVR build of LPD8806 has an SPI interrupt.
+extern "C" void SPI_STC_vect(void) __attribute__((weak));
+
+static void runIsr(void) {
+  simInIsr = true;
+  spif     = false; // Cleared by the hardware on the way into the vector
+  simTick(ISR_CYCLES + HANDLER_CYCLES);
+  if(SPI_STC_vect) SPI_STC_vect();
+  simInIsr = false;
+}
+
+void simTick(uint32_t cycles) {
+  simNow += cycles;
+  if(simInIsr) simIsrCycles += cycles;
+  if(simShifting && simNow >= doneAt) {
+    simShifting = false;
+    spif        = true;
+    send(sending);
+  }
+  while(spif && spie && !simInIsr) runIsr();
+}
+
+void simScaled(void) {
+  simTick(SCALE_CYCLES);
+}
+
+void simResetCounts(void) {
+  simIdleCycles = simIsrCycles = simCollisions = 0;
+  simPortAccesses = simPinWrites = 0;
+  simSentLength = 0;
+  bits = 0;
+}
+
+void simWatchPins(uint8_t dpin, uint8_t cpin) {
+  watchData  = dpin;
+  watchClock = cpin;
+  lastClock  = pin(cpin);
+  bits       = 0;
+}
+
+SimPort &SimPort::operator=(int v) {
+  simPortAccesses++;
+  simTick(PORT_WRITE_CYCLES);
+  value = v;
+  pinsChanged();
+  return *this;
+}
+
+SimPort &SimPort::operator|=(int mask) {
+  return *this = uint8_t(*this) | mask;
+}
+
+SimPort &SimPort::operator&=(int mask) {
+  return *this = uint8_t(*this) & mask;
+}
+
+SimPort::operator uint8_t() {
+  simPortAccesses++;
+  simTick(PORT_READ_CYCLES);
+  return value;
+}
+
+void pinMode(uint8_t, uint8_t) { }
+
+void digitalWrite(uint8_t p, uint8_t value) {
+  simPinWrites++;
+  simTick(PIN_WRITE_CYCLES);
+  if(value) ports[p / 8].value |=  _BV(p % 8);
+  else      ports[p / 8].value &= ~_BV(p % 8);
+  pinsChanged();
+}
+
+uint8_t digitalPinToPort(uint8_t p) {
+  return p / 8 + 1; // 0 is NOT_A_PORT
+}
+
+uint8_t digitalPinToBitMask(uint8_t p) {
+  return _BV(p % 8);
+}
+
+SimPort *portOutputRegister(uint8_t port) {
+  return (port > 0 && port <= SIM_PORTS) ? &ports[port - 1] : NULL;
+}
+
+unsigned long micros(void) {
+  return simNow / (F_CPU / 1000000);
+}
+
+unsigned long millis(void) {
+  return simNow / (F_CPU / 1000);
+}
+
+void delay(unsigned long ms) {
+  simTick(ms * (F_CPU / 1000));
+}
+
+void SimSerial::begin(unsigned long) { }
+void SimSerial::print(const char *s) { fputs(s, stdout); }
+void SimSerial::print(long n) { printf("%ld", n); }
+void SimSerial::print(unsigned long n) { printf("%lu", n); }
+void SimSerial::print(int n) { printf("%d", n); }
+void SimSerial::print(unsigned int n) { printf("%u", n); }
+void SimSerial::println(void) { putchar('\n'); }
+
+SimSPDR &SimSPDR::operator=(int b) {
+  simTick(SPDR_WRITE_CYCLES);
+  if(simShifting) {
+    simCollisions++;
+    return *this;
+  }
+  simShifting = true;
+  spif        = false;
+  sending     = b;
+  doneAt      = simNow + byteCycles;
+  return *this;
+}
+
+SimSPDR::operator uint8_t() {
+  return 0;
+}
+
+SimSPSR::operator uint8_t() {
+  simTick(POLL_CYCLES);
+  if(!spif && !simInIsr) simIdleCycles += POLL_CYCLES;
+  return spif ? _BV(SPIF) : 0;
+}
+
+SimSPCR &SimSPCR::operator|=(int v) {
+  if(v & _BV(SPIE)) spie = true;
+  simTick(SPCR_CYCLES);
+  return *this;
+}
+
+SimSPCR &SimSPCR::operator&=(int v) {
+  if(!(v & _BV(SPIE))) spie = false;
+  simTick(SPCR_CYCLES);
+  return *this;
+}
+
+SimSPCR::operator uint8_t() {
+  return spie ? _BV(SPIE) : 0;
+}
+
+void SimSPIClass::begin(void) { }
+void SimSPIClass::end(void) { }
+void SimSPIClass::setBitOrder(uint8_t) { }
+void SimSPIClass::setDataMode(uint8_t) { }
+void SimSPIClass::setClockDivider(uint8_t div) { byteCycles = 8 * div; }
+
+// The SPI library's own transfer(), polling the same registers
+uint8_t SimSPIClass::transfer(uint8_t b) {
+  SPDR = b;
+  while(!(SPSR & _BV(SPIF)));
+  return 0;
+}
@@ -0,0 +1,28 @@
+// What the host simulation keeps track of, for the programs that drive it.
+#ifndef HOST_SIM_H
+#define HOST_SIM_H
+
+#include <Arduino.h>
+
+#define SIM_SENT_LENGTH 4096
+
+extern uint32_t
+  simNow,           // Cycles since the start
+  simIdleCycles,    // Cycles the main code spent waiting on SPIF
+  simIsrCycles,     // Cycles spent in the SPI interrupt
+  simCollisions,    // Bytes written to SPDR while another was going out
+  simPortAccesses,  // Reads and writes of PORT registers
+  simPinWrites;     // digitalWrite() calls
+extern bool
+  simShifting,      // The SPI is shifting out a byte
+  simInIsr;         // ...and this is the SPI interrupt
+extern uint8_t
+  simSent[SIM_SENT_LENGTH]; // Everything that went out, by SPI or pins
+extern uint16_t
+  simSentLength;
+
+void
+  simResetCounts(void),
+  simWatchPins(uint8_t dpin, uint8_t cpin); // Decode soft SPI on these
+
+#endif
@@ -0,0 +1,9 @@
+// Runs a sketch's setup() once, for building examples against the host
+// simulation.
+
+void setup(void);
+
+int main(void) {
+  setup();
+  return 0;
+}
@@ -0,0 +1,227 @@
+// Host-side regression checks for the LPD8806 library, on the simulated
+// pins in ../host.  Each check decodes what goes out on the data and clock
+// pins (or through the SPI) and compares it byte for byte with what the
+// strip should get.  Prints a line per check, and exits with 1 if any fails.
+//
+// Build and run from this directory:
+//   g++ -O2 -D__AVR_ATmega2560__ -I../host -o host_checks host_checks.cpp
+//     ../../LPD8806.cpp ../host/host_sim.cpp
+//   ./host_checks
+
+#include <stdio.h>
+#include "host_sim.h"
+#include "SPI.h"
+#include "../../LPD8806.h"
+#include "../../LPD8806Parallel.h"
+
+static bool report(const char *what, bool ok) {
+  printf("%-44s %s\n", what, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+// The bytes a strip of n LEDs should get for these colors: GRB with the
+// high bits set, then the latch.
+static uint16_t expect(uint8_t *out, const uint32_t *colors, uint16_t n) {
+  uint16_t len = 0;
+  for(uint16_t i=0; i<n; i++) {
+    out[len++] = (colors[i] >> 16) | 0x80;
+    out[len++] = (colors[i] >>  8) | 0x80;
+    out[len++] =  colors[i]        | 0x80;
+  }
+  for(uint16_t i=(n+31)/32; i>0; i--) out[len++] = 0;
+  return len;
+}
+
+static bool sent(const uint8_t *bytes, uint16_t len) {
+  return simSentLength == len && !memcmp(simSent, bytes, len);
+}
+
+static uint32_t color(uint16_t i, uint8_t seed) {
+  return ((uint32_t)((i * 5 + seed) & 0x7f) << 16) |
+         ((uint32_t)((i * 3 + seed * 7) & 0x7f) << 8) |
+                    ((i * 11 + seed * 13) & 0x7f);
+}
+
+// Each strip of a LPD8806Parallel, watched on its own data pin, gets
+// exactly the stream a LPD8806 with its pixels would.
+template<uint8_t N>
+static bool parallel(const char *what, const uint8_t *dpins, uint8_t cpin) {
+  const uint16_t n = 40;
+  static uint32_t colors[8][n];
+  static uint8_t expected[SIM_SENT_LENGTH];
+
+  LPD8806Parallel<N> strips(n, dpins, cpin);
+  strips.begin();
+  for(uint8_t s=0; s<N; s++)
+    for(uint16_t i=0; i<n; i++) {
+      colors[s][i] = color(i, s);
+      strips.setPixelColor(s, i, colors[s][i]);
+    }
+
+  bool ok = true;
+  for(uint8_t s=0; s<N; s++) {
+    uint16_t len = expect(expected, colors[s], n);
+    simWatchPins(dpins[s], cpin);
+    simResetCounts();
+    strips.show();
+    ok = ok && sent(expected, len);
+    ok = ok && strips.getPixelColor(s, n / 2) == colors[s][n / 2];
+  }
+  return report(what, ok);
+}
+
+// attachBuffer() and swapBuffer() turn down a buffer too small for the
+// strip, and swapBuffer() one while the strip's own is in use; a buffer
+// that's taken has its latch cleared and is what show() sends.
+static bool buffers(void) {
+  const uint16_t n = 40, size = LPD8806::bufferSize(n);
+  static uint8_t a[200], b[200], expected[SIM_SENT_LENGTH];
+  static uint32_t colors[n];
+  LPD8806 strip(n, 2, 3);
+  strip.begin();
+  uint8_t *own = strip.getPixels();
+
+  bool ok = size == n * 3 + 2 && size <= sizeof(a);
+  ok = ok && strip.swapBuffer(a, size) == NULL;
+  ok = ok && !strip.attachBuffer(a, size - 1);
+  ok = ok && !strip.attachBuffer(NULL, size);
+  ok = ok && strip.getPixels() == own;
+
+  memset(a, 0xff, sizeof(a));
+  ok = ok && strip.attachBuffer(a, size) && strip.getPixels() == a;
+  ok = ok && a[n * 3] == 0 && a[size - 1] == 0 && a[size] == 0xff;
+  ok = ok && strip.swapBuffer(b, size - 1) == NULL;
+  ok = ok && strip.swapBuffer(NULL, size) == NULL;
+  ok = ok && strip.getPixels() == a;
+
+  for(uint16_t i=0; i<n; i++) {
+    colors[i] = color(i, 3);
+    strip.setPixelColor(i, colors[i]);
+  }
+  memset(b, 0xff, sizeof(b));
+  memcpy(b, a, n * 3);
+  ok = ok && strip.swapBuffer(b, size) == a && strip.getPixels() == b;
+  ok = ok && b[n * 3] == 0 && b[size - 1] == 0 && b[size] == 0xff;
+
+  uint16_t len = expect(expected, colors, n);
+  simWatchPins(2, 3);
+  simResetCounts();
+  strip.show();
+  ok = ok && sent(expected, len);
+  return report("attachBuffer() and swapBuffer() sizes", ok);
+}
+
+// gradient() starts on 'from' and ends on 'to', however long the run,
+// and goes one way all along it.
+static bool gradient(LPD8806GRB from, LPD8806GRB to, uint16_t n) {
+  LPD8806 strip(n, 2, 3);
+  strip.begin();
+  strip.gradient(0, n, from, to);
+  const uint8_t *p = strip.getPixels(), *last = &p[(n - 1) * 3];
+
+  bool ok = p[0] == from.g && p[1] == from.r && p[2] == from.b;
+  ok = ok && last[0] == to.g && last[1] == to.r && last[2] == to.b;
+  for(uint16_t i=3; i<n*3; i++) {
+    int d = p[i] - p[i - 3], dir = (&to.g)[i % 3] - (&from.g)[i % 3];
+    ok = ok && (p[i] & 0x80) && (dir >= 0 ? d >= 0 : d <= 0);
+  }
+
+  char what[48];
+  sprintf(what, "gradient(), %u LEDs, %06x to %06x", n,
+    (unsigned)(((from.g & 0x7f) << 16) | ((from.r & 0x7f) << 8) | (from.b & 0x7f)),
+    (unsigned)(((to.g   & 0x7f) << 16) | ((to.r   & 0x7f) << 8) | (to.b   & 0x7f)));
+  return report(what, ok);
+}
+
+// At full brightness show() sends the buffer as it is.  Scaled, each
+// color is rounded to the nearest level; dithered, it's rounded up or
+// down from show to show, and over 16 shows averages to within 1/16 of
+// the exact level.
+static bool brightness(void) {
+  const uint16_t n = 64;
+  static uint32_t colors[n];
+  static uint8_t expected[SIM_SENT_LENGTH];
+  static uint16_t sums[n * 3];
+  LPD8806 strip(n, 2, 3);
+  strip.begin();
+  for(uint16_t i=0; i<n; i++) {
+    colors[i] = color(i, 5);
+    strip.setPixelColor(i, colors[i]);
+  }
+  const uint8_t *p = strip.getPixels();
+  simWatchPins(2, 3);
+
+  uint16_t len = expect(expected, colors, n);
+  simResetCounts();
+  strip.show();
+  bool full = sent(expected, len) && sent(p, LPD8806::bufferSize(n));
+  report("show() at full brightness", full);
+
+  const uint8_t levels[3] = { 0, 90, 200 };
+  bool nearest = true, dithered = true;
+  for(uint8_t l=0; l<3; l++) {
+    uint16_t scale = levels[l] + 1;
+    strip.setBrightness(levels[l]);
+
+    strip.setDither(false);
+    simResetCounts();
+    strip.show();
+    nearest = nearest && simSentLength == len;
+    for(uint16_t i=0; i<len; i++) {
+      uint8_t b = (i < n * 3) ? ((((p[i] & 0x7f) * scale + 0x80) >> 8) | 0x80) : 0;
+      nearest = nearest && simSent[i] == b;
+    }
+
+    strip.setDither(true);
+    memset(sums, 0, sizeof(sums));
+    for(uint8_t f=0; f<16; f++) {
+      simResetCounts();
+      strip.show();
+      dithered = dithered && simSentLength == len;
+      for(uint16_t i=0; i<n*3; i++) {
+        dithered = dithered && (simSent[i] & 0x80);
+        sums[i] += simSent[i] & 0x7f;
+      }
+      for(uint16_t i=n*3; i<len; i++) dithered = dithered && simSent[i] == 0;
+    }
+    // sums[i] is 16 times the average; the exact level times 16 is
+    // (p & 0x7f) * scale / 16
+    for(uint16_t i=0; i<n*3; i++) {
+      int32_t d = (int32_t)sums[i] * 16 - (int32_t)(p[i] & 0x7f) * scale;
+      dithered = dithered && d < 16 && d > -16;
+    }
+  }
+  strip.setBrightness(255);
+  strip.setDither(false);
+  report("show() dimmed, rounded to nearest", nearest);
+  report("show() dimmed and dithered, 16 shows", dithered);
+  return full && nearest && dithered;
+}
+
+int main(void) {
+  bool ok = true;
+
+  // Pins 0-7 are PORT 0, 8-15 PORT 1 and so on (see host_sim.cpp).
+  static const uint8_t scrambled[8] = { 3, 0, 7, 1, 6, 2, 5, 4 };
+  static const uint8_t shared[4]    = { 16, 18, 19, 21 };
+  static const uint8_t spread[3]    = { 0, 9, 20 };
+  ok = parallel<8>("parallel, 8 strips, clock on another PORT",
+                   scrambled, 8) && ok;
+  ok = parallel<4>("parallel, 4 strips, clock on the same PORT",
+                   shared, 17) && ok;
+  ok = parallel<3>("parallel, pins on 3 PORTs (digitalWrite)",
+                   spread, 30) && ok;
+  ok = buffers() && ok;
+
+  LPD8806GRB black = LPD8806::encode(0, 0, 0),
+             white = LPD8806::encode(127, 127, 127),
+             amber = LPD8806::encode(127, 40, 0);
+  ok = gradient(black, white, 300) && ok;
+  ok = gradient(white, black, 300) && ok;
+  ok = gradient(amber, black, 7) && ok;
+  ok = gradient(black, amber, 1000) && ok;
+  ok = brightness() && ok;
+
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+// Host-side check of LPD8806::show() against showAsync(), with a fake AVR
+// SPI peripheral standing in for the real one.  It counts the cycles the CPU
+// spends spinning on SPIF, and what the transfer complete interrupt costs
+// instead, and checks that both send the same bytes, at full brightness and
+// dimmed.
+//
+// Build and run from this directory:
+//   g++ -O2 -D__AVR_ATmega2560__ -I../host -o spi_sim spi_sim.cpp
+//     ../../LPD8806.cpp ../host/host_sim.cpp
+//   ./spi_sim
+
+#include <stdio.h>
+#include "host_sim.h"
+#include "SPI.h"
+#include "../../LPD8806.h"
+
+// Let the last byte out so the next run starts from an idle bus.  (Time
+// only passes here when something ticks it, so LPD8806::wait() would spin
+// forever.)
+static void drain(LPD8806 &strip) {
+  while(strip.busy() || simShifting) simTick(1);
+}
+
+static void fill(LPD8806 &strip, uint8_t seed) {
+  for(uint16_t i=0; i<strip.numPixels(); i++)
+    strip.setPixelColor(i, (i + seed) & 0x7f, (i * 3 + seed) & 0x7f,
+                        (i * 7 + seed) & 0x7f);
+}
+
+static bool run(uint8_t div, uint16_t leds) {
+  LPD8806 strip(leds);
+  strip.begin();
+  SPI.setClockDivider(div);
+  fill(strip, 0);
+  drain(strip);
+
+  // Blocking show()
+  simResetCounts();
+  uint32_t start = simNow;
+  strip.show();
+  uint32_t blocking = simNow - start;
+  uint32_t blockingIdle = simIdleCycles;
+  drain(strip);
+  static uint8_t expected[SIM_SENT_LENGTH];
+  uint16_t expectedLength = simSentLength;
+  memcpy(expected, simSent, simSentLength);
+
+  // showAsync(), with the main code counting while it waits
+  simResetCounts();
+  start = simNow;
+  strip.showAsync();
+  uint32_t returned = simNow - start;
+  uint32_t spare = 0;
+  while(strip.busy()) {
+    simTick(1);
+    if(!simInIsr) spare++;
+  }
+  uint32_t async = simNow - start;
+  drain(strip);
+  bool ok = (simSentLength == expectedLength) &&
+            !memcmp(simSent, expected, simSentLength) && simCollisions == 0;
+
+  // Double buffered: drawing over the next frame while this one goes out
+  // mustn't change what's sent.
+  if(!strip.doubleBuffer(true)) {
+    printf("doubleBuffer() failed\n");
+    return false;
+  }
+  simResetCounts();
+  strip.showAsync();
+  fill(strip, 0x55);
+  drain(strip);
+  ok = ok && (simSentLength == expectedLength) &&
+       !memcmp(simSent, expected, simSentLength) && simCollisions == 0;
+
+  printf("%6u %5u %6u | %8lu %8lu %5.1f%% | %6lu %8lu %8lu %8lu %5.1f%% | %s\n",
+         div, leds, expectedLength,
+         (unsigned long)blocking, (unsigned long)blockingIdle,
+         100.0 * blockingIdle / blocking,
+         (unsigned long)returned, (unsigned long)async,
+         (unsigned long)simIsrCycles, (unsigned long)spare,
+         100.0 * spare / async, ok ? "ok" : "MISMATCH");
+  return ok;
+}
+
+// Dimmed, show() scales each byte while the one before it shifts out, and
+// showAsync() from the interrupt; both should send the same bytes, with the
+// bus never loaded early.
+static bool dimmed(uint8_t div, uint16_t leds) {
+  LPD8806 strip(leds);
+  strip.begin();
+  SPI.setClockDivider(div);
+  fill(strip, 0);
+  strip.setBrightness(90);
+  drain(strip);
+
+  simResetCounts();
+  uint32_t start = simNow;
+  strip.show();
+  uint32_t blocking = simNow - start;
+  drain(strip);
+  static uint8_t expected[SIM_SENT_LENGTH];
+  uint16_t expectedLength = simSentLength;
+  memcpy(expected, simSent, simSentLength);
+  bool ok = simCollisions == 0;
+
+  const uint8_t *p = strip.getPixels();
+  for(uint16_t i=0; i<leds*3; i++)
+    ok = ok && expected[i] == ((((p[i] & 0x7f) * 91 + 0x80) >> 8) | 0x80);
+
+  simResetCounts();
+  strip.showAsync();
+  drain(strip);
+  ok = ok && (simSentLength == expectedLength) &&
+       !memcmp(simSent, expected, simSentLength) && simCollisions == 0;
+
+  printf("%6u %5u %6u | %8lu dimmed %19s | %s\n", div, leds, expectedLength,
+         (unsigned long)blocking, "", ok ? "ok" : "MISMATCH");
+  return ok;
+}
+
+int main(void) {
+  printf("%-19s | %-26s | %-45s |\n", "", "show()", "showAsync()");
+  printf("%6s %5s %6s | %8s %8s %6s | %6s %8s %8s %8s %6s |\n",
+         "div", "LEDs", "bytes", "cycles", "waiting", "idle",
+         "return", "cycles", "ISR", "free", "free");
+
+  static const uint8_t divs[] = { 2, 4, 8, 16 };
+  static const uint16_t lengths[] = { 32, 160 };
+  bool ok = true;
+  for(uint8_t d=0; d<sizeof(divs); d++)
+    for(uint8_t n=0; n<sizeof(lengths)/sizeof(lengths[0]); n++) {
+      ok = run(divs[d], lengths[n]) && ok;
+      ok = dimmed(divs[d], lengths[n]) && ok;
+    }
+  return ok ? 0 : 1;
+}
@@ -1,5 +1,5 @@
-#include <Wire.h>
 #include <Arduino.h>
+#include "i2c_queue.h"
 #include "smart_card.h"
 
 #define SMART_CARD_ADDRESS( block ) (0x50 | (block) )
@@ -8,60 +8,204 @@
 
 void SmartCard::init()
 {
-  Wire.begin();
+  I2CQueue::begin();
 }
 
-SmartCard::SmartCard() : block_num(0), subaddress(0)
+SmartCard::SmartCard()
+  : _address(0), _writing(false), _cache(_lines[0]), _cache_address(0),
+    _cache_length(0), _ahead_subaddress(0), _ahead_address(0),
+    _ahead_length(0)
 {
-  seek(0);
 }
 
 void SmartCard::seek(uint16_t full_address)
 {
-  subaddress = full_address & 0xff;
-  block_num = (full_address >> 8) & 0x8;
+  _address = full_address % SMART_CARD_LENGTH;
 
 #ifdef PRINT_DEBUG
-  Serial.print("Seeking  "); Serial.print(block_num);
-  Serial.print(":"); Serial.println(subaddress);
-#endif PRINT_DEBUG
-  
-  // Wire.beginTransmission( SMART_CARD_ADDRESS( block_num ) );
-  // Wire.write( subaddress );
-  // Wire.endTransmission();
+  Serial.print("Seeking  "); Serial.print(_block());
+  Serial.print(":"); Serial.println(_subaddress());
+#endif // PRINT_DEBUG
+}
+
+bool SmartCard::wait_ready()
+{
+  if (!_writing)
+    return true;
+
+  // The chip ignores its address until the write cycle is over, so keep
+  // addressing it until it acknowledges. That's usually well under the 5 ms
+  // the datasheet allows.
+  unsigned long start = millis();
+  do {
+    _t.set( SMART_CARD_ADDRESS( _block() ), NULL, 0, NULL, 0 );
+    if (I2CQueue::run(&_t) == I2C_DONE) {
+      _writing = false;
+      return true;
+    }
+  } while (millis() - start < SMART_CARD_WRITE_TIMEOUT_MS);
+
+  return false;
 }
 
 void SmartCard::write( uint8_t byte )
 {
+  write(&byte, 1);
+}
+
+uint16_t SmartCard::write( const uint8_t* bytes, uint16_t size )
+{
+  uint16_t written = 0;
+
+  // It could be reading what's about to change.
+  _drop_read_ahead();
+
+  while (written < size) {
 #ifdef PRINT_DEBUG
-  Serial.print("Writing "); Serial.print(block_num);
-  Serial.print(":"); Serial.println(subaddress);
-#endif PRINT_DEBUG
-  
-  // Assume we are at the write location internally.
-  Wire.beginTransmission( SMART_CARD_ADDRESS( block_num ) );
-  Wire.write( subaddress );
-  Wire.write( byte );
-  Wire.endTransmission();
-
-  _increment_address();
+    Serial.print("Writing "); Serial.print(_block());
+    Serial.print(":"); Serial.println(_subaddress());
+#endif // PRINT_DEBUG
+
+    if (!wait_ready())
+      break;
+
+    // The chip wraps around within a page rather than carry on to the next
+    // one, so each write stops at the end of the page. Pages don't straddle
+    // blocks, so that's never past the end of the block either.
+    uint8_t count = SMART_CARD_PAGE_LENGTH -
+      (_address % SMART_CARD_PAGE_LENGTH);
+    if (count > size - written)
+      count = size - written;
+
+    _out[0] = _subaddress();
+    memcpy(_out + 1, bytes + written, count);
+    _t.set( SMART_CARD_ADDRESS( _block() ), _out, 1 + count, NULL, 0 );
+    if (I2CQueue::run(&_t) != I2C_DONE)
+      break;
+
+    // Don't wait for it here; the next transfer will if it has to.
+    _writing = true;
+    if (uint16_t(_address - _cache_address) < _cache_length ||
+        uint16_t(_cache_address - _address) < count)
+      _cache_length = 0;
+    written += count;
+    _advance(count);
+  }
+
+  return written;
 }
 
-  
-uint8_t SmartCard::read(  )
+/**
+ * Fill the cache from the current address on, as far as the end of the
+ * block: the block is part of the device address, so the next one has to be
+ * addressed anew.
+ */
+bool SmartCard::_fill_cache()
 {
 #ifdef PRINT_DEBUG
-  Serial.print("Reading "); Serial.print(block_num);
-  Serial.print(":"); Serial.println(subaddress);
-#endif PRINT_DEBUG
-  Wire.beginTransmission( SMART_CARD_ADDRESS( block_num ) );
-  Wire.write( subaddress );
-  Wire.endTransmission(false);
+  Serial.print("Reading "); Serial.print(_block());
+  Serial.print(":"); Serial.println(_subaddress());
+#endif // PRINT_DEBUG
+
+  // Reading on from the last line, it's usually on its way already. A line
+  // from prefetch() is only read on from once reads carry on into the next.
+  if (_in_ahead() && I2CQueue::wait(&_ahead) == I2C_DONE) {
+    bool sequential =
+      _ahead_address == (_cache_address + _cache_length) % SMART_CARD_LENGTH;
+    _cache = _ahead.in;
+    _cache_address = _ahead_address;
+    _cache_length = _ahead_length;
+    _ahead_length = 0;
+    if (sequential)
+      _read_ahead((_cache_address + _cache_length) % SMART_CARD_LENGTH);
+    return true;
+  }
+
+  // Only read ahead once reads carry on from one line to the next; after a
+  // seek, the line after might not be wanted, and would hold up the bus.
+  bool sequential =
+    _address == (_cache_address + _cache_length) % SMART_CARD_LENGTH;
+
+  _drop_read_ahead();
+  _cache_length = 0;
+  if (!wait_ready())
+    return false;
+
+  uint8_t count = SMART_CARD_CACHE_LENGTH;
+  if (count > _to_block_end())
+    count = _to_block_end();
+
+  _out[0] = _subaddress();
+  _t.set( SMART_CARD_ADDRESS( _block() ), _out, 1, _cache, count );
+  if (I2CQueue::run(&_t) != I2C_DONE)
+    return false;
+
+  _cache_address = _address;
+  _cache_length = count;
+  if (sequential)
+    _read_ahead((_cache_address + _cache_length) % SMART_CARD_LENGTH);
+  return true;
+}
+
+void SmartCard::prefetch()
+{
+  if (_in_cache() || _in_ahead())
+    return;
+  _drop_read_ahead();
+  // _read_ahead() leaves the chip alone while it's writing.
+  if (wait_ready())
+    _read_ahead(_address);
+}
+
+/**
+ * Start reading the line from 'next' on into the other buffer.
+ */
+void SmartCard::_read_ahead(uint16_t next)
+{
+  // The chip won't answer while it's writing.
+  if (_writing)
+    return;
+
+  uint8_t count = SMART_CARD_CACHE_LENGTH;
+  if (count > SMART_CARD_BLOCK_LENGTH - (next & 0xff))
+    count = SMART_CARD_BLOCK_LENGTH - (next & 0xff);
+
+  _ahead_subaddress = next & 0xff;
+  _ahead.set( SMART_CARD_ADDRESS( next >> 8 ), &_ahead_subaddress, 1,
+              _cache == _lines[0] ? _lines[1] : _lines[0], count );
+  if (I2CQueue::submit(&_ahead)) {
+    _ahead_address = next;
+    _ahead_length = count;
+  }
+}
+
+/**
+ * Forget the line read ahead. It has to be off the bus before its buffer
+ * can be used again.
+ */
+void SmartCard::_drop_read_ahead()
+{
+  I2CQueue::wait(&_ahead);
+  _ahead_length = 0;
+}
+
+uint16_t SmartCard::read( uint8_t* bytes, uint16_t size )
+{
+  uint16_t done = 0;
+
+  while (done < size) {
+    if (!_in_cache() && !_fill_cache())
+      break;
 
-  Wire.requestFrom( SMART_CARD_ADDRESS( block_num ), 1 );
+    uint8_t offset = _address - _cache_address;
+    uint16_t count = _cache_length - offset;
+    if (count > size - done)
+      count = size - done;
 
-  uint8_t byte = Wire.read();
+    memcpy(bytes + done, _cache + offset, count);
+    done += count;
+    _advance(count);
+  }
 
-  _increment_address();
-  return byte;
+  return done;
 }
@@ -1,41 +1,157 @@
 #ifndef SMART_CARD_H__
 #define SMART_CARD_H__
 
+#include "i2c_queue.h"
+
 enum SmartCardType
 {
   SMART_CARD_IS24C16A,
   SMART_CARD_NUM_TYPES
 };
 
+#define SMART_CARD_LENGTH        2048
+#define SMART_CARD_BLOCK_LENGTH  256
+#define SMART_CARD_PAGE_LENGTH   16
+
+// A write cycle takes at most 5 ms; give up on the chip after this long.
+#define SMART_CARD_WRITE_TIMEOUT_MS  20
+
+// Reads are served from a cache line this long, filled with one sequential
+// read. While it's being read from, the line after it comes in over the bus
+// in the background.
+#define SMART_CARD_CACHE_LENGTH  32
+
 class SmartCard
 {
 public:
   /**
-   * Common initialization routing for all smart card usage.
+   * Common initialization routing for all smart card usage. All of the I2C
+   * goes through I2CQueue.
    */
   static void init();
   
   SmartCard();
 
   void write(uint8_t byte);
-  uint8_t write(const uint8_t* bytes, uint16_t size);
 
-  uint8_t read();
+  /**
+   * Writes 'size' bytes from the current address on, a page (or what's left
+   * of one) per transaction. Returns how many were written, which is less
+   * than 'size' only if the chip stopped answering.
+   */
+  uint16_t write(const uint8_t* bytes, uint16_t size);
+
+  /**
+   * Reads the byte at the current address. Only the first byte of each cache
+   * line costs a transfer.
+   */
+  uint8_t read() {
+    if (_in_cache()) {
+      uint8_t byte = _cache[_address - _cache_address];
+      _advance(1);
+      return byte;
+    }
+    uint8_t byte = 0;
+    read(&byte, 1);
+    return byte;
+  }
+
+  /**
+   * Reads 'size' bytes from the current address on, through the cache.
+   * Returns how many were read.
+   */
   uint16_t read(uint8_t* bytes, uint16_t size);
 
+  /**
+   * Moves to an address from 0 to SMART_CARD_LENGTH - 1. Nothing is sent
+   * until the next read or write; the cache is kept, so seeking back into it
+   * is free.
+   */
   void seek(uint16_t addy);
+
+  uint16_t tell() const {
+    return _address;
+  }
+
+  /**
+   * True if the byte at the current address can be read without waiting for
+   * the bus: it's in the cache, or in a line that's been read ahead.
+   */
+  bool ready() const {
+    return _in_cache() || (_in_ahead() && !_ahead.busy());
+  }
+
+  /**
+   * Start reading the line at the current address in the background, as if
+   * it were the one after the cache, so that reading it later doesn't wait
+   * for the bus. Waits for a line that's already coming in, or a write, to
+   * finish first.
+   */
+  void prefetch();
+
+  /**
+   * True while a line read ahead is still coming in. A read from anywhere
+   * else would have to wait for it to finish first.
+   */
+  bool busy() const {
+    return _ahead.busy();
+  }
+
+  /**
+   * Waits for the last write to finish, by polling the chip until it
+   * acknowledges its address again. Returns false if it never does.
+   */
+  bool wait_ready();
   
 private:
-  uint8_t block_num, subaddress;
-  
-  void _increment_address() {
-      // Increment the address.
-    ++subaddress;
-    if (subaddress == 0) {
-      block_num = (block_num + 1) % 8;
-    }
+  // The full address; the top 3 bits are the block, which goes in the device
+  // address, and the rest is the address within the block.
+  uint16_t _address;
+  bool _writing;
+
+  uint8_t _lines[2][SMART_CARD_CACHE_LENGTH];
+  uint8_t* _cache;
+  uint16_t _cache_address;
+  uint8_t _cache_length;
+
+  // The line after the cache (or from prefetch()), read ahead into the
+  // other buffer.
+  I2CTransaction _ahead;
+  uint8_t _ahead_subaddress;
+  uint16_t _ahead_address;
+  uint8_t _ahead_length;
+
+  // Everything else, which is waited for.
+  I2CTransaction _t;
+  uint8_t _out[1 + SMART_CARD_PAGE_LENGTH];
+
+  uint8_t _block() const {
+    return _address >> 8;
+  }
+
+  uint8_t _subaddress() const {
+    return _address & 0xff;
+  }
+
+  uint16_t _to_block_end() const {
+    return SMART_CARD_BLOCK_LENGTH - _subaddress();
+  }
+
+  bool _in_cache() const {
+    return uint16_t(_address - _cache_address) < _cache_length;
+  }
+
+  bool _in_ahead() const {
+    return uint16_t(_address - _ahead_address) < _ahead_length;
   }
-};
 
+  bool _fill_cache();
+  void _read_ahead(uint16_t next);
+  void _drop_read_ahead();
+
+  void _advance(uint16_t count) {
+    _address = (_address + count) % SMART_CARD_LENGTH;
+  }
+};
 
 #endif